@@ -0,0 +1,30 @@
+#!/bin/sh
+# Measure fiber switch time and memory per fiber. Runs bench/fibers.lox with the allocation counting build, once as
+# it is and once with no spawned fibers, and divides the difference in peak RSS and in bytes allocated by the number
+# of fibers.
+#
+# Usage: bench/fibers.sh   (builds bench/clox-alloc first if need be)
+
+SCRIPT=bench/fibers.lox
+CLOX=${CLOX:-bench/clox-alloc}
+[ -x "$CLOX" ] || make "$CLOX" > /dev/null || exit $?
+
+FIBERS=$(sed -n 's/^var FIBERS = \([0-9]*\);/\1/p' "$SCRIPT")
+EMPTY=$(mktemp)
+trap 'rm -f "$EMPTY"' EXIT
+sed 's/^var FIBERS = [0-9]*;/var FIBERS = 0;/' "$SCRIPT" > "$EMPTY"
+
+# Prints "<bytes allocated> <peak RSS in KB>", and the script's output on the first line
+measure() {
+    "$CLOX" "$1" 2> "$EMPTY.stats" | sed -n 3p
+    sed -n 's/.*bytes \([0-9]*\), peak RSS \([0-9]*\) KB.*/\1 \2/p' "$EMPTY.stats"
+    rm -f "$EMPTY.stats"
+}
+
+full=$(measure "$SCRIPT")
+empty=$(measure "$EMPTY")
+
+echo "$full" | sed -n 1p | awk '{ printf "%.1f ns per switch\n", $1 }'
+{ echo "$full" | sed -n 2p; echo "$empty" | sed -n 2p; } | paste - - | awk -v n="$FIBERS" '{
+    printf "%d fibers: %.0f bytes allocated and %.0f bytes of peak RSS per fiber\n", n, ($1 - $3) / n, ($2 - $4) * 1024 / n
+}'
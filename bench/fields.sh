@@ -0,0 +1,19 @@
+#!/bin/sh
+# Compare instances laid out by shapes, with inline caches on every property instruction, against instances that keep
+# their fields in a hash table each. Both builds run the same script, which prints a checksum followed by the time it
+# took, so the two can be checked against each other as well as timed.
+#
+# Usage: bench/fields.sh [script] [runs]
+#
+# Expects bench/clox-release and bench/clox-fieldtables, which `make fieldbench` builds before running this.
+
+SCRIPT=${1:-bench/fields.lox}
+RUNS=${2:-5}
+
+for build in release fieldtables; do
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        echo "$build: $("bench/clox-$build" "$SCRIPT" | tr '\n' ' ')"
+        i=$((i + 1))
+    done
+done
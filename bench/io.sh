@@ -0,0 +1,63 @@
+#!/bin/sh
+# Measure file I/O throughput. Writes FILES small files with bench/io/write.lox and reads them back with
+# bench/io/read.lox, in a fresh temporary directory for each I/O backend, and reports files per second. sync is
+# plain stdio, one file after another. threads and uring have every file in flight at once.
+#
+# Warm reads come from the page cache, since the files were just written. Cold reads drop the page cache before each
+# run, which needs root, and are left out otherwise. Each figure is the best of RUNS runs.
+#
+# Usage: bench/io.sh   (builds bench/clox-release first if need be)
+
+CLOX=${CLOX:-bench/clox-release}
+RUNS=${RUNS:-3}
+[ -x "$CLOX" ] || make "$CLOX" > /dev/null || exit $?
+
+CLOX=$(cd "$(dirname "$CLOX")" && pwd)/$(basename "$CLOX")
+BENCH=$(cd "$(dirname "$0")" && pwd)/io
+FILES=$(sed -n 's/^var FILES = \([0-9]*\);/\1/p' "$BENCH/write.lox")
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+
+COLD=
+if [ -w /proc/sys/vm/drop_caches ]; then COLD=yes; fi
+
+# Prints the best wall time in nanoseconds of running $2 with --io $1 in $3, dropping the page cache first if $4 is
+# set. Fails if the script doesn't print FILES
+best() {
+    fastest=
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        if [ -n "$4" ]; then
+            sync
+            echo 3 > /proc/sys/vm/drop_caches
+        fi
+
+        start=$(date +%s%N)
+        output=$(cd "$3" && "$CLOX" --io "$1" "$2") || return 1
+        end=$(date +%s%N)
+        if [ "$output" != "$FILES" ]; then
+            echo "$1: $(basename "$2") printed $output, expected $FILES" >&2
+            return 1
+        fi
+
+        elapsed=$((end - start))
+        if [ -z "$fastest" ] || [ $elapsed -lt "$fastest" ]; then fastest=$elapsed; fi
+        run=$((run + 1))
+    done
+    echo "$fastest"
+}
+
+printf "%d files of about 260 bytes, in files per second\n" "$FILES"
+printf "%-8s %12s %12s %12s\n" "backend" "writes" "warm reads" "cold reads"
+for backend in sync threads uring; do
+    dir="$ROOT/$backend"
+    mkdir "$dir"
+    writes=$(best $backend "$BENCH/write.lox" "$dir") || exit 1
+    warm=$(best $backend "$BENCH/read.lox" "$dir") || exit 1
+    cold=0
+    if [ -n "$COLD" ]; then cold=$(best $backend "$BENCH/read.lox" "$dir" cold) || exit 1; fi
+
+    echo "$backend $writes $warm $cold" | awk -v n="$FILES" '{
+        printf "%-8s %12.0f %12.0f %12s\n", $1, n * 1e9 / $2, n * 1e9 / $3, ($4 > 0 ? sprintf("%.0f", n * 1e9 / $4) : "-")
+    }'
+done
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Measure how isolate throughput scales with the number of worker threads. Runs the same script COPIES times with
+# `clox --isolates`, once for every thread count from 1 to MAX_THREADS.
+#
+# Build without the debug output first, or the tracing will dominate:
+#     make clean && make CFLAGS="-O2 -DNDEBUG"
+#
+# Usage: bench/isolates.sh [script] [copies] [max threads]
+
+SCRIPT=${1:-bench/isolates.lox}
+COPIES=${2:-256}
+MAX_THREADS=${3:-$(nproc)}
+CLOX=${CLOX:-./clox}
+
+set -- 
+i=0
+while [ $i -lt "$COPIES" ]; do
+    set -- "$@" "$SCRIPT"
+    i=$((i + 1))
+done
+
+threads=1
+while [ $threads -le "$MAX_THREADS" ]; do
+    "$CLOX" --isolates $threads "$@" > /dev/null || exit $?
+    threads=$((threads + 1))
+done
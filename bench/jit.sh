@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compare the interpreter with the baseline JIT on the same script. The script prints its result followed by the
+# time it took, so the two runs can be checked against each other as well as timed.
+#
+# Build without the debug output first, or the tracing will dominate:
+#     make clean && make CFLAGS="-O2 -DNDEBUG"
+#
+# Usage: bench/jit.sh [script] [runs]
+
+SCRIPT=${1:-bench/jit.lox}
+RUNS=${2:-5}
+CLOX=${CLOX:-./clox}
+
+for mode in "" "--jit"; do
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        echo "${mode:-interpreter}: $("$CLOX" $mode "$SCRIPT" | tr '\n' ' ')"
+        i=$((i + 1))
+    done
+done
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Measure startup of a large library that a script only uses a little of, compiling every function body up front and
+# with --lazy. Generates FUNCTIONS functions with CASES string constants each, followed by calls to CALLED of them,
+# then reports the mean wall time of RUNS runs, plus the bytes allocated and peak RSS that bench/clox-alloc reports.
+# FUNCTIONS stays under 128, since each global function takes two of the script's 256 constants.
+#
+# Usage: bench/lazy.sh   (builds bench/clox-release and bench/clox-alloc first if need be)
+
+CLOX=${CLOX:-bench/clox-release}
+FUNCTIONS=${FUNCTIONS:-120}
+CASES=${CASES:-60}
+CALLED=${CALLED:-3}
+RUNS=${RUNS:-200}
+[ -x "$CLOX" ] || make "$CLOX" > /dev/null || exit $?
+make bench/clox-alloc > /dev/null || exit $?
+
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+awk -v n="$FUNCTIONS" -v cases="$CASES" -v called="$CALLED" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fun f%d(x) {\n", i
+        for (c = 0; c < cases; c++) {
+            printf "    if (x == %d) return \"case %d of function %d in the library\";\n", c, c, i
+        }
+        printf "    var total = 0;\n"
+        printf "    for (var i = 0; i < x; i = i + 1) total = total + i * %d;\n", i % 7 + 1
+        printf "    return total;\n"
+        printf "}\n"
+    }
+    for (i = 0; i < called; i++) printf "print f%d(%d);\n", i * 7 % n, i
+}' > "$SCRIPT"
+
+# Prints the mean wall time of one run in microseconds, running "$CLOX" with the given arguments RUNS times
+mean() {
+    "$CLOX" "$@" > /dev/null || return 1  # Warm the page cache
+    start=$(date +%s%N)
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        "$CLOX" "$@" > /dev/null
+        run=$((run + 1))
+    done
+    end=$(date +%s%N)
+    echo $(((end - start) / RUNS / 1000))
+}
+
+# Prints the bytes allocated and the peak RSS in KB of one run
+memory() {
+    bench/clox-alloc "$@" 2>&1 > /dev/null | sed -n 's/.*bytes \([0-9]*\), peak RSS \([0-9]*\) KB.*/\1 \2/p'
+}
+
+echo "$FUNCTIONS functions, $CALLED called, $(wc -c < "$SCRIPT") byte script"
+printf "%-10s %10s %12s %14s\n" "compile" "mean (us)" "bytes" "peak RSS (KB)"
+for mode in eager --lazy; do
+    flag=$mode
+    [ "$mode" = eager ] && flag=
+    set -- $(memory $flag "$SCRIPT")
+    printf "%-10s %10s %12s %14s\n" "${mode#--}" "$(mean $flag "$SCRIPT")" "$1" "$2"
+done
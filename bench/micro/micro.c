@@ -0,0 +1,383 @@
+/**
+    Microbenchmarks for the hot C routines, each measured on its own: string hashing, the hash table, string
+    interning, the scanner, the compiler, number formatting and the allocator. Built and run by `make microbench`.
+
+    Every benchmark does a fixed batch of operations per repetition. Repetitions are preceded by untimed warmup runs,
+    and each one is timed with clock_gettime and, on x86-64, with rdtsc. Setup and teardown around a repetition aren't
+    timed. Results go to stdout as tab separated lines, one per benchmark:
+
+        name  ops  reps  median_ns  min_ns  median_cycles
+
+    where the three measurements are per operation. Cycles are reference cycles (rdtsc), or 0 where unavailable.
+
+    Usage: bench/clox-micro [--reps <n>] [--warmup <n>] [name filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "../../src/common.h"
+#include "../../src/compiler/compiler.h"
+#include "../../src/memory/memory.h"
+#include "../../src/object/object.h"
+#include "../../src/output/output.h"
+#include "../../src/scanner/scanner.h"
+#include "../../src/table/table.h"
+#include "../../src/vm/vm.h"
+
+#define KEY_COUNT 1024
+#define MAX_REPS 1000
+
+typedef struct {
+    const char* name;
+    int ops;  // Operations per repetition, to report per operation numbers
+    void (*setup)(void);
+    void (*run)(void);
+    void (*teardown)(void);
+} Benchmark;
+
+// Shared fixture state. Benchmarks run one at a time, so plain globals are enough
+static VM vm;
+static Table table;
+static ObjString* keys[KEY_COUNT];
+static char keyChars[KEY_COUNT][16];
+static uint32_t keyHashes[KEY_COUNT];
+static char* ownedChars[KEY_COUNT];
+static void* blocks[KEY_COUNT];
+static double numbers[KEY_COUNT];
+static char* source;
+static char* largeSource;
+static volatile uint64_t sink;  // Results are written here so the compiler can't drop the work being measured
+
+static uint64_t nowNanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static uint64_t nowCycles(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void nothing(void) {}
+
+/**
+    Source text for the scanner and compiler benchmarks: a representative mix of declarations, calls, operators,
+    string and number literals
+ */
+static char* makeSource(int functions) {
+    size_t capacity = (size_t)functions * 256 + 64;
+    char* text = malloc(capacity);
+    size_t length = 0;
+
+    for (int i = 0; i < functions; i++) {
+        length += snprintf(text + length, capacity - length,
+                           "fun f%d(a, b) {\n"
+                           "    var c = a * %d.5 + b / 3 - (a - b);\n"
+                           "    var s = \"name\" + \"%d\";\n"
+                           "    print c >= 10 == !(a != b);\n"
+                           "    return c + f%d(b, a);\n"
+                           "}\n", i, i, i, i);
+    }
+    return text;
+}
+
+/**
+    A much larger source for compile latency: *functions* functions of *statements* statements each. The bodies only
+    use locals, so no chunk runs into the 256 constant limit however long they get
+ */
+static char* makeLargeSource(int functions, int statements) {
+    size_t capacity = (size_t)functions * ((size_t)statements * 64 + 64) + 64;
+    char* text = malloc(capacity);
+    size_t length = 0;
+
+    for (int i = 0; i < functions; i++) {
+        length += snprintf(text + length, capacity - length, "fun g%d(a, b) {\n    var c = a;\n", i);
+        for (int j = 0; j < statements; j++) {
+            length += snprintf(text + length, capacity - length, "    c = (a * b - c) / (a + -b) >= c == !(a < b);\n");
+        }
+        length += snprintf(text + length, capacity - length, "    return c;\n}\n");
+    }
+    return text;
+}
+
+// Fixtures
+
+static void setupVM(void) {
+    initVM(&vm);
+}
+
+static void teardownVM(void) {
+    freeVM(&vm);
+}
+
+static void setupKeys(void) {
+    initVM(&vm);
+    for (int i = 0; i < KEY_COUNT; i++) {
+        snprintf(keyChars[i], sizeof(keyChars[i]), "key%d", i);
+        keys[i] = copyString(&vm, keyChars[i], (int)strlen(keyChars[i]));
+        keyHashes[i] = keys[i]->hash;
+    }
+    initTable(&table);
+}
+
+static void teardownKeys(void) {
+    freeTable(&table);
+    freeVM(&vm);
+}
+
+static void setupFilledTable(void) {
+    setupKeys();
+    for (int i = 0; i < KEY_COUNT; i++) tableSet(&table, keys[i], NUMBER_VAL(i));
+}
+
+// Only every other key is in the table, so lookups alternate between hits and misses
+static void setupHalfTable(void) {
+    setupKeys();
+    for (int i = 0; i < KEY_COUNT; i += 2) tableSet(&table, keys[i], NUMBER_VAL(i));
+}
+
+static void setupOwnedChars(void) {
+    setupKeys();
+    for (int i = 0; i < KEY_COUNT; i++) {
+        int length = (int)strlen(keyChars[i]);
+        ownedChars[i] = ALLOCATE(char, length + 1);
+        memcpy(ownedChars[i], keyChars[i], length + 1);
+    }
+}
+
+static void setupNewOwnedChars(void) {
+    initVM(&vm);
+    for (int i = 0; i < KEY_COUNT; i++) {
+        snprintf(keyChars[i], sizeof(keyChars[i]), "new%d", i);
+        int length = (int)strlen(keyChars[i]);
+        ownedChars[i] = ALLOCATE(char, length + 1);
+        memcpy(ownedChars[i], keyChars[i], length + 1);
+    }
+}
+
+// A mix of what scripts print: small integers, fractions, large and tiny numbers
+static void setupNumbers(void) {
+    for (int i = 0; i < KEY_COUNT; i++) {
+        switch (i % 4) {
+            case 0: numbers[i] = i; break;
+            case 1: numbers[i] = i * 0.37 + 1; break;
+            case 2: numbers[i] = i / 7.0; break;
+            case 3: numbers[i] = i * 123456789.0; break;
+        }
+    }
+}
+
+// Benchmarks
+
+static void benchHashShort(void) {
+    uint32_t hash = 0;
+    for (int i = 0; i < KEY_COUNT; i++) hash ^= hashString(keyChars[i], (int)strlen(keyChars[i]));
+    sink = hash;
+}
+
+static void benchHashLong(void) {
+    static const char text[] = "a string of sixty four characters, for hashing longer keys.....";
+    uint32_t hash = 0;
+    for (int i = 0; i < KEY_COUNT; i++) hash ^= hashString(text, (int)sizeof(text) - 1 - (i & 7));
+    sink = hash;
+}
+
+static void benchTableSet(void) {
+    for (int i = 0; i < KEY_COUNT; i++) tableSet(&table, keys[i], NUMBER_VAL(i));
+}
+
+// findEntry is private to table.c. A hit through tableGet is findEntry plus one key check
+static void benchFindEntry(void) {
+    Value value;
+    uint64_t found = 0;
+    for (int i = 0; i < KEY_COUNT; i++) found += tableGet(&table, keys[(i * 7) % KEY_COUNT], &value);
+    sink = found;
+}
+
+static void benchTableFindString(void) {
+    uint64_t found = 0;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        int key = (i * 7) % KEY_COUNT;
+        found += tableFindString(&table, keyChars[key], (int)strlen(keyChars[key]), keyHashes[key]) != NULL;
+    }
+    sink = found;
+}
+
+static void benchCopyStringInterned(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < KEY_COUNT; i++) total += copyString(&vm, keyChars[i], (int)strlen(keyChars[i]))->length;
+    sink = total;
+}
+
+static void benchCopyStringNew(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        char chars[16];
+        int length = snprintf(chars, sizeof(chars), "new%d", i);
+        total += copyString(&vm, chars, length)->length;
+    }
+    sink = total;
+}
+
+static void benchTakeString(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < KEY_COUNT; i++) total += takeString(&vm, ownedChars[i], (int)strlen(keyChars[i]))->length;
+    sink = total;
+}
+
+static void benchScanToken(void) {
+    Scanner scanner;
+    initScanner(&scanner, source, strlen(source));
+
+    uint64_t tokens = 0;
+    while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+    sink = tokens;
+}
+
+static void benchCompile(void) {
+    sink = (uint64_t)(uintptr_t)compile(&vm, source, strlen(source));
+}
+
+static void benchFormatNumber(void) {
+    char chars[NUMBER_BUFFER_BYTES];
+    uint64_t total = 0;
+    for (int i = 0; i < KEY_COUNT; i++) total += formatNumber(numbers[i], chars);
+    sink = total;
+}
+
+// What formatNumber() replaced
+static void benchSnprintfNumber(void) {
+    char chars[NUMBER_BUFFER_BYTES];
+    uint64_t total = 0;
+    for (int i = 0; i < KEY_COUNT; i++) total += snprintf(chars, sizeof(chars), "%g", numbers[i]);
+    sink = total;
+}
+
+static void benchReallocateFixed(void) {
+    for (int i = 0; i < KEY_COUNT; i++) blocks[i] = reallocate(NULL, 0, 64);
+    for (int i = 0; i < KEY_COUNT; i++) reallocate(blocks[i], 64, 0);
+}
+
+// Grow one array the way chunks and value arrays do, from empty up to 64K elements
+static void benchReallocateGrow(void) {
+    uint8_t* array = NULL;
+    int capacity = 0;
+    while (capacity < 65536) {
+        int oldCapacity = capacity;
+        capacity = GROW_CAPACITY(oldCapacity);
+        array = GROW_ARRAY(array, uint8_t, oldCapacity, capacity);
+        array[capacity - 1] = 1;
+    }
+    FREE_ARRAY(uint8_t, array, capacity);
+}
+
+static void benchCompileLarge(void) {
+    sink = (uint64_t)(uintptr_t)compile(&vm, largeSource, strlen(largeSource));
+}
+
+static int countTokens(const char* text) {
+    Scanner scanner;
+    initScanner(&scanner, text, strlen(text));
+
+    int tokens = 0;
+    while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+    return tokens;
+}
+
+static int compareUint64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void runBenchmark(Benchmark* benchmark, int warmup, int reps) {
+    static uint64_t nanoseconds[MAX_REPS];
+    static uint64_t cycles[MAX_REPS];
+
+    for (int i = 0; i < warmup; i++) {
+        benchmark->setup();
+        benchmark->run();
+        benchmark->teardown();
+    }
+
+    for (int i = 0; i < reps; i++) {
+        benchmark->setup();
+        uint64_t startNanoseconds = nowNanoseconds();
+        uint64_t startCycles = nowCycles();
+        benchmark->run();
+        cycles[i] = nowCycles() - startCycles;
+        nanoseconds[i] = nowNanoseconds() - startNanoseconds;
+        benchmark->teardown();
+    }
+
+    qsort(nanoseconds, reps, sizeof(uint64_t), compareUint64);
+    qsort(cycles, reps, sizeof(uint64_t), compareUint64);
+
+    printf("%s\t%d\t%d\t%.2f\t%.2f\t%.2f\n", benchmark->name, benchmark->ops, reps,
+           (double)nanoseconds[reps / 2] / benchmark->ops, (double)nanoseconds[0] / benchmark->ops,
+           (double)cycles[reps / 2] / benchmark->ops);
+    fflush(stdout);
+}
+
+int main(int argc, const char* argv[]) {
+    int reps = 50;
+    int warmup = 5;
+    const char* filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else {
+            filter = argv[i];
+        }
+    }
+    if (reps < 1) reps = 1;
+    if (reps > MAX_REPS) reps = MAX_REPS;
+
+    source = makeSource(100);  // Two script constants per function, so this stays under the 256 constant limit
+    largeSource = makeLargeSource(100, 500);  // About 2.5MB
+
+    Benchmark benchmarks[] = {
+        {"hashString/short", KEY_COUNT, nothing, benchHashShort, nothing},
+        {"hashString/64", KEY_COUNT, nothing, benchHashLong, nothing},
+        {"tableSet/insert", KEY_COUNT, setupKeys, benchTableSet, teardownKeys},
+        {"tableSet/update", KEY_COUNT, setupFilledTable, benchTableSet, teardownKeys},
+        {"findEntry/hit", KEY_COUNT, setupFilledTable, benchFindEntry, teardownKeys},
+        {"findEntry/half-miss", KEY_COUNT, setupHalfTable, benchFindEntry, teardownKeys},
+        {"tableFindString/hit", KEY_COUNT, setupFilledTable, benchTableFindString, teardownKeys},
+        {"copyString/interned", KEY_COUNT, setupKeys, benchCopyStringInterned, teardownKeys},
+        {"copyString/new", KEY_COUNT, setupVM, benchCopyStringNew, teardownVM},
+        {"takeString/interned", KEY_COUNT, setupOwnedChars, benchTakeString, teardownKeys},
+        {"takeString/new", KEY_COUNT, setupNewOwnedChars, benchTakeString, teardownVM},
+        {"scanToken", countTokens(source), nothing, benchScanToken, nothing},
+        {"compile", 1, setupVM, benchCompile, teardownVM},
+        {"compile/large", 1, setupVM, benchCompileLarge, teardownVM},
+        {"formatNumber", KEY_COUNT, setupNumbers, benchFormatNumber, nothing},
+        {"snprintf/%g", KEY_COUNT, setupNumbers, benchSnprintfNumber, nothing},
+        {"reallocate/64B", KEY_COUNT * 2, nothing, benchReallocateFixed, nothing},
+        {"reallocate/grow", 14, nothing, benchReallocateGrow, nothing},
+    };
+
+    printf("# name\tops\treps\tmedian_ns\tmin_ns\tmedian_cycles\n");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL) continue;
+        runBenchmark(&benchmarks[i], warmup, reps);
+    }
+
+    free(source);
+    free(largeSource);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Measure what each isolate costs in memory with and without a shared prelude. Generates a library of FUNCTIONS
+# functions with CASES string constants each, and a script that calls a couple of them. Hosts ISOLATES copies at once
+# with `clox --schedule`, which sets up every isolate's VM before any of them runs: either each script carrying the
+# library itself, or the library given once as --prelude. Reports the bytes allocated and the peak RSS each extra
+# isolate adds, from the difference between hosting one and hosting ISOLATES.
+#
+# Usage: bench/prelude.sh   (builds bench/clox-alloc first if need be)
+
+FUNCTIONS=${FUNCTIONS:-60}
+CASES=${CASES:-20}
+ISOLATES=${ISOLATES:-300}
+make bench/clox-alloc > /dev/null || exit $?
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+awk -v n="$FUNCTIONS" -v cases="$CASES" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fun f%d(x) {\n", i
+        for (c = 0; c < cases; c++) {
+            printf "    if (x == %d) return \"case %d of function %d in the library\";\n", c, c, i
+        }
+        printf "    return x * %d;\n", i + 1
+        printf "}\n"
+    }
+}' > "$DIR/library.lox"
+printf 'print f3(2);\nprint f7(100);\n' > "$DIR/main.lox"
+cat "$DIR/library.lox" "$DIR/main.lox" > "$DIR/alone.lox"
+
+# Prints the bytes allocated and the peak RSS in KB of hosting $1 copies of script $2, with any further arguments
+# given to clox first. Each VM reports running totals as it's freed, so the last report covers them all
+host() {
+    count=$1
+    script=$2
+    shift 2
+    yes "$script" | head -n "$count" | xargs bench/clox-alloc --schedule 1000000 "$@" 2>&1 > /dev/null |
+        sed -n 's/.*bytes \([0-9]*\), peak RSS \([0-9]*\) KB.*/\1 \2/p' | tail -n 1
+}
+
+# Prints the bytes and KB of peak RSS each isolate past the first adds
+perIsolate() {
+    set -- $(host 1 "$@") $(host "$ISOLATES" "$@")
+    echo $((($3 - $1) / (ISOLATES - 1))) $((($4 - $2) / (ISOLATES - 1)))
+}
+
+echo "$FUNCTIONS library functions, $(wc -c < "$DIR/library.lox") byte library, $ISOLATES isolates"
+printf "%-16s %16s %20s\n" "library" "bytes/isolate" "peak RSS KB/isolate"
+set -- $(perIsolate "$DIR/alone.lox")
+printf "%-16s %16s %20s\n" "in each script" "$1" "$2"
+set -- $(perIsolate "$DIR/main.lox" --prelude "$DIR/library.lox")
+printf "%-16s %16s %20s\n" "--prelude" "$1" "$2"
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Output throughput: runs a generated script that prints 4^LEVELS * 4 values (integers, fractions, numbers in
+# scientific notation and strings) to /dev/null and reports values printed per second. If REFERENCE names another
+# clox binary, it's timed too and the two outputs are checked to be identical.
+#
+# Build without the debug output first, or the tracing will dominate:
+#     make clean && make CFLAGS="-O2 -DNDEBUG"
+#
+# Usage: bench/print.sh [levels] [runs]
+
+LEVELS=${1:-10}
+RUNS=${2:-3}
+CLOX=${CLOX:-./clox}
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+{
+    echo 'fun l0(x) { print x; print x * 0.37 + 1; print x / 7; print x * 123456789; }'
+    level=1
+    while [ "$level" -le "$LEVELS" ]; do
+        below=$((level - 1))
+        echo "fun l$level(x) { l$below(x); l$below(x + 1); l$below(x + 2); l$below(x + 3); }"
+        level=$((level + 1))
+    done
+    echo "l$LEVELS(0);"
+} > "$OUT/print.lox"
+
+values=4
+level=0
+while [ "$level" -lt "$LEVELS" ]; do
+    values=$((values * 4))
+    level=$((level + 1))
+done
+
+measure() {
+    best=0
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        "$1" "$OUT/print.lox" > /dev/null || exit $?
+        end=$(date +%s%N)
+        elapsed=$(( (end - start) / 1000 ))
+        if [ "$best" -eq 0 ] || [ "$elapsed" -lt "$best" ]; then best=$elapsed; fi
+        i=$((i + 1))
+    done
+    echo "$1: $values values in ${best}us, $(( values * 1000 / best ))K values/s"
+}
+
+measure "$CLOX"
+
+if [ -n "$REFERENCE" ]; then
+    measure "$REFERENCE"
+    "$CLOX" "$OUT/print.lox" > "$OUT/clox.txt"
+    "$REFERENCE" "$OUT/print.lox" > "$OUT/reference.txt"
+    if cmp -s "$OUT/clox.txt" "$OUT/reference.txt"; then
+        echo "outputs identical"
+    else
+        echo "outputs differ"
+        exit 1
+    fi
+fi
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Compare the stack VM with the register VM (-DCLOX_REGISTER_VM) on the same scripts: instructions dispatched, and
+# wall time over RUNS runs. Builds every variant it needs into a temporary directory, and leaves the tree cleaned, so
+# run `make` again afterwards.
+#
+# Usage: bench/registers.sh [runs] [script]...
+
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- bench/jit.lox bench/isolates.lox
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+build() {
+    make clean > /dev/null && make CFLAGS="-O2 -DNDEBUG $2" > /dev/null || exit $?
+    cp clox "$OUT/$1"
+}
+
+build stack ""
+build register "-DCLOX_REGISTER_VM"
+build stack-counting "-DDEBUG_DISPATCH_STATS"
+build register-counting "-DCLOX_REGISTER_VM -DDEBUG_DISPATCH_STATS"
+make clean > /dev/null
+
+for script in "$@"; do
+    for vm in stack register; do
+        dispatched=$("$OUT/$vm-counting" "$script" 2>&1 > /dev/null | sed -n 's/^dispatched \([0-9]*\).*/\1/p')
+
+        start=$(date +%s%N)
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            "$OUT/$vm" "$script" > /dev/null || exit $?
+            i=$((i + 1))
+        done
+        end=$(date +%s%N)
+
+        echo "$script $vm: $dispatched instructions, $(( (end - start) / RUNS / 1000 ))us per run"
+    done
+done
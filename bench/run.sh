@@ -0,0 +1,76 @@
+#!/bin/sh
+# Benchmark driver behind `make bench`. Runs every bench/*.lox script RUNS times with an optimized build and reports
+# median, 90th and 99th percentile wall time. Then runs each once with counting builds for instructions dispatched,
+# allocations and peak RSS, and compares everything against bench/baseline.txt.
+#
+# Instruction and allocation counts are deterministic, so any increase is a regression. Times and RSS are noisy and
+# only count as regressions past TOLERANCE percent (plus 256 KB of slack for RSS, which varies by a few pages from
+# run to run even for small scripts). Exits with status 1 if anything regressed.
+#
+# Usage: bench/run.sh [--save]   (--save overwrites the baseline with this run's results)
+#
+# Expects bench/clox-release, bench/clox-dispatch and bench/clox-alloc, which the Makefile builds.
+
+RUNS=${RUNS:-20}
+TOLERANCE=${TOLERANCE:-10}
+BASELINE=bench/baseline.txt
+RESULTS=$(mktemp)
+trap 'rm -f "$RESULTS"' EXIT
+
+printf "%-20s %10s %10s %10s %12s %12s %10s\n" benchmark "median us" "p90 us" "p99 us" dispatched allocations "peak KB"
+
+for script in bench/*.lox; do
+    name=$(basename "$script" .lox)
+
+    times=$(
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            start=$(date +%s%N)
+            bench/clox-release "$script" > /dev/null || exit $?
+            end=$(date +%s%N)
+            echo $(( (end - start) / 1000 ))
+            i=$((i + 1))
+        done | sort -n
+    ) || { echo "$name failed" >&2; exit 1; }
+
+    # Nearest rank percentiles over the sorted run times
+    percentile() {
+        echo "$times" | awk -v p="$1" '{ t[NR] = $1 } END { r = int((p * NR + 99) / 100); if (r < 1) r = 1; print t[r] }'
+    }
+
+    dispatched=$(bench/clox-dispatch "$script" 2>&1 > /dev/null | sed -n 's/^dispatched \([0-9]*\).*/\1/p')
+    allocStats=$(bench/clox-alloc "$script" 2>&1 > /dev/null | grep '^allocations')
+    allocations=$(echo "$allocStats" | sed -n 's/^allocations \([0-9]*\).*/\1/p')
+    peak=$(echo "$allocStats" | sed -n 's/.*peak RSS \([0-9]*\) KB.*/\1/p')
+
+    line="$name $(percentile 50) $(percentile 90) $(percentile 99) $dispatched $allocations $peak"
+    echo "$line" >> "$RESULTS"
+    echo "$line" | awk '{ printf "%-20s %10s %10s %10s %12s %12s %10s\n", $1, $2, $3, $4, $5, $6, $7 }'
+done
+
+if [ "$1" = "--save" ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "Saved baseline to $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline at $BASELINE. Run \`make bench-baseline\` to record one."
+    exit 0
+fi
+
+# Columns: 1 name, 2 median, 3 p90, 4 p99, 5 dispatched, 6 allocations, 7 peak KB
+awk -v tolerance="$TOLERANCE" -v baseline="$BASELINE" '
+    NR == FNR { median[$1] = $2; dispatched[$1] = $5; allocations[$1] = $6; peak[$1] = $7; next }
+    !($1 in median) { print $1 ": not in baseline"; next }
+    {
+        if ($2 > median[$1] * (1 + tolerance / 100)) { print $1 ": median " median[$1] "us -> " $2 "us"; failed = 1 }
+        if ($5 > dispatched[$1]) { print $1 ": dispatched " dispatched[$1] " -> " $5; failed = 1 }
+        if ($6 > allocations[$1]) { print $1 ": allocations " allocations[$1] " -> " $6; failed = 1 }
+        if ($7 > peak[$1] * (1 + tolerance / 100) + 256) { print $1 ": peak RSS " peak[$1] "KB -> " $7 "KB"; failed = 1 }
+    }
+    END {
+        if (failed) { print "Regressions against " baseline; exit 1 }
+        print "No regressions against baseline"
+    }
+' "$BASELINE" "$RESULTS"
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Measure what time-slicing costs. Runs the same script COPIES times on one thread, first each to completion with
+# `clox --isolates 1`, then taking turns with `clox --schedule` at a range of budgets, from tiny slices to large ones.
+#
+# Build without the debug output first, or the tracing will dominate:
+#     make clean && make CFLAGS="-O2 -DNDEBUG"
+#
+# Usage: bench/schedule.sh [script] [copies]
+
+SCRIPT=${1:-bench/fib.lox}
+COPIES=${2:-16}
+CLOX=${CLOX:-./clox}
+
+set --
+i=0
+while [ $i -lt "$COPIES" ]; do
+    set -- "$@" "$SCRIPT"
+    i=$((i + 1))
+done
+
+"$CLOX" --isolates 1 "$@" > /dev/null || exit $?
+for budget in 10 100 1000 10000 100000; do
+    "$CLOX" --schedule $budget "$@" > /dev/null || exit $?
+done
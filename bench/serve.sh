@@ -0,0 +1,30 @@
+#!/bin/sh
+# Measure what `clox --serve` saves a tiny script. Starts a server on a temporary socket, then runs bench/clox-latency,
+# which sends the script COUNT times and runs it COUNT times as a fresh process, and reports p50 and p99 latency for
+# each.
+#
+# Usage: bench/serve.sh [script] [count]   (builds bench/clox-release and bench/clox-latency first if need be)
+
+SCRIPT=${1:-bench/serve/hello.lox}
+COUNT=${2:-1000}
+CLOX=${CLOX:-bench/clox-release}
+[ -x "$CLOX" ] || make "$CLOX" > /dev/null || exit $?
+[ -x bench/clox-latency ] || make bench/clox-latency > /dev/null || exit $?
+
+DIR=$(mktemp -d)
+SOCKET="$DIR/clox.sock"
+"$CLOX" --serve "$SOCKET" 2> /dev/null &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null; rm -rf "$DIR"' EXIT
+
+tries=0
+while [ ! -S "$SOCKET" ]; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ]; then
+        echo "The server didn't start." >&2
+        exit 1
+    fi
+    sleep 0.05
+done
+
+bench/clox-latency "$CLOX" "$SOCKET" "$SCRIPT" "$COUNT"
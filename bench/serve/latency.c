@@ -0,0 +1,127 @@
+/**
+    Request latency of `clox --serve` against running a fresh `clox` process per script. Runs the same script COUNT
+    times each way, one at a time, after a few untimed warmup runs, and prints the p50, p99 and mean latency of each
+    in microseconds. A request is timed from connecting to getting its exit status back, a process from posix_spawn()
+    to waitpid(). The script's output goes to /dev/null either way. Run by bench/serve.sh, which starts the server.
+
+    Usage: bench/clox-latency <clox> <socket> <script> [count]
+ */
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../src/server/server.h"
+
+#define WARMUP 10
+
+extern char** environ;
+
+static uint64_t nowNanoseconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static char* readWholeFile(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *length = (size_t)ftell(file);
+    rewind(file);
+
+    char* chars = malloc(*length + 1);
+    if (chars != NULL && fread(chars, 1, *length, file) != *length) {
+        free(chars);
+        chars = NULL;
+    }
+    fclose(file);
+    return chars;
+}
+
+static bool runProcess(const char* clox, const char* script) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char* argv[] = {(char*)clox, (char*)script, NULL};
+    pid_t pid;
+    int spawned = posix_spawn(&pid, clox, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) return false;
+
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int compareLatencies(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+static void report(const char* name, uint64_t* latencies, int count) {
+    qsort(latencies, (size_t)count, sizeof(uint64_t), compareLatencies);
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) total += latencies[i];
+
+    int p99 = (count * 99 + 99) / 100 - 1;  // The smallest latency at least 99% of runs were no slower than
+    printf("%-8s %10.1f %10.1f %10.1f\n", name, latencies[(count - 1) / 2] / 1e3, latencies[p99] / 1e3,
+           total / (double)count / 1e3);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: clox-latency <clox> <socket> <script> [count]\n");
+        return 64;
+    }
+
+    const char* clox = argv[1];
+    const char* socketPath = argv[2];
+    const char* script = argv[3];
+    int count = argc >= 5 ? atoi(argv[4]) : 1000;
+    if (count < 1) count = 1;
+
+    size_t length;
+    char* source = readWholeFile(script, &length);
+    int devNull = open("/dev/null", O_WRONLY);
+    uint64_t* latencies = malloc(sizeof(uint64_t) * (size_t)count);
+    if (source == NULL || devNull < 0 || latencies == NULL) {
+        fprintf(stderr, "Could not read \"%s\".\n", script);
+        return 74;
+    }
+
+    printf("%d runs of %s, latency in microseconds\n", count, script);
+    printf("%-8s %10s %10s %10s\n", "", "p50", "p99", "mean");
+
+    for (int i = -WARMUP; i < count; i++) {
+        uint64_t start = nowNanoseconds();
+        if (requestRun(socketPath, SERVE_SOURCE, source, length, devNull, STDERR_FILENO) != 0) {
+            fprintf(stderr, "Request to the server at \"%s\" failed.\n", socketPath);
+            return 70;
+        }
+        if (i >= 0) latencies[i] = nowNanoseconds() - start;
+    }
+    report("server", latencies, count);
+
+    for (int i = -WARMUP; i < count; i++) {
+        uint64_t start = nowNanoseconds();
+        if (!runProcess(clox, script)) {
+            fprintf(stderr, "Running \"%s %s\" failed.\n", clox, script);
+            return 70;
+        }
+        if (i >= 0) latencies[i] = nowNanoseconds() - start;
+    }
+    report("process", latencies, count);
+
+    free(latencies);
+    free(source);
+    close(devNull);
+    return 0;
+}
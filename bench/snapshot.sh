@@ -0,0 +1,53 @@
+#!/bin/sh
+# Measure cold start with and without a snapshot. Generates a prelude of FUNCTIONS functions, each with CASES string
+# constants of its own, snapshots it, then times RUNS starts of a script that calls one of them: with no prelude at
+# all, with --prelude on the script, and with --prelude on the snapshot. Reports the mean wall time of a start.
+# FUNCTIONS stays under 128, since each global function takes two of the script's 256 constants.
+#
+# Usage: bench/snapshot.sh   (builds bench/clox-release first if need be)
+
+CLOX=${CLOX:-bench/clox-release}
+FUNCTIONS=${FUNCTIONS:-120}
+CASES=${CASES:-60}
+RUNS=${RUNS:-200}
+[ -x "$CLOX" ] || make "$CLOX" > /dev/null || exit $?
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+awk -v n="$FUNCTIONS" -v cases="$CASES" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fun f%d(x) {\n", i
+        for (c = 0; c < cases; c++) {
+            printf "    if (x == %d) return \"case %d of function %d in the prelude\";\n", c, c, i
+        }
+        printf "    var total = 0;\n"
+        printf "    for (var i = 0; i < x; i = i + 1) total = total + i * %d;\n", i % 7 + 1
+        printf "    return total;\n"
+        printf "}\n"
+    }
+    printf "var greeting = \"ready\";\n"
+}' > "$DIR/prelude.lox"
+echo 'print f7(10);' > "$DIR/main.lox"
+echo 'fun f7(x) { return 45; } print f7(10);' > "$DIR/alone.lox"
+
+"$CLOX" --snapshot "$DIR/prelude.lox" "$DIR/prelude.img" || exit 1
+
+# Prints the mean wall time of one start in microseconds, running "$CLOX" with the given arguments RUNS times
+mean() {
+    "$CLOX" "$@" > /dev/null || return 1  # Warm the page cache
+    start=$(date +%s%N)
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        "$CLOX" "$@" > /dev/null
+        run=$((run + 1))
+    done
+    end=$(date +%s%N)
+    echo $(((end - start) / RUNS / 1000))
+}
+
+echo "$FUNCTIONS prelude functions, $(wc -c < "$DIR/prelude.lox") byte script, $(wc -c < "$DIR/prelude.img") byte snapshot"
+printf "%-20s %10s\n" "start" "mean (us)"
+printf "%-20s %10s\n" "no prelude" "$(mean "$DIR/alone.lox")"
+printf "%-20s %10s\n" "prelude script" "$(mean --prelude "$DIR/prelude.lox" "$DIR/main.lox")"
+printf "%-20s %10s\n" "prelude snapshot" "$(mean --prelude "$DIR/prelude.img" "$DIR/main.lox")"
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Compare whole-file compilation with --stream on generated scripts of growing size: wall time and peak RSS. The
+# statements use no constants, so the whole-file compile stays under the 256 constant limit at any size. Builds
+# bench/clox-alloc, which reports peak RSS when the VM is freed.
+#
+# Usage: bench/stream.sh [statements]...
+
+[ $# -eq 0 ] && set -- 10000 100000 500000
+
+make bench/clox-alloc > /dev/null || exit $?
+
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+for statements in "$@"; do
+    awk -v n="$statements" 'BEGIN { for (i = 0; i < n; i++) print "(true == !false) != (nil == !true);"; print "print true;" }' > "$SCRIPT"
+    size=$(( $(wc -c < "$SCRIPT") / 1024 ))
+
+    for mode in whole --stream; do
+        flag=$mode
+        [ "$mode" = whole ] && flag=
+
+        start=$(date +%s%N)
+        rss=$(bench/clox-alloc $flag "$SCRIPT" 2>&1 > /dev/null | sed -n 's/.*peak RSS \([0-9]*\) KB.*/\1/p')
+        end=$(date +%s%N)
+
+        echo "$statements statements (${size} KB) $mode: $(( (end - start) / 1000000 ))ms, peak RSS ${rss} KB"
+    done
+done
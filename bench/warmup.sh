@@ -0,0 +1,34 @@
+#!/bin/sh
+# Warmup curve. Runs bench/warmup.lox, which times equal batches of the same work, in the interpreter and with the
+# JIT at a few hot thresholds, and prints the throughput of every batch in loop iterations per millisecond. With the
+# JIT, throughput steps up at the batch where work() crosses the threshold (each batch is 2000 calls plus
+# back-edges). The checksum on the last line has to agree across every run.
+#
+# Build without the debug output first, or the tracing will dominate:
+#     make clean && make CFLAGS="-O2 -DNDEBUG"
+#
+# Usage: bench/warmup.sh [thresholds...]
+
+CLOX=${CLOX:-./clox}
+SCRIPT=bench/warmup.lox
+ITERATIONS=2000  # Loop iterations per batch, 20 calls of work(100)
+
+[ $# -gt 0 ] || set -- 1000 10000 40000
+
+run() {
+    label=$1
+    shift
+    "$CLOX" "$@" "$SCRIPT" | awk -v label="$label" -v n="$ITERATIONS" '
+        { lines[NR] = $1 }
+        END {
+            printf "%-12s", label
+            for (i = 1; i < NR; i++) printf " %5d", (lines[i] > 0 ? n / (lines[i] * 1000) : 0)
+            printf "  checksum %s\n", lines[NR]
+        }'
+}
+
+echo "iterations/ms per batch of $ITERATIONS"
+run interpreter
+for threshold in "$@"; do
+    run "jit@$threshold" --jit --hot "$threshold"
+done
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "../region/region.h"
+
+#define ARENA_ALIGNMENT 16  // Enough for any Value
+
+static size_t roundUp(size_t bytes, size_t multiple) {
+    return (bytes + multiple - 1) / multiple * multiple;
+}
+
+/**
+    Reserve address space for a new arena and commit the first ARENA_COMMIT_BYTES of it
+ */
+void initArena(Arena* arena) {
+    void* region = reserveRegion(ARENA_RESERVE_BYTES, &arena->reservedBytes);
+    if (region == NULL) {
+        fprintf(stderr, "Could not reserve memory for the compiler.\n");
+        exit(74);
+    }
+
+    arena->base = (uint8_t*)region;
+    arena->top = arena->base;
+    arena->limit = arena->base;
+    arena->last = NULL;
+
+    arenaAllocate(arena, ARENA_COMMIT_BYTES);
+    resetArena(arena);
+}
+
+/**
+    Release everything ever allocated in the arena with a single munmap
+ */
+void freeArena(Arena* arena) {
+    releaseRegion(arena->base, arena->reservedBytes);
+
+    arena->base = NULL;
+    arena->top = NULL;
+    arena->limit = NULL;
+    arena->last = NULL;
+    arena->reservedBytes = 0;
+}
+
+/**
+    Forget every allocation, so the arena's memory can be used again. The committed pages stay committed
+ */
+void resetArena(Arena* arena) {
+    arena->top = arena->base;
+    arena->last = NULL;
+}
+
+ArenaMark markArena(Arena* arena) {
+    return (ArenaMark){ arena->top, arena->last };
+}
+
+/**
+    Forget every allocation made since *mark* was taken. Whatever was the most recent allocation back then can be
+    grown in place again
+ */
+void rewindArena(Arena* arena, ArenaMark mark) {
+    arena->top = mark.top;
+    arena->last = mark.last;
+}
+
+/**
+    Commit enough of the reservation that everything below *end* can be used, by enough that a big compile doesn't
+    commit once per allocation
+ */
+static void ensureCommitted(Arena* arena, uint8_t* end) {
+    if (end <= arena->limit) return;
+
+    size_t needed = (size_t)(end - arena->base);
+    if (roundUpToPage(needed) > arena->reservedBytes) {
+        fprintf(stderr, "Source too large to compile.\n");
+        exit(74);
+    }
+
+    size_t committed = commitRegion(arena->base, (size_t)(arena->limit - arena->base), needed, ARENA_COMMIT_BYTES,
+                                    arena->reservedBytes);
+    if (committed == 0) {
+        fprintf(stderr, "Could not commit memory for the compiler.\n");
+        exit(74);
+    }
+
+    arena->limit = arena->base + committed;
+}
+
+void* arenaAllocate(Arena* arena, size_t size) {
+    uint8_t* start = arena->top;
+    ensureCommitted(arena, start + roundUp(size, ARENA_ALIGNMENT));
+
+    arena->top = start + roundUp(size, ARENA_ALIGNMENT);
+    arena->last = start;
+    return start;
+}
+
+/**
+    Resize an allocation the way reallocate() would. The most recent allocation is extended where it is, anything
+    older is copied to the top of the arena and its old space is simply abandoned until the arena goes
+ */
+void* arenaGrow(Arena* arena, void* previous, size_t oldSize, size_t newSize) {
+    if (previous != NULL && previous == arena->last) {
+        ensureCommitted(arena, arena->last + roundUp(newSize, ARENA_ALIGNMENT));
+        arena->top = arena->last + roundUp(newSize, ARENA_ALIGNMENT);
+        return previous;
+    }
+
+    void* block = arenaAllocate(arena, newSize);
+    if (previous != NULL) memcpy(block, previous, oldSize < newSize ? oldSize : newSize);
+    return block;
+}
@@ -0,0 +1,40 @@
+/**
+    Module for the compiler's arena. Everything the compiler only needs while it runs is bump allocated out of one
+    large region of address space that is reserved up front and only backed by memory as it's needed. Nothing in an
+    arena is ever freed on its own: the whole region goes at once when the compile is done
+ */
+
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "../common.h"
+
+// Address space reserved for an arena. Only the committed prefix of this actually uses memory
+#define ARENA_RESERVE_BYTES ((size_t)1024 * 1024 * 1024)
+
+// Memory committed when an arena is created, and the minimum amount committed each time it grows
+#define ARENA_COMMIT_BYTES (64 * 1024)
+
+typedef struct {
+    uint8_t* base;  // Base of the reserved region. Never moves
+    uint8_t* top;  // Next free byte
+    uint8_t* limit;  // One past the last committed byte
+    uint8_t* last;  // Most recent allocation, which arenaGrow() can extend in place. NULL if there is none
+    size_t reservedBytes;
+} Arena;
+
+// A position in an arena to rewind back to
+typedef struct {
+    uint8_t* top;
+    uint8_t* last;
+} ArenaMark;
+
+void initArena(Arena* arena);
+void freeArena(Arena* arena);
+void resetArena(Arena* arena);
+ArenaMark markArena(Arena* arena);
+void rewindArena(Arena* arena, ArenaMark mark);
+void* arenaAllocate(Arena* arena, size_t size);
+void* arenaGrow(Arena* arena, void* previous, size_t oldSize, size_t newSize);
+
+#endif
@@ -0,0 +1,356 @@
+#include "array.h"
+#include "../vm/vm.h"
+
+#if defined(__x86_64__) && !defined(CLOX_NO_SIMD)
+#define SIMD_KERNELS
+#include <immintrin.h>
+#endif
+
+#define LANES 4  // Partial results a reduction keeps, whatever the vector width
+
+// Same as minpd and maxpd, which return the second operand unless the first is strictly smaller (or larger). So a NaN
+// element can be passed over, and min() and max() of arrays with NaNs in them are unreliable
+static inline double minOf(double a, double b) { return a < b ? a : b; }
+static inline double maxOf(double a, double b) { return a > b ? a : b; }
+
+#ifdef SIMD_KERNELS
+/**
+    Stamp out the kernels for one instruction set, *width* doubles to a vector. The element wise kernels cover as many
+    whole vectors as the arrays hold. Reductions cover as many whole groups of LANES elements, starting from the
+    partial results in *lanes* and writing them back. Each returns how many elements it covered, and the scalar loops
+    finish the rest
+ */
+#define DEFINE_KERNELS(set, attributes, Vector, width, load, store, splat, addOp, multiplyOp, minOp, maxOp, \
+                       greaterOp, lessOp, andOp) \
+    attributes static int add##set(const double* a, const double* b, double* out, int count) { \
+        int i = 0; \
+        for (; i + width <= count; i += width) store(out + i, addOp(load(a + i), load(b + i))); \
+        return i; \
+    } \
+    \
+    attributes static int scale##set(const double* a, double k, double* out, int count) { \
+        Vector factor = splat(k); \
+        int i = 0; \
+        for (; i + width <= count; i += width) store(out + i, multiplyOp(load(a + i), factor)); \
+        return i; \
+    } \
+    \
+    attributes static int greater##set(const double* a, double k, double* out, int count) { \
+        Vector bound = splat(k), one = splat(1.0); \
+        int i = 0; \
+        for (; i + width <= count; i += width) store(out + i, andOp(greaterOp(load(a + i), bound), one)); \
+        return i; \
+    } \
+    \
+    attributes static int less##set(const double* a, double k, double* out, int count) { \
+        Vector bound = splat(k), one = splat(1.0); \
+        int i = 0; \
+        for (; i + width <= count; i += width) store(out + i, andOp(lessOp(load(a + i), bound), one)); \
+        return i; \
+    } \
+    \
+    attributes static int sum##set(const double* a, int count, double* lanes) { \
+        Vector partial[LANES / width]; \
+        for (int v = 0; v < LANES / width; v++) partial[v] = load(lanes + v * width); \
+        int i = 0; \
+        for (; i + LANES <= count; i += LANES) { \
+            for (int v = 0; v < LANES / width; v++) partial[v] = addOp(partial[v], load(a + i + v * width)); \
+        } \
+        for (int v = 0; v < LANES / width; v++) store(lanes + v * width, partial[v]); \
+        return i; \
+    } \
+    \
+    attributes static int dot##set(const double* a, const double* b, int count, double* lanes) { \
+        Vector partial[LANES / width]; \
+        for (int v = 0; v < LANES / width; v++) partial[v] = load(lanes + v * width); \
+        int i = 0; \
+        for (; i + LANES <= count; i += LANES) { \
+            for (int v = 0; v < LANES / width; v++) { \
+                int j = i + v * width; \
+                partial[v] = addOp(partial[v], multiplyOp(load(a + j), load(b + j))); \
+            } \
+        } \
+        for (int v = 0; v < LANES / width; v++) store(lanes + v * width, partial[v]); \
+        return i; \
+    } \
+    \
+    attributes static int min##set(const double* a, int count, double* lanes) { \
+        Vector partial[LANES / width]; \
+        for (int v = 0; v < LANES / width; v++) partial[v] = load(lanes + v * width); \
+        int i = 0; \
+        for (; i + LANES <= count; i += LANES) { \
+            for (int v = 0; v < LANES / width; v++) partial[v] = minOp(partial[v], load(a + i + v * width)); \
+        } \
+        for (int v = 0; v < LANES / width; v++) store(lanes + v * width, partial[v]); \
+        return i; \
+    } \
+    \
+    attributes static int max##set(const double* a, int count, double* lanes) { \
+        Vector partial[LANES / width]; \
+        for (int v = 0; v < LANES / width; v++) partial[v] = load(lanes + v * width); \
+        int i = 0; \
+        for (; i + LANES <= count; i += LANES) { \
+            for (int v = 0; v < LANES / width; v++) partial[v] = maxOp(partial[v], load(a + i + v * width)); \
+        } \
+        for (int v = 0; v < LANES / width; v++) store(lanes + v * width, partial[v]); \
+        return i; \
+    }
+
+// SSE2 is part of x86-64, so these need no check
+#define SSE_GREATER(a, b) _mm_cmpgt_pd(a, b)
+#define SSE_LESS(a, b) _mm_cmplt_pd(a, b)
+DEFINE_KERNELS(Sse, , __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd, _mm_min_pd,
+               _mm_max_pd, SSE_GREATER, SSE_LESS, _mm_and_pd)
+
+#define AVX_GREATER(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define AVX_LESS(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+DEFINE_KERNELS(Avx, __attribute__((target("avx"))), __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+               _mm256_add_pd, _mm256_mul_pd, _mm256_min_pd, _mm256_max_pd, AVX_GREATER, AVX_LESS, _mm256_and_pd)
+
+#undef DEFINE_KERNELS
+
+static inline bool hasAvx(void) {
+    return __builtin_cpu_supports("avx");
+}
+
+// Run the AVX or SSE2 form of *kernel*, whichever the machine supports, and set *i* to the elements it covered
+#define VECTORIZE(i, kernel, ...) ((i) = hasAvx() ? kernel##Avx(__VA_ARGS__) : kernel##Sse(__VA_ARGS__))
+#else
+#define VECTORIZE(i, kernel, ...) ((void)0)
+#endif
+
+static void addArrays(const double* a, const double* b, double* out, int count) {
+    int i = 0;
+    VECTORIZE(i, add, a, b, out, count);
+    for (; i < count; i++) out[i] = a[i] + b[i];
+}
+
+static void scaleArray(const double* a, double k, double* out, int count) {
+    int i = 0;
+    VECTORIZE(i, scale, a, k, out, count);
+    for (; i < count; i++) out[i] = a[i] * k;
+}
+
+static void greaterMask(const double* a, double k, double* out, int count) {
+    int i = 0;
+    VECTORIZE(i, greater, a, k, out, count);
+    for (; i < count; i++) out[i] = a[i] > k ? 1.0 : 0.0;
+}
+
+static void lessMask(const double* a, double k, double* out, int count) {
+    int i = 0;
+    VECTORIZE(i, less, a, k, out, count);
+    for (; i < count; i++) out[i] = a[i] < k ? 1.0 : 0.0;
+}
+
+static double sumArray(const double* a, int count) {
+    double lanes[LANES] = { 0.0, 0.0, 0.0, 0.0 };
+    int i = 0;
+    VECTORIZE(i, sum, a, count, lanes);
+    for (; i + LANES <= count; i += LANES) {
+        for (int j = 0; j < LANES; j++) lanes[j] += a[i + j];
+    }
+
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += a[i];
+    return total;
+}
+
+static double dotArrays(const double* a, const double* b, int count) {
+    double lanes[LANES] = { 0.0, 0.0, 0.0, 0.0 };
+    int i = 0;
+    VECTORIZE(i, dot, a, b, count, lanes);
+    for (; i + LANES <= count; i += LANES) {
+        for (int j = 0; j < LANES; j++) lanes[j] += a[i + j] * b[i + j];
+    }
+
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+// Smallest element of a non-empty array. Every lane starts from the first element
+static double minArray(const double* a, int count) {
+    double lanes[LANES] = { a[0], a[0], a[0], a[0] };
+    int i = 0;
+    VECTORIZE(i, min, a, count, lanes);
+    for (; i + LANES <= count; i += LANES) {
+        for (int j = 0; j < LANES; j++) lanes[j] = minOf(lanes[j], a[i + j]);
+    }
+
+    double result = minOf(minOf(lanes[0], lanes[1]), minOf(lanes[2], lanes[3]));
+    for (; i < count; i++) result = minOf(result, a[i]);
+    return result;
+}
+
+static double maxArray(const double* a, int count) {
+    double lanes[LANES] = { a[0], a[0], a[0], a[0] };
+    int i = 0;
+    VECTORIZE(i, max, a, count, lanes);
+    for (; i + LANES <= count; i += LANES) {
+        for (int j = 0; j < LANES; j++) lanes[j] = maxOf(lanes[j], a[i + j]);
+    }
+
+    double result = maxOf(maxOf(lanes[0], lanes[1]), maxOf(lanes[2], lanes[3]));
+    for (; i < count; i++) result = maxOf(result, a[i]);
+    return result;
+}
+
+#undef VECTORIZE
+
+static bool checkArity(VM* vm, int argCount, int arity) {
+    if (argCount == arity) return true;
+    runtimeError(vm, "Expected %d arguments but got %d.", arity, argCount);
+    return false;
+}
+
+static bool arrayArgument(VM* vm, const char* name, Value value, ObjArray** array) {
+    if (!IS_ARRAY(value)) {
+        runtimeError(vm, "Argument to %s() must be an array.", name);
+        return false;
+    }
+
+    *array = AS_ARRAY(value);
+    return true;
+}
+
+static bool numberArgument(VM* vm, const char* name, Value value, double* number) {
+    if (!IS_NUMBER(value)) {
+        runtimeError(vm, "Argument to %s() must be a number.", name);
+        return false;
+    }
+
+    *number = AS_NUMBER(value);
+    return true;
+}
+
+// The two array arguments of *name*, which must be the same length
+static bool arrayPair(VM* vm, const char* name, Value* args, ObjArray** a, ObjArray** b) {
+    if (!arrayArgument(vm, name, args[0], a) || !arrayArgument(vm, name, args[1], b)) return false;
+
+    if ((*a)->count != (*b)->count) {
+        runtimeError(vm, "Arrays passed to %s() must be the same length.", name);
+        return false;
+    }
+    return true;
+}
+
+bool arrayNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount != 1 && argCount != 2) {
+        runtimeError(vm, "Expected 1 or 2 arguments but got %d.", argCount);
+        return false;
+    }
+
+    double length;
+    if (!numberArgument(vm, "array", args[0], &length)) return false;
+    if (!(length >= 0 && length <= INT32_MAX) || length != (int32_t)length) {
+        runtimeError(vm, "Array length must be a whole number of at least zero.");
+        return false;
+    }
+
+    double fill = 0.0;
+    if (argCount == 2 && !numberArgument(vm, "array", args[1], &fill)) return false;
+
+    ObjArray* array = newArray(vm, (int)length);
+    for (int i = 0; i < array->count; i++) array->values[i] = fill;
+
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+bool lengthNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* array;
+    if (!checkArity(vm, argCount, 1) || !arrayArgument(vm, "length", args[0], &array)) return false;
+
+    *result = INT_VAL(array->count);
+    return true;
+}
+
+bool addNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray *a, *b;
+    if (!checkArity(vm, argCount, 2) || !arrayPair(vm, "add", args, &a, &b)) return false;
+
+    ObjArray* sum = newArray(vm, a->count);
+    addArrays(a->values, b->values, sum->values, a->count);
+    *result = OBJ_VAL(sum);
+    return true;
+}
+
+bool scaleNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    double k;
+    if (!checkArity(vm, argCount, 2) || !arrayArgument(vm, "scale", args[0], &a) ||
+        !numberArgument(vm, "scale", args[1], &k)) return false;
+
+    ObjArray* scaled = newArray(vm, a->count);
+    scaleArray(a->values, k, scaled->values, a->count);
+    *result = OBJ_VAL(scaled);
+    return true;
+}
+
+bool greaterNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    double k;
+    if (!checkArity(vm, argCount, 2) || !arrayArgument(vm, "greater", args[0], &a) ||
+        !numberArgument(vm, "greater", args[1], &k)) return false;
+
+    ObjArray* mask = newArray(vm, a->count);
+    greaterMask(a->values, k, mask->values, a->count);
+    *result = OBJ_VAL(mask);
+    return true;
+}
+
+bool lessNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    double k;
+    if (!checkArity(vm, argCount, 2) || !arrayArgument(vm, "less", args[0], &a) ||
+        !numberArgument(vm, "less", args[1], &k)) return false;
+
+    ObjArray* mask = newArray(vm, a->count);
+    lessMask(a->values, k, mask->values, a->count);
+    *result = OBJ_VAL(mask);
+    return true;
+}
+
+bool sumNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    if (!checkArity(vm, argCount, 1) || !arrayArgument(vm, "sum", args[0], &a)) return false;
+
+    *result = NUMBER_VAL(sumArray(a->values, a->count));
+    return true;
+}
+
+bool dotNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray *a, *b;
+    if (!checkArity(vm, argCount, 2) || !arrayPair(vm, "dot", args, &a, &b)) return false;
+
+    *result = NUMBER_VAL(dotArrays(a->values, b->values, a->count));
+    return true;
+}
+
+// Shared by min() and max(), which have no answer for an empty array
+static bool nonEmptyArgument(VM* vm, const char* name, int argCount, Value* args, ObjArray** array) {
+    if (!checkArity(vm, argCount, 1) || !arrayArgument(vm, name, args[0], array)) return false;
+
+    if ((*array)->count == 0) {
+        runtimeError(vm, "Argument to %s() must not be empty.", name);
+        return false;
+    }
+    return true;
+}
+
+bool minNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    if (!nonEmptyArgument(vm, "min", argCount, args, &a)) return false;
+
+    *result = NUMBER_VAL(minArray(a->values, a->count));
+    return true;
+}
+
+bool maxNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjArray* a;
+    if (!nonEmptyArgument(vm, "max", argCount, args, &a)) return false;
+
+    *result = NUMBER_VAL(maxArray(a->values, a->count));
+    return true;
+}
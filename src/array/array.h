@@ -0,0 +1,28 @@
+/**
+    Module for the natives that work on whole arrays. Each one runs a kernel over the raw doubles of its arguments,
+    with AVX or SSE2 when the machine has them and a scalar loop otherwise, so a bulk operation costs one native call
+    instead of a dispatch per element. Built with -DCLOX_NO_SIMD, or on anything but x86-64, only the scalar loops
+    are used
+
+    Reductions keep four partial results, one per lane, whichever kernel runs, and combine them in the same order at
+    the end. So sum() and dot() give the same answer on every machine, though it can differ in the last bits from
+    adding the elements up one at a time
+ */
+
+#ifndef clox_array_h
+#define clox_array_h
+
+#include "../object/object.h"
+
+bool arrayNative(VM* vm, int argCount, Value* args, Value* result);  // array(length) or array(length, fill)
+bool lengthNative(VM* vm, int argCount, Value* args, Value* result);  // length(array)
+bool addNative(VM* vm, int argCount, Value* args, Value* result);  // add(a, b), a new array of a[i] + b[i]
+bool scaleNative(VM* vm, int argCount, Value* args, Value* result);  // scale(a, k), a new array of a[i] * k
+bool greaterNative(VM* vm, int argCount, Value* args, Value* result);  // greater(a, k), 1 where a[i] > k, else 0
+bool lessNative(VM* vm, int argCount, Value* args, Value* result);  // less(a, k), 1 where a[i] < k, else 0
+bool sumNative(VM* vm, int argCount, Value* args, Value* result);  // sum(a)
+bool dotNative(VM* vm, int argCount, Value* args, Value* result);  // dot(a, b)
+bool minNative(VM* vm, int argCount, Value* args, Value* result);  // min(a), of a non-empty array
+bool maxNative(VM* vm, int argCount, Value* args, Value* result);  // max(a), of a non-empty array
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "../memory/memory.h"
@@ -13,15 +14,44 @@ void initChunk(Chunk* chunk) {
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&(chunk->constants));
+    chunk->caches = NULL;
+    chunk->cacheCount = 0;
+    chunk->arena = NULL;
+}
+
+/**
+    Byte offsets of the line table, the constants and the property caches in a compacted chunk's block, and the size
+    of the whole block
+ */
+static size_t linesOffset(int count) {
+    return ((size_t)count + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+}
+
+static size_t constantsOffset(int count) {
+    size_t end = linesOffset(count) + (size_t)count * sizeof(int);
+    return (end + sizeof(Value) - 1) / sizeof(Value) * sizeof(Value);
+}
+
+static size_t cachesOffset(int count, int constantCount) {
+    return constantsOffset(count) + (size_t)constantCount * sizeof(Value);  // Value alignment covers the caches too
+}
+
+static size_t blockSize(int count, int constantCount, int cacheCount) {
+    return cachesOffset(count, constantCount) + (size_t)cacheCount * sizeof(PropertyCache);
+}
+
+// Size in bytes of a compacted chunk's block
+size_t chunkBlockSize(Chunk* chunk) {
+    return blockSize(chunk->count, chunk->constants.count, chunk->cacheCount);
 }
 
 /*
-    Deallocate a chunk
+    Deallocate a chunk. A chunk still being written belongs to its arena, which frees it along with everything else
  */
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
-    freeValueArray(&(chunk->constants));
+    if (chunk->arena == NULL && chunk->code != NULL) {
+        FREE_ARRAY(uint8_t, chunk->code, chunkBlockSize(chunk));
+    }
     initChunk(chunk);
 }
 
@@ -33,8 +63,8 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
         // Double the capacity of chunk array
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(chunk->code, uint8_t, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(chunk->lines, int, oldCapacity, chunk->capacity);
+        chunk->code = arenaGrow(chunk->arena, chunk->code, oldCapacity, chunk->capacity);
+        chunk->lines = arenaGrow(chunk->arena, chunk->lines, sizeof(int) * oldCapacity, sizeof(int) * chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
@@ -49,6 +79,98 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
           (maybe store three bytes sequentially in *code* with values between 0 and 255)
  */
 int addConstant(Chunk* chunk, Value value) {
-    writeValueArray(&(chunk->constants), value);
-    return chunk->constants.count - 1;
+    ValueArray* constants = &chunk->constants;
+    if (constants->capacity < constants->count + 1) {
+        int oldCapacity = constants->capacity;
+        constants->capacity = GROW_CAPACITY(oldCapacity);
+        constants->values = arenaGrow(chunk->arena, constants->values, sizeof(Value) * oldCapacity,
+                                      sizeof(Value) * constants->capacity);
+    }
+
+    constants->values[constants->count] = value;
+    return constants->count++;
+}
+
+/**
+    Reserve a property cache for an instruction being written and return its index. The caches themselves are only
+    allocated, empty, once the chunk is compacted
+ */
+int addCache(Chunk* chunk) {
+    return chunk->cacheCount++;
+}
+
+/**
+    Move a finished chunk out of its arena into a single block holding the code, the line table, the constants and the
+    property caches, in that order. Freeing the chunk is then one free, and the bytes an instruction touches sit next
+    to each other
+ */
+void compactChunk(Chunk* chunk) {
+    uint8_t* block = ALLOCATE(uint8_t, blockSize(chunk->count, chunk->constants.count, chunk->cacheCount));
+    int* lines = (int*)(block + linesOffset(chunk->count));
+    Value* constants = (Value*)(block + constantsOffset(chunk->count));
+    PropertyCache* caches = (PropertyCache*)(block + cachesOffset(chunk->count, chunk->constants.count));
+
+    memcpy(block, chunk->code, chunk->count);
+    memcpy(lines, chunk->lines, sizeof(int) * chunk->count);
+    if (chunk->constants.count > 0) memcpy(constants, chunk->constants.values, sizeof(Value) * chunk->constants.count);
+    memset(caches, 0, sizeof(PropertyCache) * chunk->cacheCount);
+
+    chunk->code = block;
+    chunk->lines = lines;
+    chunk->capacity = chunk->count;
+    chunk->constants.values = constants;
+    chunk->constants.capacity = chunk->constants.count;
+    chunk->caches = caches;
+    chunk->arena = NULL;
+}
+
+/**
+    Size in bytes of an instruction that starts with the opcode *instruction*, operands included
+ */
+int instructionSize(uint8_t instruction) {
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_EQUAL_CONSTANT:
+        case OP_GREATER_CONSTANT:
+        case OP_LESS_CONSTANT:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_CALL:
+        case OP_CLASS:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+            return 3;
+        case OP_JUMP_IF_NOT_EQUAL_CONSTANT:
+        case OP_JUMP_IF_NOT_GREATER_CONSTANT:
+        case OP_JUMP_IF_NOT_LESS_CONSTANT:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/**
+    Offset of the instruction that the jump at *offset* lands on
+ */
+int jumpTarget(Chunk* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+    int size = instructionSize(instruction);
+    int jump = (chunk->code[offset + size - 2] << 8) | chunk->code[offset + size - 1];  // The offset is always last
+    return instruction == OP_LOOP ? offset + size - jump : offset + size + jump;
 }
\ No newline at end of file
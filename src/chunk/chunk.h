@@ -5,9 +5,13 @@
 #ifndef clox_chunk_h
 #define clox_chunk_h
 
+#include "../arena/arena.h"
 #include "../common.h"
 #include "../value/value.h"
 
+// Hidden class of an instance, defined in object.h
+typedef struct sObjShape ObjShape;
+
 // Literals whose values can't be enumerated (like strings & numbers) are denoted by OP_CONSTANT codes. The next byte
 // after an OP_CONSTANT OpCode is an int that refers to where the constant is stored in the ValueArray
 
@@ -20,6 +24,12 @@ typedef enum {
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
+    OP_POP,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_GET_GLOBAL,
+    OP_DEFINE_GLOBAL,
+    OP_SET_GLOBAL,
     OP_EQUAL,  // No separate tokens for !=, <=, and >= since those can be represented with compound bytecode instructions (e.g. !(x < y)), but would be good for performance!
     OP_GREATER,
     OP_LESS,
@@ -29,22 +39,111 @@ typedef enum {
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
-    OP_RETURN
+
+    // Superinstructions. Each one does the same work as the sequence in its comment, in a single dispatch. The
+    // compiler emits them in place of those sequences, which are the most frequent pairs in measured dispatch counts
+    OP_NOT_EQUAL,          // OP_EQUAL, OP_NOT
+    OP_GREATER_EQUAL,      // OP_LESS, OP_NOT
+    OP_LESS_EQUAL,         // OP_GREATER, OP_NOT
+    OP_EQUAL_CONSTANT,     // OP_CONSTANT k, OP_EQUAL
+    OP_GREATER_CONSTANT,   // OP_CONSTANT k, OP_GREATER
+    OP_LESS_CONSTANT,      // OP_CONSTANT k, OP_LESS
+    OP_ADD_CONSTANT,       // OP_CONSTANT k, OP_ADD
+    OP_SUBTRACT_CONSTANT,  // OP_CONSTANT k, OP_SUBTRACT
+    OP_MULTIPLY_CONSTANT,  // OP_CONSTANT k, OP_MULTIPLY
+
+    // Quickened instructions. The compiler never emits these. The VM rewrites a generic instruction into one of them
+    // the first time it runs, based on the operand types it sees, and rewrites it back if the types ever change
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER,
+    OP_ADD_NUMBER,
+    OP_ADD_STRING,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_GREATER_INT,  // The _INT forms take two numbers held as ints, and the _NUMBER forms any other two numbers
+    OP_LESS_INT,
+    OP_ADD_INT,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+
+    OP_PRINT,
+
+    // Jumps. The operand is a 16 bit offset, high byte first, counted from the end of the instruction. OP_JUMP and
+    // OP_JUMP_IF_FALSE jump forward, OP_LOOP jumps backward. OP_JUMP_IF_FALSE leaves the value it tests on the stack
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
+
+    // Compare and branch. Each one compares its two operands like the instruction in its comment, pops them, and
+    // jumps forward if the comparison came out false, instead of leaving a boolean for OP_JUMP_IF_FALSE to test. The
+    // compiler emits them for the conditions of if, while and for. The constant forms take the constant index first
+    OP_JUMP_IF_NOT_EQUAL,             // OP_EQUAL
+    OP_JUMP_IF_EQUAL,                 // OP_NOT_EQUAL
+    OP_JUMP_IF_NOT_GREATER,           // OP_GREATER
+    OP_JUMP_IF_NOT_GREATER_EQUAL,     // OP_GREATER_EQUAL
+    OP_JUMP_IF_NOT_LESS,              // OP_LESS
+    OP_JUMP_IF_NOT_LESS_EQUAL,        // OP_LESS_EQUAL
+    OP_JUMP_IF_NOT_EQUAL_CONSTANT,    // OP_EQUAL_CONSTANT
+    OP_JUMP_IF_NOT_GREATER_CONSTANT,  // OP_GREATER_CONSTANT
+    OP_JUMP_IF_NOT_LESS_CONSTANT,     // OP_LESS_CONSTANT
+
+    OP_CALL,  // Operand is the argument count. Callee and arguments are already in place on the value stack
+    OP_RETURN,
+
+    // Classes and instances. The property instructions take the name's constant index, then the 16 bit index of the
+    // instruction's property cache, high byte first
+    OP_CLASS,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+
+    // Array elements. OP_GET_INDEX replaces the array and index with the element, and OP_SET_INDEX replaces the
+    // array, index and value with the value
+    OP_GET_INDEX,
+    OP_SET_INDEX
 } OpCode;
 
+#define CACHE_WAYS 4  // Shapes a property cache remembers. An instruction that sees more than this is megamorphic
 
-/** Chunk will hold a series of instructions, along with other related data. Stored as dynamic array */
+/**
+    Inline cache of one property instruction. Each entry pairs a shape the instruction has seen with the slot the
+    property is stored in on instances of that shape. For a store that adds the property, *next* is the shape the
+    instance moves to, and otherwise it's the shape itself. Entry zero is checked first, so while an instruction only
+    ever sees one shape it costs a single compare
+ */
+typedef struct {
+    ObjShape* shapes[CACHE_WAYS];
+    ObjShape* next[CACHE_WAYS];
+    int slots[CACHE_WAYS];
+    int count;  // Entries in use. Once all of them are, shapes that miss are looked up every time
+} PropertyCache;
+
+
+/**
+    Chunk will hold a series of instructions, along with other related data. A chunk is written while its function is
+    being compiled, with its arrays growing in the compiler's *arena*. Once the function is done, compactChunk() moves
+    the code, line table and constants into one block of exactly the right size, laid out one after another in that
+    order followed by the property caches, and the chunk no longer has an arena
+ */
 typedef struct {
     int count;  // Count and capacity for dynamic array purposes
     int capacity;
-    uint8_t* code;  // Using uint8_t to represent bytes
+    uint8_t* code;  // Using uint8_t to represent bytes. Start of the whole block once compacted
     int* lines;  // Array of code line location for each byte - index of a line corresponds to the index of a byte in *code*
     ValueArray constants;
+    PropertyCache* caches;  // One per property instruction. NULL until compacted, only counted while being written
+    int cacheCount;
+    Arena* arena;  // Arena the arrays grow in while the chunk is being written. NULL once compacted
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addCache(Chunk* chunk);
+int instructionSize(uint8_t instruction);
+int jumpTarget(Chunk* chunk, int offset);
+void compactChunk(Chunk* chunk);
+size_t chunkBlockSize(Chunk* chunk);
 
 #endif
\ No newline at end of file
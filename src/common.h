@@ -5,7 +5,25 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Building with -DNDEBUG turns off the debugging output, which is what you want when measuring performance
+#ifndef NDEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+// Count every instruction the VM dispatches, and every pair of consecutive instructions, and report them to stderr
+// when the VM is freed. Off by default since it costs a couple of increments per instruction. Turn on with
+// -DDEBUG_DISPATCH_STATS
+// #define DEBUG_DISPATCH_STATS
+
+// Count every allocation made through reallocate() and report it, along with the peak RSS, to stderr when the VM is
+// freed. Turn on with -DDEBUG_ALLOCATION_STATS
+// #define DEBUG_ALLOCATION_STATS
+
+// Run functions as register based bytecode (see registers.h) instead of stack bytecode. Turn on with
+// -DCLOX_REGISTER_VM
+// #define CLOX_REGISTER_VM
+
+#define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
\ No newline at end of file
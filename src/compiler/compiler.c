@@ -1,21 +1,58 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "../arena/arena.h"
 #include "../common.h"
 #include "compiler.h"
+#include "../jit/jit.h"
+#include "../memory/memory.h"
+#include "../output/output.h"
+#include "../registers/registers.h"
 #include "../scanner/scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "../debug/debug.h"
 #endif
 
+typedef struct Compiler Compiler;
+
+/**
+    All of the state for one compilation. It's passed explicitly to every function in the compiler, so separate VMs
+    can compile on separate threads at the same time
+ */
 typedef struct {
+    Scanner scanner;
+    VM* vm;  // VM that owns the objects (strings, functions) the compiler creates
+    Compiler* compiler;  // Compiler for the function currently being compiled
+    Arena* arena;  // Everything that only lives as long as the compile: chunks being written, name tables
+    Arena ownArena;  // The arena, unless the VM lends one it keeps between compiles
+    ReplSession* session;  // Session whose script an interactive entry is compiled into. NULL for anything else
+    bool keptConstants;  // The script started with the constants of the session's previous entry
+    bool poolFull;  // Ran out of constants because of the kept ones. Nothing more is reported, see compileEntry()
+    bool canContinue;  // Source ending part way through an entry isn't an error, since more of it can follow
+    bool incomplete;  // Source ended part way through an entry. Nothing more is reported, see compileEntry()
+
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
 } Parser;
 
+/**
+    Compiler state kept from one entry of an interactive session to the next. Every entry is compiled into the same
+    script function, and the constants of the previous entry are kept in its pool, so an entry that uses names or
+    strings the session has already used adds no constants for them. The session's arena is lent to the VM, so it
+    stays mapped in between entries too
+ */
+struct sReplSession {
+    VM* vm;
+    ObjFunction* script;
+    Arena arena;
+};
+
 /** Precedence levels sorted lowest to highest */
 typedef enum {
     PREC_NONE,
@@ -31,7 +68,8 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();  // ParseFn is a func that takes no arguments and returns nothing
+// canAssign is false when parsing an operand of a higher precedence operator
+typedef void (*ParseFn)(Parser* parser, bool canAssign);
 
 typedef struct {
     ParseFn prefix;
@@ -39,104 +77,182 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-Parser parser;  // Single global variable like vm and scanner. Make factory if using for prod
+/**
+    A local variable. *depth* is the scope depth of the block the local was declared in, or -1 while the local is
+    declared but its initializer hasn't finished compiling yet
+ */
+typedef struct {
+    Token name;
+    int depth;
+} Local;
+
+/**
+    A string already in the chunk's constants, from an identifier or a literal. Strings are interned, so the string
+    pointer is the whole key
+ */
+typedef struct {
+    ObjString* name;  // NULL if the entry is empty
+    int constant;
+} NameConstant;
+
+typedef enum {
+    TYPE_FUNCTION,
+    TYPE_SCRIPT
+} FunctionType;
+
+/**
+    Compiler state for a single function. Compilers for nested function declarations are chained through *enclosing*.
+    Locals are laid out in the same order they will sit on the value stack at runtime, so a local's index in *locals*
+    is exactly its stack slot relative to the function's CallFrame
+ */
+struct Compiler {
+    struct Compiler* enclosing;
+    ObjFunction* function;
+    FunctionType type;
+    ArenaMark arenaMark;  // Where the arena was when this function started. Rewound to once it's compacted
+
+    Local locals[UINT8_COUNT];
+    int localCount;
+    int scopeDepth;  // Zero is global scope
 
-Chunk* compilingChunk;
+    int lastConstant;  // Offset of the most recent OP_CONSTANT, so the next instruction can be fused with it. -1 if none
+    int lastComparison;  // Offset of the most recent comparison, so a branch on its result can be fused with it. -1 if none
 
-static Chunk* currentChunk() {
-    return compilingChunk;
+    // Open addressed table of the strings in the chunk's constants, so each one is only added once. In the arena
+    NameConstant* names;
+    int nameCount;
+    int nameCapacity;
+};
+
+static Chunk* currentChunk(Parser* parser) {
+    return &parser->compiler->function->chunk;
+}
+
+/**
+    Whether the source ran out at *token*, part way through a declaration or string that more source could finish
+ */
+static bool endsEarly(Parser* parser, Token* token) {
+    if (token->type == TOKEN_EOF) return true;
+    return token->type == TOKEN_ERROR && parser->scanner.current == parser->scanner.end &&
+           *parser->scanner.start == '"';  // Unterminated string
 }
 
 /**
     Report an error at a particular token. If panic mode activated, do nothing. If panic mode not activated, activate
     panic mode, print an error message, tell parser that the compiler had an error, and skip all errors until we find
     a statement boundary to turn off panic mode
-
-    TODO: Add ability to turn panic mode off once statements are added to cLox
  */
-static void errorAt(Token* token, const char* message) {
-    if (parser.panicMode) return;  // Stop reporting errors until we reach synchronization point (statement boundary)
-    parser.panicMode = true;
+static void errorAt(Parser* parser, Token* token, const char* message) {
+    if (parser->panicMode) return;  // Stop reporting errors until we reach synchronization point (statement boundary)
+    if (parser->poolFull) return;
+    parser->panicMode = true;
 
-    fprintf(stderr, "[line %d] Error", token->line);
+    // An entry that just needs more lines isn't an error yet, unless there's already an error in what's there
+    if (parser->canContinue && !parser->hadError && endsEarly(parser, token)) {
+        parser->incomplete = true;
+        parser->hadError = true;
+        return;
+    }
+
+    flushOutput();  // With --stream, earlier statements may have printed
+    printError("[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        printError(" at end");
     } else if (token->type == TOKEN_ERROR) {
         // Don't report anything because we're in panic mode
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);  // print token itself
+        printError(" at '%.*s'", token->length, token->start);  // print token itself
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    printError(": %s\n", message);
+    parser->hadError = true;
 }
 
-static void error(const char*message) {
-    errorAt(&parser.previous, message);
+static void error(Parser* parser, const char*message) {
+    errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char* message) {
-    errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+    errorAt(parser, &parser->current, message);
 }
 
 /**
     Save current token as previous token, get next token, and save as current token. If the next token is an
     ERROR_TOKEN (represents lexical errors in scanning), report it
  */
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
         // Scan until you find a non error token
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->current = scanToken(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
 
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(parser, parser->current.start);
     }
 }
 
 /**
     Consume a particular TokenType token or report an error if type isn't next to be consumed
  */
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
+}
+
+static bool check(Parser* parser, TokenType type) {
+    return parser->current.type == type;
+}
+
+/**
+    Consume the current token only if it has type *type*
+ */
+static bool match(Parser* parser, TokenType type) {
+    if (!check(parser, type)) return false;
+    advance(parser);
+    return true;
 }
 
 /**
     Write one byte to the chunk
  */
-static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);  // previous line used for error reporting
+static void emitByte(Parser* parser, uint8_t byte) {
+    writeChunk(currentChunk(parser), byte, parser->previous.line);  // previous line used for error reporting
 }
 
 /**
     Emit two bytes consecutively. Convenience function for emitting opcode byte + operand byte
  */
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
 /**
-    Emit function return
+    Emit function return. Functions without an explicit return statement implicitly return nil
  */
-static void emitReturn() {
-    emitByte(OP_RETURN);
+static void emitReturn(Parser* parser) {
+    emitByte(parser, OP_NIL);
+    emitByte(parser, OP_RETURN);
 }
 
 /**
     Add a constant to the chunk constant array and check if too many constants
  */
-static uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
+static uint8_t makeConstant(Parser* parser, Value value) {
+    int constant = addConstant(currentChunk(parser), value);
     if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");
+        if (parser->keptConstants && parser->compiler->type == TYPE_SCRIPT && !parser->hadError) {
+            parser->poolFull = true;  // The entry is compiled again with an empty pool
+            parser->hadError = true;
+            return 0;
+        }
+        error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
@@ -148,47 +264,540 @@ static uint8_t makeConstant(Value value) {
     Emit a new constant byte to the bytestream, along with its index in the constant array. Since constants are of type
     Value, they can represent any lox type (number, string, etc.)
  */
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstantAt(Parser* parser, uint8_t constant) {
+    parser->compiler->lastConstant = currentChunk(parser)->count;
+    emitBytes(parser, OP_CONSTANT, constant);
+}
+
+static void emitConstant(Parser* parser, Value value) {
+    emitConstantAt(parser, makeConstant(parser, value));
+}
+
+/**
+    Return true if the last instruction emitted was an OP_CONSTANT, and so can still be fused with the next one
+ */
+static bool endsWithConstant(Parser* parser) {
+    return parser->compiler->lastConstant != -1 && parser->compiler->lastConstant == currentChunk(parser)->count - 2;
+}
+
+/**
+    Emit an operator that has no fused constant form, and return its offset for emitConditionJump
+ */
+static int emitOperator(Parser* parser, OpCode op) {
+    emitByte(parser, op);
+    return currentChunk(parser)->count - 1;
+}
+
+/**
+    Emit a binary operator. If its right operand was a constant, the OP_CONSTANT is rewritten in place into the fused
+    *constantOp* (which has the same constant index operand) instead of emitting a second instruction. Returns the
+    offset of the instruction, like emitOperator
+ */
+static int emitBinary(Parser* parser, OpCode op, OpCode constantOp) {
+    if (endsWithConstant(parser)) {
+        int offset = parser->compiler->lastConstant;
+        currentChunk(parser)->code[offset] = constantOp;
+        parser->compiler->lastConstant = -1;
+        return offset;
+    }
+
+    return emitOperator(parser, op);
+}
+
+/**
+    Note that the next instruction is the target of a jump. Whatever comes before it can be reached without running
+    it, so it must not be fused with anything emitted after this point
+ */
+static void markJumpTarget(Parser* parser) {
+    parser->compiler->lastConstant = -1;
+    parser->compiler->lastComparison = -1;
+}
+
+/**
+    Emit a forward jump with a placeholder offset, and return the offset of the placeholder for patchJump
+ */
+static int emitJump(Parser* parser, uint8_t instruction) {
+    emitByte(parser, instruction);
+    emitBytes(parser, 0xff, 0xff);
+    return currentChunk(parser)->count - 2;
+}
+
+/**
+    Point the jump whose placeholder is at *offset* at the next instruction to be emitted
+ */
+static void patchJump(Parser* parser, int offset) {
+    Chunk* chunk = currentChunk(parser);
+    int jump = chunk->count - offset - 2;  // Counted from the end of the placeholder
+    if (jump > UINT16_MAX) {
+        error(parser, "Too much code to jump over.");
+    }
+
+    chunk->code[offset] = (jump >> 8) & 0xff;
+    chunk->code[offset + 1] = jump & 0xff;
+    markJumpTarget(parser);
+}
+
+/**
+    Emit a backward jump to *loopStart*
+ */
+static void emitLoop(Parser* parser, int loopStart) {
+    emitByte(parser, OP_LOOP);
+
+    int offset = currentChunk(parser)->count - loopStart + 2;  // + 2 for the operand itself
+    if (offset > UINT16_MAX) error(parser, "Loop body too large.");
+
+    emitBytes(parser, (offset >> 8) & 0xff, offset & 0xff);
+}
+
+/**
+    The compare and branch instruction a comparison fuses into, or -1 if *instruction* isn't a comparison
+ */
+static int branchFor(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:            return OP_JUMP_IF_NOT_EQUAL;
+        case OP_NOT_EQUAL:        return OP_JUMP_IF_EQUAL;
+        case OP_GREATER:          return OP_JUMP_IF_NOT_GREATER;
+        case OP_GREATER_EQUAL:    return OP_JUMP_IF_NOT_GREATER_EQUAL;
+        case OP_LESS:             return OP_JUMP_IF_NOT_LESS;
+        case OP_LESS_EQUAL:       return OP_JUMP_IF_NOT_LESS_EQUAL;
+        case OP_EQUAL_CONSTANT:   return OP_JUMP_IF_NOT_EQUAL_CONSTANT;
+        case OP_GREATER_CONSTANT: return OP_JUMP_IF_NOT_GREATER_CONSTANT;
+        case OP_LESS_CONSTANT:    return OP_JUMP_IF_NOT_LESS_CONSTANT;
+        default:                  return -1;
+    }
+}
+
+/**
+    Emit the jump taken when the condition just compiled is false, and return its placeholder for patchJump. If the
+    condition ended with a comparison, the comparison is rewritten in place into a compare and branch, which doesn't
+    leave the condition on the stack, and *fused* is set. Otherwise it's an OP_JUMP_IF_FALSE, and the condition has to
+    be popped on both paths
+ */
+static int emitConditionJump(Parser* parser, bool* fused) {
+    Compiler* compiler = parser->compiler;
+    Chunk* chunk = currentChunk(parser);
+
+    *fused = false;
+    if (compiler->lastComparison != -1 &&
+        compiler->lastComparison + instructionSize(chunk->code[compiler->lastComparison]) == chunk->count) {
+        int branch = branchFor(chunk->code[compiler->lastComparison]);
+        if (branch != -1) {
+            chunk->code[compiler->lastComparison] = (uint8_t)branch;
+            compiler->lastComparison = -1;
+            *fused = true;
+            emitBytes(parser, 0xff, 0xff);
+            return currentChunk(parser)->count - 2;
+        }
+    }
+
+    return emitJump(parser, OP_JUMP_IF_FALSE);
+}
+
+/**
+    Start compiling a function. *function* is the object to compile into, or NULL for a new one, which for a function
+    declaration is named after the previous token
+ */
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type, ObjFunction* function) {
+    compiler->enclosing = parser->compiler;
+    compiler->function = NULL;  // Nulled out first in case allocating the function ever triggers a GC
+    compiler->type = type;
+    compiler->arenaMark = markArena(parser->arena);
+    compiler->localCount = 0;
+    compiler->scopeDepth = 0;
+    compiler->lastConstant = -1;
+    compiler->lastComparison = -1;
+    compiler->names = NULL;
+    compiler->nameCount = 0;
+    compiler->nameCapacity = 0;
+    compiler->function = function != NULL ? function : newFunction(parser->vm);
+    compiler->function->chunk.arena = parser->arena;
+    parser->compiler = compiler;
+
+    if (type != TYPE_SCRIPT && function == NULL) {
+        parser->compiler->function->name = copyString(parser->vm, parser->previous.start, parser->previous.length);
+    }
+
+    // Stack slot zero is claimed by the function being called, so give it an unusable empty name
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
+    local->depth = 0;
+    local->name.start = "";
+    local->name.length = 0;
+}
+
+#define THREAD_HOPS_MAX 16  // Longest chain of jumps followed, which also stops loops that only jump to themselves
+
+/**
+    Jump threading. Point every jump that lands on another jump straight at where that chain of jumps ends, so it runs
+    one dispatch instead of several. Nested ifs and loops, and and/or chains, produce these chains all the time.
+
+    An unconditional jump can go anywhere, and becomes an OP_JUMP or OP_LOOP to match its new direction. OP_JUMP_IF_FALSE
+    leaves the value it tested on the stack, so it can also go through another OP_JUMP_IF_FALSE, which is sure to
+    jump on the same value. Conditional jumps only jump forward, so they're only threaded through chains that end in
+    front of them
+ */
+static void threadJumps(Chunk* chunk) {
+    for (int offset = 0; offset < chunk->count; offset += instructionSize(chunk->code[offset])) {
+        uint8_t instruction = chunk->code[offset];
+        if (instruction < OP_JUMP || instruction > OP_JUMP_IF_NOT_LESS_CONSTANT) continue;  // Jumps are contiguous
+        bool unconditional = instruction == OP_JUMP || instruction == OP_LOOP;
+
+        int target = jumpTarget(chunk, offset);
+        for (int hops = 0; hops < THREAD_HOPS_MAX; hops++) {
+            uint8_t next = chunk->code[target];
+            if (next != OP_JUMP && next != OP_LOOP &&
+                (instruction != OP_JUMP_IF_FALSE || next != OP_JUMP_IF_FALSE)) break;
+            target = jumpTarget(chunk, target);
+        }
+
+        int size = instructionSize(instruction);
+        int end = offset + size;
+        int jump = target >= end ? target - end : end - target;
+        if (jump > UINT16_MAX || (!unconditional && target < end)) continue;
+
+        if (unconditional) chunk->code[offset] = target >= end ? OP_JUMP : OP_LOOP;
+        chunk->code[end - 2] = (jump >> 8) & 0xff;
+        chunk->code[end - 1] = jump & 0xff;
+    }
+}
+
+/**
+    Record that the forward jump at *offset* arrives at its target with *depth* values on the stack
+ */
+static void recordTargetDepth(int* targetDepths, Chunk* chunk, int offset, int depth) {
+    int target = jumpTarget(chunk, offset);
+    if (target > chunk->count) return;  // Only after a compile error
+    if (depth > targetDepths[target]) targetDepths[target] = depth;
 }
 
-static void endCompiler() {
-    emitReturn();
+/**
+    Walk a finished chunk and find the tallest the value stack can get while it runs, relative to the function's first
+    slot. *depth* is the number of slots already in use on entry (the callee plus its arguments). Statements always
+    leave the stack as they found it, so a pass over the bytecode in order is enough to find the peak, as long as the
+    depth is carried over jumps. Forward jumps record the depth they land with, and after an instruction that never
+    falls through, the depth picks up from there. Backward jumps only go to loop starts, which were already walked
+ */
+static int computeMaxSlots(Parser* parser, Chunk* chunk, int depth) {
+    int maxDepth = depth;
+
+    // Depth on arrival at each forward jump target, or -1 if nothing jumps there. In the arena, rewound with the rest
+    int* targetDepths = arenaAllocate(parser->arena, sizeof(int) * (chunk->count + 1));
+    for (int i = 0; i <= chunk->count; i++) targetDepths[i] = -1;
+    bool fallsThrough = true;
+
+    for (int offset = 0; offset < chunk->count;) {
+        if (targetDepths[offset] != -1) {
+            depth = fallsThrough && depth > targetDepths[offset] ? depth : targetDepths[offset];
+        }
+        fallsThrough = true;
+
+        uint8_t instruction = chunk->code[offset];
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_GET_LOCAL:
+            case OP_GET_GLOBAL:
+            case OP_CLASS:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                depth++;
+                break;
+            case OP_SET_LOCAL:
+            case OP_SET_GLOBAL:
+            case OP_EQUAL_CONSTANT:
+            case OP_GREATER_CONSTANT:
+            case OP_LESS_CONSTANT:
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_GET_PROPERTY:
+                break;
+            case OP_CALL:
+                depth -= chunk->code[offset + 1];  // Arguments are consumed and the callee is replaced by the result
+                break;
+            case OP_JUMP_IF_FALSE:
+                recordTargetDepth(targetDepths, chunk, offset, depth);
+                break;
+            case OP_JUMP:
+                recordTargetDepth(targetDepths, chunk, offset, depth);
+                fallsThrough = false;
+                break;
+            case OP_LOOP:
+                fallsThrough = false;
+                break;
+            case OP_JUMP_IF_NOT_EQUAL_CONSTANT:
+            case OP_JUMP_IF_NOT_GREATER_CONSTANT:
+            case OP_JUMP_IF_NOT_LESS_CONSTANT:
+                depth--;
+                recordTargetDepth(targetDepths, chunk, offset, depth);
+                break;
+            case OP_JUMP_IF_NOT_EQUAL:
+            case OP_JUMP_IF_EQUAL:
+            case OP_JUMP_IF_NOT_GREATER:
+            case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            case OP_JUMP_IF_NOT_LESS:
+            case OP_JUMP_IF_NOT_LESS_EQUAL:
+                depth -= 2;
+                recordTargetDepth(targetDepths, chunk, offset, depth);
+                break;
+            case OP_SET_INDEX:
+                depth -= 2;  // The array and index are replaced by the assigned value
+                break;
+            case OP_RETURN:
+                depth--;
+                fallsThrough = false;
+                break;
+            default:
+                // Everything else pops one value: binary operators, OP_POP, OP_DEFINE_GLOBAL, OP_PRINT,
+                // OP_SET_PROPERTY and OP_GET_INDEX
+                depth--;
+                break;
+        }
+
+        if (depth > maxDepth) maxDepth = depth;
+        offset += instructionSize(instruction);
+    }
+
+    return maxDepth;
+}
+
+/**
+    Finish the current function's bytecode and move its chunk out of the arena, leaving the compiler in place
+ */
+static ObjFunction* finishFunction(Parser* parser) {
+    emitReturn(parser);
+    ObjFunction* function = parser->compiler->function;
+    if (!parser->hadError) threadJumps(&function->chunk);  // Jumps past an error may never have been patched
+    function->maxSlots = computeMaxSlots(parser, &function->chunk, 1 + function->arity);
+    compactChunk(&function->chunk);
+
+    #ifdef CLOX_REGISTER_VM
+        if (!parser->hadError) translateToRegisters(function);
+    #endif
+
     #ifdef DEBUG_PRINT_CODE
-        if (!parser.hadError) {
-            disassembleChunk(currentChunk(), "code");
+        if (!parser->hadError) {
+            const char* name = function->name != NULL ? function->name->chars : "<script>";
+            disassembleChunk(currentChunk(parser), name);
+            if (function->registers != NULL) {
+                disassembleRegisterCode(function->registers, &function->chunk.constants, name);
+            }
         }
     #endif
+
+    return function;
+}
+
+/**
+    Finish the current function and go back to compiling the one it's nested in. Nothing the finished function left in
+    the arena is needed anymore, and the enclosing function didn't allocate anything while it was being compiled, so
+    the arena goes back to where it was when the function started
+ */
+static ObjFunction* endCompiler(Parser* parser) {
+    ObjFunction* function = finishFunction(parser);
+    rewindArena(parser->arena, parser->compiler->arenaMark);
+    parser->compiler = parser->compiler->enclosing;
+    return function;
+}
+
+static void beginScope(Parser* parser) {
+    parser->compiler->scopeDepth++;
 }
 
-static void expression();
+/**
+    Leave a block scope and pop every local declared inside it off the stack
+ */
+static void endScope(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    compiler->scopeDepth--;
+
+    while (compiler->localCount > 0 && compiler->locals[compiler->localCount - 1].depth > compiler->scopeDepth) {
+        emitByte(parser, OP_POP);
+        compiler->localCount--;
+    }
+}
+
+static void expression(Parser* parser);
+static void statement(Parser* parser);
+static void declaration(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
+
+static NameConstant* findName(NameConstant* names, int capacity, ObjString* name) {
+    uint32_t index = name->hash & (capacity - 1);
+    while (names[index].name != NULL && names[index].name != name) index = (index + 1) & (capacity - 1);
+    return &names[index];
+}
+
+/**
+    Grow the name table. The old table is left behind in the arena
+ */
+static void growNames(Parser* parser, Compiler* compiler) {
+    int capacity = GROW_CAPACITY(compiler->nameCapacity);
+    NameConstant* names = arenaAllocate(parser->arena, sizeof(NameConstant) * capacity);
+    memset(names, 0, sizeof(NameConstant) * capacity);
+
+    for (int i = 0; i < compiler->nameCapacity; i++) {
+        NameConstant* entry = &compiler->names[i];
+        if (entry->name != NULL) *findName(names, capacity, entry->name) = *entry;
+    }
+
+    compiler->names = names;
+    compiler->nameCapacity = capacity;
+}
+
+/**
+    Store a string in the constant table and return its index. A string that's already in the table is reused, so a
+    script can refer to any number of globals as long as there are few distinct ones
+ */
+static uint8_t stringConstant(Parser* parser, ObjString* string) {
+    Compiler* compiler = parser->compiler;
+    if (compiler->nameCount + 1 > compiler->nameCapacity * 3 / 4) growNames(parser, compiler);
+
+    NameConstant* entry = findName(compiler->names, compiler->nameCapacity, string);
+    if (entry->name == NULL) {
+        entry->name = string;
+        entry->constant = makeConstant(parser, OBJ_VAL(string));
+        compiler->nameCount++;
+    }
+
+    return (uint8_t)entry->constant;
+}
+
+/**
+    Store a variable's name in the constant table. Global variables are looked up by name at runtime, and the name is
+    too large to fit in the bytecode stream itself
+ */
+static uint8_t identifierConstant(Parser* parser, Token* name) {
+    return stringConstant(parser, copyString(parser->vm, name->start, name->length));
+}
+
+static bool identifiersEqual(Token* a, Token* b) {
+    if (a->length != b->length) return false;
+    return memcmp(a->start, b->start, a->length) == 0;
+}
+
+/**
+    Find the stack slot of the local variable *name*, or -1 if it's not a local (and therefore must be a global).
+    Searches backwards so inner scopes shadow outer ones
+ */
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name) {
+    for (int i = compiler->localCount - 1; i >= 0; i--) {
+        Local* local = &compiler->locals[i];
+        if (identifiersEqual(name, &local->name)) {
+            if (local->depth == -1) {
+                error(parser, "Cannot read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void addLocal(Parser* parser, Token name) {
+    if (parser->compiler->localCount == UINT8_COUNT) {
+        error(parser, "Too many local variables in function.");
+        return;
+    }
+
+    Local* local = &parser->compiler->locals[parser->compiler->localCount++];
+    local->name = name;
+    local->depth = -1;
+}
+
+/**
+    Record the existence of a local variable. Globals are late bound, so there's nothing to declare for them
+ */
+static void declareVariable(Parser* parser) {
+    if (parser->compiler->scopeDepth == 0) return;
+
+    Token* name = &parser->previous;
+    for (int i = parser->compiler->localCount - 1; i >= 0; i--) {
+        Local* local = &parser->compiler->locals[i];
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) break;
+
+        if (identifiersEqual(name, &local->name)) {
+            error(parser, "Variable with this name already declared in this scope.");
+        }
+    }
+
+    addLocal(parser, *name);
+}
+
+static uint8_t parseVariable(Parser* parser, const char* errorMessage) {
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
+
+    declareVariable(parser);
+    if (parser->compiler->scopeDepth > 0) return 0;
+
+    return identifierConstant(parser, &parser->previous);
+}
+
+static void markInitialized(Parser* parser) {
+    if (parser->compiler->scopeDepth == 0) return;
+    parser->compiler->locals[parser->compiler->localCount - 1].depth = parser->compiler->scopeDepth;
+}
+
+/**
+    Emit the bytecode to define a variable whose value is on top of the stack. A local's value simply stays where it is
+    and becomes the local's stack slot
+ */
+static void defineVariable(Parser* parser, uint8_t global) {
+    if (parser->compiler->scopeDepth > 0) {
+        markInitialized(parser);
+        return;
+    }
+
+    emitBytes(parser, OP_DEFINE_GLOBAL, global);
+}
+
+/**
+    Compile each argument of a call, leaving them on the stack in order right above the callee
+ */
+static uint8_t argumentList(Parser* parser) {
+    uint8_t argCount = 0;
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            expression(parser);
+
+            if (argCount == 255) {
+                error(parser, "Cannot have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
 
 /**
     Parse a new binary expression. Important to remember that chained binary expressions should be broken down into
     atomic binary expressions. For example, 5 + 5 + 5 + 5 is three separate binary expressions ((5 + 5) + 5) + 5
  */
-static void binary() {
+static void binary(Parser* parser, bool canAssign) {
     // Remember the operator.
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
 
     // Compile the right operand
     ParseRule* rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));  // parsePrecedence with rule's precedence + 1 because binary expressions are left associative
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));  // parsePrecedence with rule's precedence + 1 because binary expressions are left associative
 
-    // Emit the operator instruction.
+    // Emit the operator instruction. Comparisons are remembered, in case they turn out to be a branch's condition
+    Compiler* compiler = parser->compiler;
     switch (operatorType) {
-        case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL:    compiler->lastComparison = emitOperator(parser, OP_NOT_EQUAL); break;
+        case TOKEN_EQUAL_EQUAL:   compiler->lastComparison = emitBinary(parser, OP_EQUAL, OP_EQUAL_CONSTANT); break;
+        case TOKEN_GREATER:       compiler->lastComparison = emitBinary(parser, OP_GREATER, OP_GREATER_CONSTANT); break;
+        case TOKEN_GREATER_EQUAL: compiler->lastComparison = emitOperator(parser, OP_GREATER_EQUAL); break;
+        case TOKEN_LESS:          compiler->lastComparison = emitBinary(parser, OP_LESS, OP_LESS_CONSTANT); break;
+        case TOKEN_LESS_EQUAL:    compiler->lastComparison = emitOperator(parser, OP_LESS_EQUAL); break;
+        case TOKEN_PLUS:          emitBinary(parser, OP_ADD, OP_ADD_CONSTANT); break;
+        case TOKEN_MINUS:         emitBinary(parser, OP_SUBTRACT, OP_SUBTRACT_CONSTANT); break;
+        case TOKEN_STAR:          emitBinary(parser, OP_MULTIPLY, OP_MULTIPLY_CONSTANT); break;
+        case TOKEN_SLASH:         emitByte(parser, OP_DIVIDE); break;
         default:
             return; // Unreachable
     }
@@ -197,44 +806,172 @@ static void binary() {
 /**
     Parse a new enumerated literal expression
  */
-static void literal() {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+static void call(Parser* parser, bool canAssign) {
+    uint8_t argCount = argumentList(parser);
+    emitBytes(parser, OP_CALL, argCount);
+}
+
+/**
+    Emit a property instruction for the field *name*, with a property cache of its own
+ */
+static void emitProperty(Parser* parser, OpCode op, uint8_t name) {
+    int cache = addCache(currentChunk(parser));
+    if (cache > UINT16_MAX) {
+        error(parser, "Too many property accesses in one chunk.");
+        return;
+    }
+
+    emitBytes(parser, op, name);
+    emitBytes(parser, (cache >> 8) & 0xff, cache & 0xff);
+}
+
+/**
+    Property access on the instance to the left of the dot, or assignment to one of its fields
+ */
+static void dot(Parser* parser, bool canAssign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitProperty(parser, OP_SET_PROPERTY, name);
+    } else {
+        emitProperty(parser, OP_GET_PROPERTY, name);
+    }
+}
+
+/**
+    Element access on the array to the left of the bracket, or assignment to one of its elements
+ */
+static void index_(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitByte(parser, OP_SET_INDEX);
+    } else {
+        emitByte(parser, OP_GET_INDEX);
+    }
+}
+
+/**
+    Short circuiting and. If the left operand is falsey it's the result, and the right operand is skipped. Otherwise
+    it's popped and the right operand is the result
+ */
+static void and_(Parser* parser, bool canAssign) {
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND);
+
+    patchJump(parser, endJump);
+}
+
+/**
+    Short circuiting or. If the left operand is truthy it's the result, and the right operand is skipped
+ */
+static void or_(Parser* parser, bool canAssign) {
+    int elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    int endJump = emitJump(parser, OP_JUMP);
+
+    patchJump(parser, elseJump);
+    emitByte(parser, OP_POP);
+
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
+}
+
+static void literal(Parser* parser, bool canAssign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE: emitByte(parser, OP_FALSE); break;
+        case TOKEN_NIL: emitByte(parser, OP_NIL); break;
+        case TOKEN_TRUE: emitByte(parser, OP_TRUE); break;
         default:
             return;  // Unreachable
     }
 }
 
-static void grouping() {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool canAssign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
 /**
-    Emit one number constant
+    Emit one number constant. Whole numbers that fit are stored as ints
  */
-static void number() {
-    double value = strtod(parser.previous.start, NULL);  // Convert previously consumed number token into a double
-    emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser, bool canAssign) {
+    double value = strtod(parser->previous.start, NULL);  // Convert previously consumed number token into a double
+    if (value <= INT32_MAX && value == (int32_t)value) {  // Literals are never negative
+        emitConstant(parser, INT_VAL((int32_t)value));
+    } else {
+        emitConstant(parser, NUMBER_VAL(value));
+    }
 }
 
-static void string() {
+static void string(Parser* parser, bool canAssign) {
     // + 1 and -2 trim the leading and trailing quotation marks off of the current string lexeme
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length -2)));
+    ObjString* string = copyString(parser->vm, parser->previous.start + 1, parser->previous.length - 2);
+    emitConstantAt(parser, stringConstant(parser, string));
 }
 
-static void unary() {
-    TokenType operatorType = parser.previous.type;
+/**
+    Emit the get or set instruction for a named variable, depending on whether it's a local or a global and whether
+    it's the target of an assignment
+ */
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
+    uint8_t getOp, setOp;
+    int arg = resolveLocal(parser, parser->compiler, &name);
+
+    if (arg != -1) {
+        getOp = OP_GET_LOCAL;
+        setOp = OP_SET_LOCAL;
+    } else {
+        arg = identifierConstant(parser, &name);
+        getOp = OP_GET_GLOBAL;
+        setOp = OP_SET_GLOBAL;
+    }
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emitBytes(parser, setOp, (uint8_t)arg);
+    } else {
+        emitBytes(parser, getOp, (uint8_t)arg);
+    }
+}
+
+static void variable(Parser* parser, bool canAssign) {
+    namedVariable(parser, parser->previous, canAssign);
+}
+
+static void unary(Parser* parser, bool canAssign) {
+    TokenType operatorType = parser->previous.type;
 
     // Compile the operand
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
 
     // Emit the operator instructions
     switch (operatorType) {
-        case TOKEN_BANG: emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+        case TOKEN_BANG: emitByte(parser, OP_NOT); break;
+        case TOKEN_MINUS: {
+            // Negating a number literal is folded into the literal itself, so -1 is a single OP_CONSTANT. Every
+            // literal gets its own constant slot, so rewriting it in place can't affect anything else
+            Chunk* chunk = currentChunk(parser);
+            if (endsWithConstant(parser)) {
+                Value* constant = &chunk->constants.values[chunk->code[chunk->count - 1]];
+                if (IS_INT(*constant) && AS_INT(*constant) != 0) {
+                    *constant = INT_VAL(-AS_INT(*constant));
+                    break;
+                }
+                if (IS_NUMBER(*constant)) {
+                    *constant = NUMBER_VAL(-AS_NUMBER(*constant));  // -0 is only a double
+                    break;
+                }
+            }
+
+            emitByte(parser, OP_NEGATE);
+            break;
+        }
         default:
             return;  // Unreachable
     }
@@ -251,12 +988,14 @@ static void unary() {
     TODO: Not all rules are filled in yet. Until they are, placeholder is { NULL, NULL, PREC_NONE }
  */
 ParseRule rules[] = {
-    { grouping, NULL,    PREC_CALL },       // TOKEN_LEFT_PAREN
+    { grouping, call,    PREC_CALL },       // TOKEN_LEFT_PAREN
     { NULL,     NULL,    PREC_NONE },       // TOKEN_RIGHT_PAREN
     { NULL,     NULL,    PREC_NONE },       // TOKEN_LEFT_BRACE
     { NULL,     NULL,    PREC_NONE },       // TOKEN_RIGHT_BRACE
+    { NULL,     index_,  PREC_CALL },       // TOKEN_LEFT_BRACKET
+    { NULL,     NULL,    PREC_NONE },       // TOKEN_RIGHT_BRACKET
     { NULL,     NULL,    PREC_NONE },       // TOKEN_COMMA
-    { NULL,     NULL,    PREC_CALL },       // TOKEN_DOT
+    { NULL,     dot,     PREC_CALL },       // TOKEN_DOT
     { unary,    binary,  PREC_TERM },       // TOKEN_MINUS
     { NULL,     binary,  PREC_TERM },       // TOKEN_PLUS
     { NULL,     NULL,    PREC_NONE },       // TOKEN_SEMICOLON
@@ -270,10 +1009,10 @@ ParseRule rules[] = {
     { NULL,     binary,  PREC_COMPARISON }, // TOKEN_GREATER_EQUAL
     { NULL,     binary,  PREC_COMPARISON }, // TOKEN_LESS
     { NULL,     binary,  PREC_COMPARISON }, // TOKEN_LESS_EQUAL
-    { NULL,     NULL,    PREC_NONE },       // TOKEN_IDENTIFIER
+    { variable, NULL,    PREC_NONE },       // TOKEN_IDENTIFIER
     { string,   NULL,    PREC_NONE },       // TOKEN_STRING
     { number,   NULL,    PREC_NONE },       // TOKEN_NUMBER
-    { NULL,     NULL,    PREC_AND },        // TOKEN_AND
+    { NULL,     and_,    PREC_AND },        // TOKEN_AND
     { NULL,     NULL,    PREC_NONE },       // TOKEN_CLASS
     { NULL,     NULL,    PREC_NONE },       // TOKEN_ELSE
     { literal,  NULL,    PREC_NONE },       // TOKEN_FALSE
@@ -281,7 +1020,7 @@ ParseRule rules[] = {
     { NULL,     NULL,    PREC_NONE },       // TOKEN_FUN
     { NULL,     NULL,    PREC_NONE },       // TOKEN_IF
     { literal,  NULL,    PREC_NONE },       // TOKEN_NIL
-    { NULL,     NULL,    PREC_OR },         // TOKEN_OR
+    { NULL,     or_,     PREC_OR },         // TOKEN_OR
     { NULL,     NULL,    PREC_NONE },       // TOKEN_PRINT
     { NULL,     NULL,    PREC_NONE },       // TOKEN_RETURN
     { NULL,     NULL,    PREC_NONE },       // TOKEN_SUPER
@@ -329,24 +1068,30 @@ ParseRule rules[] = {
         - Nothing left in full expression to parse, no more tokens consumed
         - At the end of parsing +, OP_ADD is emitted to add the previous two constants (((5 * 4) + 2) and 3)
  */
-static void parsePrecedence(Precedence precedence) {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    advance(parser);
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
 
     // The first token in an expression will ALWAYS be a prefix expression, whether a literal (like a number) or a unary
     if (prefixRule == NULL) {
-        error("Expect expression.");
+        error(parser, "Expect expression.");
         return;
     }
-    prefixRule();
+    // Only allow assignment if we're parsing a low precedence expression, so that a * b = c isn't parsed as a * (b = c)
+    bool canAssign = precedence <= PREC_ASSIGNMENT;
+    prefixRule(parser, canAssign);
 
     // Only continue parsing for infix expressions if the infix expression has greater or equal precedence than
     // *precedence*. If next token has too low precedence, or isn't an infix operator, expression is done and stop
     // advancing
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+    while (precedence <= getRule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        infixRule(parser, canAssign);
+    }
+
+    if (canAssign && match(parser, TOKEN_EQUAL)) {
+        error(parser, "Invalid assignment target.");
     }
 }
 
@@ -357,20 +1102,569 @@ static ParseRule* getRule(TokenType type) {
     return &rules[type];
 }
 
-void expression() {
-    parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+    parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
-bool compile(const char* source, Chunk* chunk) {
-    initScanner(source);
+static void block(Parser* parser) {
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
 
-    compilingChunk = chunk;
-    parser.hadError = false;
-    parser.panicMode = false;
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+/**
+    Compile a function's parameters and body into the current Compiler. Parameters are just the first locals of the
+    function's scope
+ */
+static void functionBody(Parser* parser) {
+    beginScope(parser);  // No matching endScope(parser), the callee's frame is discarded wholesale at return
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255) {
+                errorAtCurrent(parser, "Cannot have more than 255 parameters.");
+            }
+
+            uint8_t paramConstant = parseVariable(parser, "Expect parameter name.");
+            defineVariable(parser, paramConstant);
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+}
+
+/**
+    Pre-parse a function: count its parameters, then skip its body by matching braces, and keep a copy of the source
+    from the parameter list to the closing brace to compile on the first call. Scanning is all the body costs until
+    then: no bytecode, constants or interned strings. Errors the scanner finds in the body are still reported now,
+    anything else on the first call.
+
+    A body is compiled on its own later, and it comes out the same as it would now. Nothing in it can refer to the
+    locals of the function it's nested in, since a name that isn't one of its own locals is a global, so there's no
+    scope to record beyond its parameters
+ */
+static ObjFunction* preparseFunction(Parser* parser) {
+    ObjFunction* function = newFunction(parser->vm);
+    function->name = copyString(parser->vm, parser->previous.start, parser->previous.length);
+    const char* start = parser->current.start;
+    int line = parser->current.line;
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            if (++function->arity > 255) errorAtCurrent(parser, "Cannot have more than 255 parameters.");
+            consume(parser, TOKEN_IDENTIFIER, "Expect parameter name.");
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+    int depth = 1;
+    while (depth > 0 && !check(parser, TOKEN_EOF)) {
+        if (check(parser, TOKEN_LEFT_BRACE)) depth++;
+        if (check(parser, TOKEN_RIGHT_BRACE)) depth--;
+        advance(parser);
+    }
+    if (depth > 0) errorAtCurrent(parser, "Expect '}' after block.");
 
-    advance();
-    expression();
-    consume(TOKEN_EOF, "Expect end of expression.");
-    endCompiler();
-    return !parser.hadError;
-}
\ No newline at end of file
+    if (!parser->hadError) {
+        const char* end = parser->previous.start + parser->previous.length;
+        function->lazy = newLazyBody(start, (int)(end - start), line);
+    }
+    return function;
+}
+
+/**
+    Compile a function declaration with a fresh Compiler, or only pre-parse it if the VM compiles bodies lazily, and
+    leave the resulting function object on the stack as a constant
+ */
+static void function(Parser* parser, FunctionType type) {
+    ObjFunction* function;
+    if (parser->vm->lazyFunctions) {
+        function = preparseFunction(parser);
+    } else {
+        Compiler compiler;
+        initCompiler(parser, &compiler, type, NULL);
+        functionBody(parser);
+        function = endCompiler(parser);
+    }
+
+    emitBytes(parser, OP_CONSTANT, makeConstant(parser, OBJ_VAL(function)));
+}
+
+/**
+    Classes only have a name for now. The body has to be empty
+ */
+static void classDeclaration(Parser* parser) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect class name.");
+    uint8_t nameConstant = identifierConstant(parser, &parser->previous);
+    declareVariable(parser);
+
+    emitBytes(parser, OP_CLASS, nameConstant);
+    defineVariable(parser, nameConstant);
+
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+}
+
+static void funDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect function name.");
+    markInitialized(parser);  // A function can refer to itself inside its body, so it's usable before being fully compiled
+    function(parser, TYPE_FUNCTION);
+    defineVariable(parser, global);
+}
+
+static void varDeclaration(Parser* parser) {
+    uint8_t global = parseVariable(parser, "Expect variable name.");
+
+    if (match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+    } else {
+        emitByte(parser, OP_NIL);
+    }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    defineVariable(parser, global);
+}
+
+/**
+    An expression followed by a semicolon. The expression's result is discarded
+ */
+static void expressionStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(parser, OP_POP);
+}
+
+/**
+    if (condition) thenBranch else elseBranch. When the condition was fused into a compare and branch there's nothing
+    left on the stack to pop, and without an else branch there's nothing to jump over either
+ */
+static void ifStatement(Parser* parser) {
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    bool fused;
+    int thenJump = emitConditionJump(parser, &fused);
+    if (!fused) emitByte(parser, OP_POP);
+    statement(parser);
+
+    if (fused && !check(parser, TOKEN_ELSE)) {
+        patchJump(parser, thenJump);
+        return;
+    }
+
+    int elseJump = emitJump(parser, OP_JUMP);
+
+    patchJump(parser, thenJump);
+    if (!fused) emitByte(parser, OP_POP);
+
+    if (match(parser, TOKEN_ELSE)) statement(parser);
+    patchJump(parser, elseJump);
+}
+
+static void whileStatement(Parser* parser) {
+    int loopStart = currentChunk(parser)->count;
+    markJumpTarget(parser);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+    bool fused;
+    int exitJump = emitConditionJump(parser, &fused);
+    if (!fused) emitByte(parser, OP_POP);
+    statement(parser);
+
+    emitLoop(parser, loopStart);
+
+    patchJump(parser, exitJump);
+    if (!fused) emitByte(parser, OP_POP);
+}
+
+/**
+    for (initializer; condition; increment) body. Every clause is optional. The increment is compiled before the body
+    but runs after it, so the body jumps back to the increment, and the increment jumps back to the condition
+ */
+static void forStatement(Parser* parser) {
+    beginScope(parser);  // A variable declared in the initializer is scoped to the loop
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(parser, TOKEN_SEMICOLON)) {
+        // No initializer
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);
+    } else {
+        expressionStatement(parser);
+    }
+
+    int loopStart = currentChunk(parser)->count;
+    markJumpTarget(parser);
+
+    int exitJump = -1;
+    bool fused = false;
+    if (!match(parser, TOKEN_SEMICOLON)) {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+
+        exitJump = emitConditionJump(parser, &fused);
+        if (!fused) emitByte(parser, OP_POP);
+    }
+
+    if (!match(parser, TOKEN_RIGHT_PAREN)) {
+        int bodyJump = emitJump(parser, OP_JUMP);
+
+        int incrementStart = currentChunk(parser)->count;
+        markJumpTarget(parser);
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        emitLoop(parser, loopStart);
+        loopStart = incrementStart;
+        patchJump(parser, bodyJump);
+    }
+
+    statement(parser);
+    emitLoop(parser, loopStart);
+
+    if (exitJump != -1) {
+        patchJump(parser, exitJump);
+        if (!fused) emitByte(parser, OP_POP);
+    }
+
+    endScope(parser);
+}
+
+static void printStatement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
+}
+
+static void returnStatement(Parser* parser) {
+    if (parser->compiler->type == TYPE_SCRIPT) {
+        error(parser, "Cannot return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emitReturn(parser);
+    } else {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+        emitByte(parser, OP_RETURN);
+    }
+}
+
+/**
+    Skip tokens until we reach something that looks like a statement boundary, so one syntax error doesn't cause a
+    cascade of bogus errors after it
+ */
+static void synchronize(Parser* parser) {
+    parser->panicMode = false;
+
+    while (parser->current.type != TOKEN_EOF) {
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
+
+        switch (parser->current.type) {
+            case TOKEN_CLASS:
+            case TOKEN_FUN:
+            case TOKEN_VAR:
+            case TOKEN_FOR:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_PRINT:
+            case TOKEN_RETURN:
+                return;
+
+            default:
+                ;  // Do nothing
+        }
+
+        advance(parser);
+    }
+}
+
+static void declaration(Parser* parser) {
+    if (match(parser, TOKEN_CLASS)) {
+        classDeclaration(parser);
+    } else if (match(parser, TOKEN_FUN)) {
+        funDeclaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        varDeclaration(parser);
+    } else {
+        statement(parser);
+    }
+
+    if (parser->panicMode) synchronize(parser);
+}
+
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        printStatement(parser);
+    } else if (match(parser, TOKEN_IF)) {
+        ifStatement(parser);
+    } else if (match(parser, TOKEN_WHILE)) {
+        whileStatement(parser);
+    } else if (match(parser, TOKEN_FOR)) {
+        forStatement(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        returnStatement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) {
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
+    } else {
+        expressionStatement(parser);
+    }
+}
+
+/**
+    Compile source code into the implicit top level function of a script. Returns NULL if there was a compile error
+ */
+static void initParser(Parser* parser, VM* vm, const char* source, size_t length) {
+    initScanner(&parser->scanner, source, length);
+    if (vm->compileArena != NULL) {
+        parser->arena = vm->compileArena;
+        resetArena(parser->arena);
+    } else {
+        initArena(&parser->ownArena);
+        parser->arena = &parser->ownArena;
+    }
+    parser->vm = vm;
+    parser->compiler = NULL;
+    parser->session = NULL;
+    parser->keptConstants = false;
+    parser->poolFull = false;
+    parser->canContinue = false;
+    parser->incomplete = false;
+    parser->hadError = false;
+    parser->panicMode = false;
+}
+
+// Give the arena back, unless it's the VM's. Every chunk has been compacted out of it by now
+static void freeParser(Parser* parser) {
+    if (parser->arena == &parser->ownArena) freeArena(parser->arena);
+}
+
+ObjFunction* compile(VM* vm, const char* source, size_t length) {
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser, vm, source, length);
+
+    Compiler compiler;
+    initCompiler(parser, &compiler, TYPE_SCRIPT, NULL);
+
+    advance(parser);
+
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
+
+    ObjFunction* function = endCompiler(parser);
+    freeParser(parser);
+    return parser->hadError ? NULL : function;
+}
+
+/**
+    Compile the body of a function that was pre-parsed, from the copy of its source. Errors are reported like any
+    compile error, at the script's line numbers. Returns false if there were any, in which case the function stays
+    uncompiled
+ */
+bool compileLazy(VM* vm, ObjFunction* function) {
+    LazyBody* body = function->lazy;
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser, vm, body->source, (size_t)body->length);
+    parser->scanner.line = body->line;
+
+    Compiler compiler;
+    initCompiler(parser, &compiler, TYPE_FUNCTION, function);
+    function->arity = 0;  // Counted again as the parameters are declared
+    advance(parser);
+    functionBody(parser);
+    endCompiler(parser);
+    freeParser(parser);
+
+    if (parser->hadError) {
+        freeChunk(&function->chunk);
+        initChunk(&function->chunk);
+        return false;
+    }
+
+    freeLazyBody(body);
+    function->lazy = NULL;
+    return true;
+}
+
+// Anything derived from a script's previous bytecode is stale once it's compiled again
+static void dropCompiledCode(ObjFunction* function) {
+    if (function->jit != NULL) {
+        freeJitCode(function->jit);
+        function->jit = NULL;
+    }
+    function->jitTried = false;
+    if (function->registers != NULL) {
+        freeRegisterCode(function->registers);
+        function->registers = NULL;
+    }
+}
+
+/**
+    Empty the script function so the next statement can be compiled into the same chunk. Every chunk has been
+    compacted out of the arena by now, so the arena starts over too, and compiling a long run of statements settles
+    into reusing the same memory
+ */
+static void resetScript(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    ObjFunction* function = compiler->function;
+    freeChunk(&function->chunk);
+    resetArena(parser->arena);
+    function->chunk.arena = parser->arena;
+    compiler->lastConstant = -1;
+    compiler->lastComparison = -1;
+    compiler->names = NULL;
+    compiler->nameCount = 0;
+    compiler->nameCapacity = 0;
+    dropCompiledCode(function);
+}
+
+#define RELEASE_BATCH (1024 * 1024)  // Source is handed back in batches, to keep madvise calls rare
+
+/**
+    Hand the pages of a read-only file mapping between *released* and *upTo* back to the kernel, once there's at least
+    a batch of them. Nothing keeps pointers into source that has already been compiled, and if a page is ever touched
+    again it's just read back in. Returns how far the source has been released
+ */
+static const char* releaseSource(const char* released, const char* upTo) {
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)released + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t)upTo & ~(pageSize - 1);
+
+    if (end < start + RELEASE_BATCH) return released;
+    madvise((void*)start, end - start, MADV_DONTNEED);
+    return (const char*)end;
+}
+
+/**
+    Compile and run a script one top level declaration at a time, so memory use doesn't grow with the length of the
+    script. Each declaration is compiled into the same script function, which is handed to *run* and then emptied for
+    the next one. Stops at the first compile or runtime error, by which point everything before it has already run.
+
+    If *mappedSource* is set, the source is a read-only file mapping, and the pages of it that have been compiled
+    are released as compilation moves along
+ */
+InterpretResult compileStream(VM* vm, const char* source, size_t length, bool mappedSource, ScriptRunner run) {
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser, vm, source, length);
+
+    Compiler compiler;
+    initCompiler(parser, &compiler, TYPE_SCRIPT, NULL);
+
+    advance(parser);
+
+    const char* released = source;
+    while (!match(parser, TOKEN_EOF)) {
+        resetScript(parser);
+        declaration(parser);
+        finishFunction(parser);
+        if (parser->hadError) {
+            freeParser(parser);
+            return INTERPRET_COMPILE_ERROR;
+        }
+
+        InterpretResult result = run(vm, compiler.function);
+        if (result != INTERPRET_OK) {
+            freeParser(parser);
+            return result;
+        }
+
+        if (mappedSource) released = releaseSource(released, parser->current.start);
+    }
+
+    freeParser(parser);
+    return INTERPRET_OK;
+}
+
+#define KEPT_CONSTANTS_MAX (UINT8_COUNT / 2)  // An entry starts with an empty pool once the script has more than this
+
+ReplSession* newReplSession(VM* vm) {
+    ReplSession* session = malloc(sizeof(ReplSession));
+    if (session == NULL) {
+        fprintf(stderr, "Not enough memory for the REPL.\n");
+        exit(74);
+    }
+
+    session->vm = vm;
+    session->script = newFunction(vm);  // Belongs to the VM's heap like any other function
+    initArena(&session->arena);
+    if (vm->compileArena == NULL) vm->compileArena = &session->arena;
+    return session;
+}
+
+void freeReplSession(ReplSession* session) {
+    if (session->vm->compileArena == &session->arena) session->vm->compileArena = NULL;
+    freeArena(&session->arena);
+    free(session);
+}
+
+static ObjFunction* compileEntryInto(Parser* parser, ReplSession* session, const char* source, size_t length,
+                                     bool keepConstants, bool canContinue) {
+    initParser(parser, session->vm, source, length);
+    parser->session = session;
+    parser->keptConstants = keepConstants;
+    parser->canContinue = canContinue;
+
+    // The previous entry's chunk is only needed for its constants now
+    ObjFunction* script = session->script;
+    Chunk previous = script->chunk;
+    initChunk(&script->chunk);
+    dropCompiledCode(script);
+    script->calls = 0;
+    script->backEdges = 0;
+
+    Compiler compiler;
+    initCompiler(parser, &compiler, TYPE_SCRIPT, script);
+    for (int i = 0; keepConstants && i < previous.constants.count; i++) {
+        Value value = previous.constants.values[i];
+        if (IS_STRING(value)) {
+            stringConstant(parser, AS_STRING(value));
+        } else {
+            makeConstant(parser, value);
+        }
+    }
+    freeChunk(&previous);
+
+    advance(parser);
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
+
+    endCompiler(parser);
+    freeParser(parser);
+    return parser->hadError ? NULL : script;
+}
+
+/**
+    Compile one entry of an interactive session into the session's script, which is returned, or NULL on an error.
+    If *incomplete* isn't NULL, source that ends part way through a declaration isn't reported as an error: NULL is
+    returned with *incomplete* set, so the caller can read more and compile the whole entry again. With NULL, it's
+    reported like any other error
+ */
+ObjFunction* compileEntry(ReplSession* session, const char* source, size_t length, bool* incomplete) {
+    Parser parser;
+    bool keepConstants = session->script->chunk.constants.count <= KEPT_CONSTANTS_MAX;
+    ObjFunction* script = compileEntryInto(&parser, session, source, length, keepConstants, incomplete != NULL);
+    if (parser.poolFull) script = compileEntryInto(&parser, session, source, length, false, incomplete != NULL);
+
+    if (incomplete != NULL) *incomplete = parser.incomplete;
+    return script;
+}
@@ -4,6 +4,14 @@
 #include "../object/object.h"
 #include "../vm/vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// Runs one compiled script function, for compileStream
+typedef InterpretResult (*ScriptRunner)(VM* vm, ObjFunction* script);
+
+ObjFunction* compile(VM* vm, const char* source, size_t length);
+InterpretResult compileStream(VM* vm, const char* source, size_t length, bool mappedSource, ScriptRunner run);
+ReplSession* newReplSession(VM* vm);
+void freeReplSession(ReplSession* session);
+ObjFunction* compileEntry(ReplSession* session, const char* source, size_t length, bool* incomplete);
+bool compileLazy(VM* vm, ObjFunction* function);
 
 #endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "../output/output.h"
 #include "../value/value.h"
 
 /*
@@ -15,7 +16,7 @@
     return. All bytes correspond to code from line 123
  */
 void disassembleChunk(Chunk* chunk, const char* name) {
-    printf("== %s ==\n", name);
+    printOutput("== %s ==\n", name);
 
     for (int offset = 0; offset < chunk->count;) {
         // offset is set here instead of in loop instructions because instructions can have varying
@@ -26,14 +27,56 @@ void disassembleChunk(Chunk* chunk, const char* name) {
 
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constIndex = chunk->code[offset + 1];  // refers to index of where constant is stored in ValueArray
-    printf("%-16s %4d '", name, constIndex);
+    printOutput("%-20s %4d '", name, constIndex);
     printValue(chunk->constants.values[constIndex]);
-    printf("'\n");
+    printOutput("'\n");
     return offset + 2;
 }
 
+/**
+    Instructions with a single byte operand that isn't a constant index, like a local's stack slot or an argument count
+ */
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    printOutput("%-20s %4d\n", name, slot);
+    return offset + 2;
+}
+
+/**
+    Jumps, printed with the offset they land on. *sign* is 1 for forward jumps and -1 for OP_LOOP
+ */
+static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printOutput("%-20s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+/**
+    Compare and branch against a constant. The constant index comes before the jump offset
+ */
+static int constantJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constIndex = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printOutput("%-20s %4d '", name, constIndex);
+    printValue(chunk->constants.values[constIndex]);
+    printOutput("' -> %d\n", offset + 4 + jump);
+    return offset + 4;
+}
+
+/**
+    Property instructions, printed with the property name and the index of their cache
+ */
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constIndex = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printOutput("%-20s %4d '", name, constIndex);
+    printValue(chunk->constants.values[constIndex]);
+    printOutput("' cache %d\n", cache);
+    return offset + 4;
+}
+
 static int simpleInstruction(const char* name, int offset) {
-    printf("%s\n", name);
+    printOutput("%s\n", name);
     return offset + 1;
 }
 
@@ -41,11 +84,11 @@ static int simpleInstruction(const char* name, int offset) {
     Disassemble one instruction
  */
 int disassembleInstruction(Chunk* chunk, int offset) {
-    printf("%04d ", offset);
+    printOutput("%04d ", offset);
     if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {  // Same line as previous byte
-        printf("   | ");
+        printOutput("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printOutput("%4d ", chunk->lines[offset]);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -58,6 +101,18 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_TRUE", offset);
         case OP_FALSE:
             return simpleInstruction("OP_FALSE", offset);
+        case OP_POP:
+            return simpleInstruction("OP_POP", offset);
+        case OP_GET_LOCAL:
+            return byteInstruction("OP_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL:
+            return byteInstruction("OP_SET_LOCAL", chunk, offset);
+        case OP_GET_GLOBAL:
+            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_DEFINE_GLOBAL:
+            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:
+            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_EQUAL:
             return simpleInstruction("OP_EQUAL", offset);
         case OP_GREATER:
@@ -76,10 +131,275 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_NOT", offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
+        case OP_NOT_EQUAL:
+            return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OP_GREATER_EQUAL:
+            return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case OP_LESS_EQUAL:
+            return simpleInstruction("OP_LESS_EQUAL", offset);
+        case OP_EQUAL_CONSTANT:
+            return constantInstruction("OP_EQUAL_CONSTANT", chunk, offset);
+        case OP_GREATER_CONSTANT:
+            return constantInstruction("OP_GREATER_CONSTANT", chunk, offset);
+        case OP_LESS_CONSTANT:
+            return constantInstruction("OP_LESS_CONSTANT", chunk, offset);
+        case OP_ADD_CONSTANT:
+            return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+        case OP_SUBTRACT_CONSTANT:
+            return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+        case OP_MULTIPLY_CONSTANT:
+            return constantInstruction("OP_MULTIPLY_CONSTANT", chunk, offset);
+        case OP_GREATER_NUMBER:
+            return simpleInstruction("OP_GREATER_NUMBER", offset);
+        case OP_LESS_NUMBER:
+            return simpleInstruction("OP_LESS_NUMBER", offset);
+        case OP_ADD_NUMBER:
+            return simpleInstruction("OP_ADD_NUMBER", offset);
+        case OP_ADD_STRING:
+            return simpleInstruction("OP_ADD_STRING", offset);
+        case OP_SUBTRACT_NUMBER:
+            return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+        case OP_MULTIPLY_NUMBER:
+            return simpleInstruction("OP_MULTIPLY_NUMBER", offset);
+        case OP_DIVIDE_NUMBER:
+            return simpleInstruction("OP_DIVIDE_NUMBER", offset);
+        case OP_GREATER_INT:
+            return simpleInstruction("OP_GREATER_INT", offset);
+        case OP_LESS_INT:
+            return simpleInstruction("OP_LESS_INT", offset);
+        case OP_ADD_INT:
+            return simpleInstruction("OP_ADD_INT", offset);
+        case OP_SUBTRACT_INT:
+            return simpleInstruction("OP_SUBTRACT_INT", offset);
+        case OP_MULTIPLY_INT:
+            return simpleInstruction("OP_MULTIPLY_INT", offset);
+        case OP_PRINT:
+            return simpleInstruction("OP_PRINT", offset);
+        case OP_JUMP:
+            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+        case OP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_LOOP:
+            return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_JUMP_IF_NOT_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESS:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_EQUAL_CONSTANT:
+            return constantJumpInstruction("OP_JUMP_IF_NOT_EQUAL_CONSTANT", chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER_CONSTANT:
+            return constantJumpInstruction("OP_JUMP_IF_NOT_GREATER_CONSTANT", chunk, offset);
+        case OP_JUMP_IF_NOT_LESS_CONSTANT:
+            return constantJumpInstruction("OP_JUMP_IF_NOT_LESS_CONSTANT", chunk, offset);
+        case OP_CALL:
+            return byteInstruction("OP_CALL", chunk, offset);
         case OP_RETURN:
             return simpleInstruction("OP_RETURN", offset);
+        case OP_CLASS:
+            return constantInstruction("OP_CLASS", chunk, offset);
+        case OP_GET_PROPERTY:
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_SET_PROPERTY:
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_GET_INDEX:
+            return simpleInstruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simpleInstruction("OP_SET_INDEX", offset);
         default:
-            printf("Unknown opcode %d\n", instruction);
+            printOutput("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
+}
+
+/*
+    Get the name of an opcode, for reports that aren't a full disassembly
+ */
+const char* opcodeName(uint8_t instruction) {
+    static const char* names[] = {
+        [OP_CONSTANT] = "OP_CONSTANT",
+        [OP_NIL] = "OP_NIL",
+        [OP_TRUE] = "OP_TRUE",
+        [OP_FALSE] = "OP_FALSE",
+        [OP_POP] = "OP_POP",
+        [OP_GET_LOCAL] = "OP_GET_LOCAL",
+        [OP_SET_LOCAL] = "OP_SET_LOCAL",
+        [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+        [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+        [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+        [OP_EQUAL] = "OP_EQUAL",
+        [OP_GREATER] = "OP_GREATER",
+        [OP_LESS] = "OP_LESS",
+        [OP_ADD] = "OP_ADD",
+        [OP_SUBTRACT] = "OP_SUBTRACT",
+        [OP_MULTIPLY] = "OP_MULTIPLY",
+        [OP_DIVIDE] = "OP_DIVIDE",
+        [OP_NOT] = "OP_NOT",
+        [OP_NEGATE] = "OP_NEGATE",
+        [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+        [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+        [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+        [OP_EQUAL_CONSTANT] = "OP_EQUAL_CONSTANT",
+        [OP_GREATER_CONSTANT] = "OP_GREATER_CONSTANT",
+        [OP_LESS_CONSTANT] = "OP_LESS_CONSTANT",
+        [OP_ADD_CONSTANT] = "OP_ADD_CONSTANT",
+        [OP_SUBTRACT_CONSTANT] = "OP_SUBTRACT_CONSTANT",
+        [OP_MULTIPLY_CONSTANT] = "OP_MULTIPLY_CONSTANT",
+        [OP_GREATER_NUMBER] = "OP_GREATER_NUMBER",
+        [OP_LESS_NUMBER] = "OP_LESS_NUMBER",
+        [OP_ADD_NUMBER] = "OP_ADD_NUMBER",
+        [OP_ADD_STRING] = "OP_ADD_STRING",
+        [OP_SUBTRACT_NUMBER] = "OP_SUBTRACT_NUMBER",
+        [OP_MULTIPLY_NUMBER] = "OP_MULTIPLY_NUMBER",
+        [OP_DIVIDE_NUMBER] = "OP_DIVIDE_NUMBER",
+        [OP_GREATER_INT] = "OP_GREATER_INT",
+        [OP_LESS_INT] = "OP_LESS_INT",
+        [OP_ADD_INT] = "OP_ADD_INT",
+        [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+        [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+        [OP_PRINT] = "OP_PRINT",
+        [OP_JUMP] = "OP_JUMP",
+        [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+        [OP_LOOP] = "OP_LOOP",
+        [OP_JUMP_IF_NOT_EQUAL] = "OP_JUMP_IF_NOT_EQUAL",
+        [OP_JUMP_IF_EQUAL] = "OP_JUMP_IF_EQUAL",
+        [OP_JUMP_IF_NOT_GREATER] = "OP_JUMP_IF_NOT_GREATER",
+        [OP_JUMP_IF_NOT_GREATER_EQUAL] = "OP_JUMP_IF_NOT_GREATER_EQUAL",
+        [OP_JUMP_IF_NOT_LESS] = "OP_JUMP_IF_NOT_LESS",
+        [OP_JUMP_IF_NOT_LESS_EQUAL] = "OP_JUMP_IF_NOT_LESS_EQUAL",
+        [OP_JUMP_IF_NOT_EQUAL_CONSTANT] = "OP_JUMP_IF_NOT_EQUAL_CONSTANT",
+        [OP_JUMP_IF_NOT_GREATER_CONSTANT] = "OP_JUMP_IF_NOT_GREATER_CONSTANT",
+        [OP_JUMP_IF_NOT_LESS_CONSTANT] = "OP_JUMP_IF_NOT_LESS_CONSTANT",
+        [OP_CALL] = "OP_CALL",
+        [OP_RETURN] = "OP_RETURN",
+        [OP_CLASS] = "OP_CLASS",
+        [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+        [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+        [OP_GET_INDEX] = "OP_GET_INDEX",
+        [OP_SET_INDEX] = "OP_SET_INDEX",
+    };
+
+    if (instruction >= sizeof(names) / sizeof(names[0]) || names[instruction] == NULL) return "OP_UNKNOWN";
+    return names[instruction];
+}
+
+/*
+    Disassemble a function's register code. Registers are printed as r<slot> and constants as their value, e.g.
+
+    == fib (registers) ==
+    0000    3 REG_LESS_CONSTANT    r2 = r1, '2'
+    0004    | REG_RETURN           r2
+ */
+void disassembleRegisterCode(RegisterCode* registers, ValueArray* constants, const char* name) {
+    printOutput("== %s (registers) ==\n", name);
+
+    for (int offset = 0; offset < registers->count;) {
+        offset = disassembleRegisterInstruction(registers, constants, offset);
+    }
+}
+
+static void printConstant(ValueArray* constants, uint8_t index) {
+    printOutput("'");
+    printValue(constants->values[index]);
+    printOutput("'");
+}
+
+int disassembleRegisterInstruction(RegisterCode* registers, ValueArray* constants, int offset) {
+    static const char* names[] = {
+        [REG_LOAD_CONSTANT] = "REG_LOAD_CONSTANT",
+        [REG_LOAD_NIL] = "REG_LOAD_NIL",
+        [REG_LOAD_TRUE] = "REG_LOAD_TRUE",
+        [REG_LOAD_FALSE] = "REG_LOAD_FALSE",
+        [REG_MOVE] = "REG_MOVE",
+        [REG_GET_GLOBAL] = "REG_GET_GLOBAL",
+        [REG_DEFINE_GLOBAL] = "REG_DEFINE_GLOBAL",
+        [REG_SET_GLOBAL] = "REG_SET_GLOBAL",
+        [REG_EQUAL] = "REG_EQUAL",
+        [REG_NOT_EQUAL] = "REG_NOT_EQUAL",
+        [REG_GREATER] = "REG_GREATER",
+        [REG_GREATER_EQUAL] = "REG_GREATER_EQUAL",
+        [REG_LESS] = "REG_LESS",
+        [REG_LESS_EQUAL] = "REG_LESS_EQUAL",
+        [REG_ADD] = "REG_ADD",
+        [REG_SUBTRACT] = "REG_SUBTRACT",
+        [REG_MULTIPLY] = "REG_MULTIPLY",
+        [REG_DIVIDE] = "REG_DIVIDE",
+        [REG_EQUAL_CONSTANT] = "REG_EQUAL_CONSTANT",
+        [REG_GREATER_CONSTANT] = "REG_GREATER_CONSTANT",
+        [REG_LESS_CONSTANT] = "REG_LESS_CONSTANT",
+        [REG_ADD_CONSTANT] = "REG_ADD_CONSTANT",
+        [REG_SUBTRACT_CONSTANT] = "REG_SUBTRACT_CONSTANT",
+        [REG_MULTIPLY_CONSTANT] = "REG_MULTIPLY_CONSTANT",
+        [REG_NOT] = "REG_NOT",
+        [REG_NEGATE] = "REG_NEGATE",
+        [REG_PRINT] = "REG_PRINT",
+        [REG_CALL] = "REG_CALL",
+        [REG_RETURN] = "REG_RETURN",
+    };
+
+    printOutput("%04d ", offset);
+    if (offset > 0 && registers->lines[offset] == registers->lines[offset - 1]) {
+        printOutput("   | ");
+    } else {
+        printOutput("%4d ", registers->lines[offset]);
+    }
+
+    uint8_t instruction = registers->code[offset];
+    uint8_t* operands = &registers->code[offset + 1];
+    if (instruction >= sizeof(names) / sizeof(names[0])) {
+        printOutput("Unknown register opcode %d\n", instruction);
+        return offset + 1;
+    }
+    printOutput("%-20s ", names[instruction]);
+
+    switch (instruction) {
+        case REG_LOAD_CONSTANT:
+        case REG_GET_GLOBAL:
+            printOutput("r%d = ", operands[0]);
+            printConstant(constants, operands[1]);
+            printOutput("\n");
+            return offset + 3;
+        case REG_LOAD_NIL:
+        case REG_LOAD_TRUE:
+        case REG_LOAD_FALSE:
+            printOutput("r%d\n", operands[0]);
+            return offset + 2;
+        case REG_MOVE:
+        case REG_NOT:
+        case REG_NEGATE:
+            printOutput("r%d = r%d\n", operands[0], operands[1]);
+            return offset + 3;
+        case REG_DEFINE_GLOBAL:
+        case REG_SET_GLOBAL:
+            printConstant(constants, operands[1]);
+            printOutput(" = r%d\n", operands[0]);
+            return offset + 3;
+        case REG_EQUAL_CONSTANT:
+        case REG_GREATER_CONSTANT:
+        case REG_LESS_CONSTANT:
+        case REG_ADD_CONSTANT:
+        case REG_SUBTRACT_CONSTANT:
+        case REG_MULTIPLY_CONSTANT:
+            printOutput("r%d = r%d, ", operands[0], operands[1]);
+            printConstant(constants, operands[2]);
+            printOutput("\n");
+            return offset + 4;
+        case REG_PRINT:
+        case REG_RETURN:
+            printOutput("r%d\n", operands[0]);
+            return offset + 2;
+        case REG_CALL:
+            printOutput("r%d (%d args)\n", operands[0], operands[1]);
+            return offset + 3;
+        default:  // Three register binary instructions
+            printOutput("r%d = r%d, r%d\n", operands[0], operands[1], operands[2]);
+            return offset + 4;
+    }
 }
\ No newline at end of file
@@ -2,8 +2,12 @@
 #define clox_debug_h
 
 #include "../chunk/chunk.h"
+#include "../registers/registers.h"
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
+const char* opcodeName(uint8_t instruction);
+void disassembleRegisterCode(RegisterCode* registers, ValueArray* constants, const char* name);
+int disassembleRegisterInstruction(RegisterCode* registers, ValueArray* constants, int offset);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,345 @@
+#include <string.h>
+
+#include "fiber.h"
+#include "../io/io.h"
+#include "../memory/memory.h"
+
+// Write the VM's running state back to the fiber that's stopping
+static void saveFiber(VM* vm) {
+    ObjFiber* current = vm->fiber;
+    current->frames = vm->frames;
+    current->frameCount = vm->frameCount;
+    current->frameCapacity = vm->frameCapacity;
+    current->stackTop = vm->stackTop;
+}
+
+/**
+    Load the VM's running state from *fiber*, once the one that's stopping has been saved. It can be the same fiber.
+    The main fiber's stack limit lives in vm->stack, since that's what grows it
+ */
+static void loadFiber(VM* vm, ObjFiber* fiber) {
+    vm->fiberSwitches++;
+    vm->fiber = fiber;
+    vm->frames = fiber->frames;
+    vm->frameCount = fiber->frameCount;
+    vm->frameCapacity = fiber->frameCapacity;
+    vm->stackTop = fiber->stackTop;
+    vm->stackLimit = fiber == &vm->mainFiber ? vm->stack.limit : fiber->stack + fiber->stackCapacity;
+}
+
+static void switchFiber(VM* vm, ObjFiber* fiber) {
+    saveFiber(vm);
+    loadFiber(vm, fiber);
+}
+
+/**
+    Switch to *fiber*, once the running one has been saved, and hand it *value*. A fiber that hasn't started gets its
+    stacks, just big enough for its function, and the value is passed to the function if it takes an argument. A
+    suspended fiber gets the value as the result of the yield() it's stopped in. A fiber that was waiting on I/O
+    already has its result on its stack
+ */
+static bool enterFiber(VM* vm, ObjFiber* fiber, Value value) {
+    if (fiber->state != FIBER_NEW) {
+        loadFiber(vm, fiber);
+        if (fiber->state == FIBER_SUSPENDED) push(vm, value);
+        fiber->state = FIBER_RUNNING;
+        return true;
+    }
+
+    ObjFunction* function = fiber->function;
+    fiber->stackCapacity = function->maxSlots;
+    fiber->stack = ALLOCATE(Value, fiber->stackCapacity);
+    fiber->stackTop = fiber->stack;
+    fiber->frameCapacity = FIBER_FRAMES_START;
+    fiber->frames = ALLOCATE(CallFrame, fiber->frameCapacity);
+    fiber->frameCount = 0;
+
+    loadFiber(vm, fiber);
+    fiber->state = FIBER_RUNNING;
+    push(vm, OBJ_VAL(function));
+    if (function->arity == 1) push(vm, value);
+    return callFunction(vm, function, function->arity);
+}
+
+// Free a finished fiber's stacks. The fiber itself lives on, since Lox code can still ask whether it's done
+static void releaseFiber(ObjFiber* fiber) {
+    FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+    FREE_ARRAY(CallFrame, fiber->frames, fiber->frameCapacity);
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+}
+
+static void schedule(VM* vm, ObjFiber* fiber) {
+    fiber->nextReady = NULL;
+    if (vm->readyTail == NULL) {
+        vm->readyHead = fiber;
+    } else {
+        vm->readyTail->nextReady = fiber;
+    }
+    vm->readyTail = fiber;
+}
+
+static ObjFiber* nextReady(VM* vm) {
+    ObjFiber* fiber = vm->readyHead;
+    vm->readyHead = fiber->nextReady;
+    if (vm->readyHead == NULL) vm->readyTail = NULL;
+    fiber->nextReady = NULL;
+    return fiber;
+}
+
+/**
+    Take the next fiber off the ready queue. If it's empty but fibers are waiting on I/O, wait for one of them to be
+    resumed. Returns NULL if there's nothing left to run
+ */
+static ObjFiber* nextRunnable(VM* vm) {
+    if (vm->readyHead == NULL && vm->io != NULL) completeIo(vm, true);
+    return vm->readyHead != NULL ? nextReady(vm) : NULL;
+}
+
+/**
+    Make room for one more CallFrame in the running fiber. The main fiber always has FRAMES_MAX, and other fibers
+    double up to that. Returns false if there's no more room to be had
+ */
+bool growFrames(VM* vm) {
+    if (vm->frameCapacity >= FRAMES_MAX) return false;
+
+    int capacity = vm->frameCapacity * 2;
+    if (capacity > FRAMES_MAX) capacity = FRAMES_MAX;
+
+    vm->frames = GROW_ARRAY(vm->frames, CallFrame, vm->frameCapacity, capacity);
+    vm->frameCapacity = capacity;
+    vm->fiber->frames = vm->frames;
+    vm->fiber->frameCapacity = capacity;
+    return true;
+}
+
+/**
+    Make sure the running fiber's stack has room for every slot below *top*. The main script's stack grows in place
+    (see ensureValueStack()). Any other fiber's stack at least doubles into a new block, and the stack top and every
+    frame's slots are moved along with it, so the caller must not hold on to pointers into the stack across this.
+    Returns false if the stack has overflowed
+ */
+bool growStack(VM* vm, Value* top) {
+    ObjFiber* fiber = vm->fiber;
+    if (fiber == &vm->mainFiber) {
+        if (!ensureValueStack(&vm->stack, top)) return false;
+        vm->stackLimit = vm->stack.limit;
+        return true;
+    }
+
+    int needed = (int)(top - fiber->stack);
+    int capacity = fiber->stackCapacity * 2;
+    if (capacity < needed) capacity = needed;
+
+    Value* stack = ALLOCATE(Value, capacity);
+    memcpy(stack, fiber->stack, sizeof(Value) * (size_t)(vm->stackTop - fiber->stack));
+    for (int i = 0; i < vm->frameCount; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - fiber->stack);
+    }
+    vm->stackTop = stack + (vm->stackTop - fiber->stack);
+
+    FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+    fiber->stack = stack;
+    fiber->stackCapacity = capacity;
+    vm->stackLimit = stack + capacity;
+    return true;
+}
+
+/**
+    Called when the running fiber's function returns *result*, with its last frame already popped. The result goes to
+    the fiber that resumed it, if any, or else the next ready fiber runs. Returns false when there's nothing left to
+    run, which leaves the VM in the main script with no frames
+ */
+bool finishFiber(VM* vm, Value result) {
+    ObjFiber* fiber = vm->fiber;
+    ObjFiber* caller = fiber->caller;
+    fiber->state = FIBER_DONE;
+    fiber->caller = NULL;
+    vm->stackTop = fiber->stack;
+
+    bool running = true;
+    ObjFiber* next;
+    if (caller != NULL) {
+        switchFiber(vm, caller);
+        push(vm, result);
+    } else if ((next = nextRunnable(vm)) != NULL) {
+        saveFiber(vm);
+        running = enterFiber(vm, next, NIL_VAL);
+    } else {
+        // The main script must have returned already, or it would be waiting on this fiber, in the ready queue or
+        // waiting on I/O
+        if (fiber != &vm->mainFiber) switchFiber(vm, &vm->mainFiber);
+        running = false;
+    }
+
+    if (fiber != &vm->mainFiber) releaseFiber(fiber);
+    return running;
+}
+
+/**
+    After a runtime error, mark the fibers that were running as done, since their frames are gone, and empty the ready
+    queue. Fibers waiting on I/O are never resumed. The VM itself goes back to the main script separately
+ */
+void abandonFibers(VM* vm) {
+    for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        if (fiber != &vm->mainFiber) fiber->state = FIBER_DONE;
+    }
+
+    vm->readyHead = NULL;
+    vm->readyTail = NULL;
+    if (vm->io != NULL) abandonIo(vm->io);
+}
+
+/**
+    Called by a native that has just started I/O for the running fiber. Takes the call off the stack and runs
+    something else until the I/O finishes, which is the same fiber straight away if there's nothing else to run
+ */
+bool waitForIo(VM* vm, int argCount) {
+    ObjFiber* fiber = vm->fiber;
+    vm->stackTop -= argCount + 1;  // This call's result is pushed by ioCompleted()
+    fiber->state = FIBER_WAITING;
+    saveFiber(vm);
+
+    return enterFiber(vm, nextRunnable(vm), NIL_VAL);  // Never NULL, since this fiber is waiting
+}
+
+// Hand a fiber waiting on I/O its result, and put it on the ready queue
+void ioCompleted(VM* vm, ObjFiber* fiber, Value result) {
+    *fiber->stackTop++ = result;
+    schedule(vm, fiber);
+}
+
+static bool checkArity(VM* vm, int argCount, int arity) {
+    if (argCount == arity) return true;
+    runtimeError(vm, "Expected %d arguments but got %d.", arity, argCount);
+    return false;
+}
+
+static bool fiberFunction(VM* vm, const char* name, Value value, ObjFunction** function) {
+    if (!IS_FUNCTION(value)) {
+        runtimeError(vm, "Argument to %s() must be a function.", name);
+        return false;
+    }
+
+    *function = AS_FUNCTION(value);
+    if ((*function)->arity > 1) {
+        runtimeError(vm, "Function passed to %s() must take at most one argument.", name);
+        return false;
+    }
+
+    // The fiber's stack is sized from the function's code, so a body that was only pre-parsed is compiled now
+    return (*function)->lazy == NULL || compileBody(vm, *function);
+}
+
+static bool fiberArgument(VM* vm, const char* name, Value value, ObjFiber** fiber) {
+    if (!IS_FIBER(value)) {
+        runtimeError(vm, "Argument to %s() must be a fiber.", name);
+        return false;
+    }
+
+    *fiber = AS_FIBER(value);
+    return true;
+}
+
+bool fiberNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjFunction* function;
+    if (!checkArity(vm, argCount, 1) || !fiberFunction(vm, "fiber", args[0], &function)) return false;
+
+    *result = OBJ_VAL(newFiber(vm, function));
+    return true;
+}
+
+bool spawnNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjFunction* function;
+    if (!checkArity(vm, argCount, 1) || !fiberFunction(vm, "spawn", args[0], &function)) return false;
+
+    ObjFiber* fiber = newFiber(vm, function);
+    fiber->scheduled = true;
+    schedule(vm, fiber);
+    *result = OBJ_VAL(fiber);
+    return true;
+}
+
+bool resumeNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount != 1 && argCount != 2) {
+        runtimeError(vm, "Expected 1 or 2 arguments but got %d.", argCount);
+        return false;
+    }
+
+    ObjFiber* fiber;
+    if (!fiberArgument(vm, "resume", args[0], &fiber)) return false;
+
+    if (fiber->shared) {
+        runtimeError(vm, "Cannot resume a shared fiber.");
+        return false;
+    }
+    if (fiber->scheduled) {
+        runtimeError(vm, "Cannot resume a spawned fiber.");
+        return false;
+    }
+    if (fiber->state == FIBER_RUNNING) {
+        runtimeError(vm, "Cannot resume a fiber that is already running.");
+        return false;
+    }
+    if (fiber->state == FIBER_WAITING) {
+        runtimeError(vm, "Cannot resume a fiber that is waiting on I/O.");
+        return false;
+    }
+    if (fiber->state == FIBER_DONE) {
+        runtimeError(vm, "Cannot resume a finished fiber.");
+        return false;
+    }
+
+    Value value = argCount == 2 ? args[1] : NIL_VAL;
+    vm->stackTop -= argCount + 1;  // This call's result is pushed when the fiber yields or returns
+    fiber->caller = vm->fiber;
+    saveFiber(vm);
+    return enterFiber(vm, fiber, value);
+}
+
+/**
+    Go back to the fiber that resumed this one, handing it *value*. A fiber nobody resumed goes to the back of the
+    ready queue instead, and the next ready fiber runs. The value is dropped then, and yield() returns nil, straight
+    away if there's nothing else ready
+ */
+bool yieldNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount > 1) {
+        runtimeError(vm, "Expected 0 or 1 arguments but got %d.", argCount);
+        return false;
+    }
+
+    ObjFiber* fiber = vm->fiber;
+    ObjFiber* caller = fiber->caller;
+    if (caller == NULL && vm->io != NULL) completeIo(vm, false);  // Let fibers whose I/O has finished take a turn
+    if (caller == NULL && vm->readyHead == NULL) {
+        *result = NIL_VAL;
+        return true;
+    }
+
+    Value value = argCount == 1 ? args[0] : NIL_VAL;
+    vm->stackTop -= argCount + 1;  // This call's result is pushed when the fiber is resumed
+    fiber->state = FIBER_SUSPENDED;
+
+    if (caller != NULL) {
+        fiber->caller = NULL;
+        switchFiber(vm, caller);
+        push(vm, value);
+        return true;
+    }
+
+    schedule(vm, fiber);
+    saveFiber(vm);
+    return enterFiber(vm, nextReady(vm), NIL_VAL);
+}
+
+bool doneNative(VM* vm, int argCount, Value* args, Value* result) {
+    ObjFiber* fiber;
+    if (!checkArity(vm, argCount, 1) || !fiberArgument(vm, "done", args[0], &fiber)) return false;
+
+    *result = BOOL_VAL(fiber->state == FIBER_DONE);
+    return true;
+}
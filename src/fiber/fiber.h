@@ -0,0 +1,34 @@
+/**
+    Module for fibers, coroutines that each have their own value stack and CallFrame stack, so many Lox tasks can take
+    turns on one thread. Switching fibers just swaps which stacks the VM points at (see struct sVM), so it never leaves
+    the dispatch loop and costs about as much as a call.
+
+    resume(fiber, value) runs a fiber until it yields or returns, and gives back what it yielded or returned. The value
+    is the result of the yield() the fiber is stopped in, or its function's argument if it hasn't started. spawn()
+    hands a new fiber to the scheduler instead: a ready queue that run() takes the next fiber from whenever a fiber
+    nobody resumed yields or returns, including the main script. So a script can spawn any number of fibers and keep
+    yielding until they're done. A fiber that starts file I/O waits for it off the ready queue (see io.h)
+ */
+
+#ifndef clox_fiber_h
+#define clox_fiber_h
+
+#include "../vm/vm.h"
+
+#define FIBER_FRAMES_START 4  // CallFrames a fiber has room for when it starts. Grows up to FRAMES_MAX
+
+bool growFrames(VM* vm);
+bool growStack(VM* vm, Value* top);
+bool finishFiber(VM* vm, Value result);
+void abandonFibers(VM* vm);
+bool waitForIo(VM* vm, int argCount);
+void ioCompleted(VM* vm, ObjFiber* fiber, Value result);
+
+// Natives that switch fibers take their call off the stack themselves, so callValue() knows not to
+bool fiberNative(VM* vm, int argCount, Value* args, Value* result);  // fiber(function), a new fiber
+bool resumeNative(VM* vm, int argCount, Value* args, Value* result);  // resume(fiber) or resume(fiber, value)
+bool yieldNative(VM* vm, int argCount, Value* args, Value* result);  // yield() or yield(value)
+bool spawnNative(VM* vm, int argCount, Value* args, Value* result);  // spawn(function), a new fiber, scheduled
+bool doneNative(VM* vm, int argCount, Value* args, Value* result);  // done(fiber), whether it has returned
+
+#endif
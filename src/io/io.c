@@ -0,0 +1,724 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "io.h"
+#include "../fiber/fiber.h"
+#include "../memory/memory.h"
+
+#define IO_RING_ENTRIES 256  // Submission queue entries. The kernel makes the completion queue twice as big
+#define IO_RING_ACTIVE IO_RING_ENTRIES  // Requests on the ring at once. Each has one operation in flight at a time
+#define IO_THREAD_COUNT 4
+#define IO_READ_START 4096  // Buffer a read on the ring starts with. Doubles until the whole file fits
+
+typedef enum {
+    IO_READ,
+    IO_WRITE
+} IoKind;
+
+// What a completion on the ring finished. Kept in the low bits of its user_data, under the request pointer
+typedef enum {
+    STAGE_OPEN,
+    STAGE_TRANSFER,  // A read or a write
+    STAGE_CLOSE
+} IoStage;
+
+#define STAGE_MASK 3
+
+/**
+    One readFile() or writeFile() call, from the native until its fiber is resumed with the result. On the ring it
+    lives on until its file is closed, which can be after that
+ */
+typedef struct sIoRequest {
+    IoKind kind;
+    ObjFiber* fiber;  // Resumed with the result
+    uint32_t generation;  // The loop's generation when this started. The fiber is only resumed if it's still current
+    const char* path;  // The path string's characters, which outlive the request
+    char* buffer;  // Where a read goes, and then the new string's characters. Where a write comes from
+    size_t size;  // Bytes to write. For a read, what the buffer has room for, not counting the terminating NUL
+    size_t done;
+    bool ended;  // A read has reached the end of the file
+    int fd;  // -1 until the file is open
+    int error;  // errno of the first thing that failed, or 0
+    struct sIoRequest* next;  // Next in the backlog, or in one of the thread pool's lists
+} IoRequest;
+
+#ifdef __linux__
+typedef struct {
+    int fd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;  // The same mapping as sqRing on kernels that map both rings at once
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+
+    unsigned* sqTail;  // Only ever written here
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;  // Written by the kernel
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    unsigned unsubmitted;  // Entries queued since the last io_uring_enter()
+} Ring;
+#else
+typedef struct {
+    int fd;
+} Ring;
+#endif
+
+struct sIoLoop {
+    VM* vm;
+    IoBackend backend;
+    uint32_t generation;  // Bumped by abandonIo(), so requests started before finish without resuming anyone
+    int waiting;  // Requests of the current generation whose fibers haven't been resumed yet
+    int resumed;  // Fibers resumed so far, so completeIo() can tell when it's got somewhere
+
+    // IO_URING
+    Ring ring;
+    int active;  // Requests on the ring, including ones that are only closing their file now
+    IoRequest* backlogHead;  // Requests waiting for room on the ring, oldest first
+    IoRequest* backlogTail;
+
+    // IO_THREADS
+    pthread_t threads[IO_THREAD_COUNT];
+    pthread_mutex_t lock;  // Guards everything below
+    pthread_cond_t queued;  // Signalled when a request is queued, or the pool is stopping
+    pthread_cond_t finished;  // Signalled when a worker finishes a request
+    IoRequest* queueHead;  // Requests waiting for a worker, oldest first
+    IoRequest* queueTail;
+    IoRequest* finishedHead;  // Requests whose fibers are waiting to be resumed, in no particular order
+    bool stopping;
+};
+
+bool parseIoBackend(const char* name, IoBackend* backend) {
+    if (strcmp(name, "uring") == 0) {
+        *backend = IO_URING;
+    } else if (strcmp(name, "threads") == 0) {
+        *backend = IO_THREADS;
+    } else if (strcmp(name, "sync") == 0) {
+        *backend = IO_SYNC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static IoRequest* newRequest(VM* vm, IoKind kind, ObjString* path) {
+    IoRequest* request = ALLOCATE(IoRequest, 1);
+    memset(request, 0, sizeof(IoRequest));
+    request->kind = kind;
+    request->fiber = vm->fiber;
+    request->generation = vm->io->generation;
+    request->path = path->chars;
+    request->fd = -1;
+    return request;
+}
+
+static void freeRequest(IoRequest* request) {
+    if (request->kind == IO_READ) FREE_ARRAY(char, request->buffer, request->size + 1);  // Unless it became a string
+    FREE(IoRequest, request);
+}
+
+/**
+    Resume the request's fiber with what readFile() or writeFile() returns. A read's buffer becomes the string's
+    characters, once it's been cut down to the file's length. Shrinking a block leaves it where it is, so that never
+    copies the file
+ */
+static void resumeRequest(IoLoop* loop, IoRequest* request) {
+    if (request->generation != loop->generation) return;  // Its fiber was abandoned after a runtime error
+
+    Value result;
+    if (request->kind == IO_WRITE) {
+        result = BOOL_VAL(request->error == 0);
+    } else if (request->error != 0) {
+        result = NIL_VAL;
+    } else {
+        if (request->done < request->size) {
+            request->buffer = GROW_ARRAY(request->buffer, char, request->size + 1, request->done + 1);
+            request->size = request->done;
+        }
+        request->buffer[request->done] = '\0';
+        result = OBJ_VAL(takeString(loop->vm, request->buffer, (int)request->done));
+        request->buffer = NULL;
+    }
+
+    loop->waiting--;
+    loop->resumed++;
+    ioCompleted(loop->vm, request->fiber, result);
+}
+
+static void failRequest(IoRequest* request, int error) {
+    if (request->error == 0) request->error = error;
+}
+
+// Room for *size* bytes and a terminating NUL, keeping what's been read. A Lox string's length has to fit in an int
+static void growReadBuffer(IoRequest* request, uint64_t size) {
+    if (size >= INT_MAX) {
+        failRequest(request, EFBIG);
+        return;
+    }
+
+    request->buffer = GROW_ARRAY(request->buffer, char, request->buffer == NULL ? 0 : request->size + 1, size + 1);
+    request->size = (size_t)size;
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+// IO_URING
+
+#ifdef __linux__
+
+static bool setupRing(Ring* ring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+    if (ring->fd < 0) return false;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cqRing = singleMap ? ring->sqRing : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+        if (!singleMap && ring->cqRing != MAP_FAILED) munmap(ring->cqRing, ring->cqRingSize);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+        close(ring->fd);
+        return false;
+    }
+
+    char* sq = ring->sqRing;
+    char* cq = ring->cqRing;
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->unsubmitted = 0;
+    return true;
+}
+
+static void freeRing(Ring* ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+/**
+    Submit whatever has been queued and, if *waitFor* isn't 0, wait until that many completions are ready. The
+    submission queue can never overflow, and the completion queue neither, since there are never more operations in
+    flight than IO_RING_ACTIVE requests have
+ */
+static void enterRing(Ring* ring, unsigned waitFor) {
+    for (;;) {
+        int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, waitFor,
+                                     waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted >= 0) {
+            ring->unsubmitted -= (unsigned)submitted;
+            return;
+        }
+        if (errno != EINTR) {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+            exit(74);
+        }
+    }
+}
+
+// A cleared entry at the tail of the submission queue. It's not the kernel's until pushOperation()
+static struct io_uring_sqe* nextOperation(Ring* ring) {
+    struct io_uring_sqe* sqe = &ring->sqes[*ring->sqTail & ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static void pushOperation(Ring* ring, IoRequest* request, IoStage stage) {
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & ring->sqMask;
+    ring->sqes[index].user_data = (uint64_t)(uintptr_t)request | stage;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->unsubmitted++;
+}
+
+static void startRingRequest(IoLoop* loop, IoRequest* request) {
+    Ring* ring = &loop->ring;
+    loop->active++;
+
+    struct io_uring_sqe* sqe = nextOperation(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)request->path;
+    if (request->kind == IO_READ) {
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    } else {
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->len = 0644;
+    }
+    pushOperation(ring, request, STAGE_OPEN);
+}
+
+/**
+    Read or write the rest, unless there's nothing left or something has failed. A read that has filled its buffer
+    doubles it first. The file isn't stat'ed for its size, since the ring hands stats to kernel threads, which costs
+    more than reading a small file twice over
+ */
+static bool pushTransfer(Ring* ring, IoRequest* request) {
+    bool transferred = request->kind == IO_READ ? request->ended : request->done == request->size;
+    if (request->error != 0 || transferred) return false;
+
+    if (request->kind == IO_READ && request->done == request->size) {
+        growReadBuffer(request, request->size == 0 ? IO_READ_START : (uint64_t)request->size * 2);
+        if (request->error != 0) return false;
+    }
+
+    struct io_uring_sqe* sqe = nextOperation(ring);
+    sqe->opcode = request->kind == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(request->buffer + request->done);
+    sqe->len = (uint32_t)(request->size - request->done);
+    sqe->off = request->done;
+    pushOperation(ring, request, STAGE_TRANSFER);
+    return true;
+}
+
+static void pushClose(Ring* ring, IoRequest* request) {
+    struct io_uring_sqe* sqe = nextOperation(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = request->fd;
+    pushOperation(ring, request, STAGE_CLOSE);
+}
+
+static void startBacklog(IoLoop* loop) {
+    while (loop->backlogHead != NULL && loop->active < IO_RING_ACTIVE) {
+        IoRequest* request = loop->backlogHead;
+        loop->backlogHead = request->next;
+        if (loop->backlogHead == NULL) loop->backlogTail = NULL;
+        startRingRequest(loop, request);
+    }
+}
+
+/**
+    Move a request on once its operation has completed. It reads to the end of the file, or writes the whole string,
+    then its fiber is resumed and its file closed. Closing is the last thing the request does
+ */
+static void advanceRequest(IoLoop* loop, IoRequest* request, IoStage stage, int result) {
+    switch (stage) {
+        case STAGE_OPEN:
+            if (result < 0) {
+                failRequest(request, -result);
+            } else {
+                request->fd = result;
+            }
+            break;
+        case STAGE_TRANSFER:
+            if (result < 0) {
+                failRequest(request, -result);
+            } else if (result == 0) {
+                // A write always gets somewhere
+                if (request->kind == IO_READ) request->ended = true;
+                else failRequest(request, EIO);
+            } else {
+                request->done += (size_t)result;
+            }
+            break;
+        case STAGE_CLOSE:
+            break;
+    }
+
+    if (stage != STAGE_CLOSE) {
+        if (pushTransfer(&loop->ring, request)) return;
+
+        resumeRequest(loop, request);
+        if (request->fd >= 0) {
+            pushClose(&loop->ring, request);
+            return;
+        }
+    }
+
+    loop->active--;
+    freeRequest(request);
+}
+
+static void reapRing(IoLoop* loop) {
+    Ring* ring = &loop->ring;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+        IoRequest* request = (IoRequest*)(uintptr_t)(cqe->user_data & ~(uint64_t)STAGE_MASK);
+        IoStage stage = (IoStage)(cqe->user_data & STAGE_MASK);
+        int result = cqe->res;
+        __atomic_store_n(ring->cqHead, ++head, __ATOMIC_RELEASE);
+
+        advanceRequest(loop, request, stage, result);
+    }
+}
+
+/**
+    Start what there's room for, submit it, and handle completions until a fiber has been resumed, waiting in the
+    kernel when nothing has completed yet. Without *wait*, this just submits and handles whatever's ready
+ */
+static void completeRing(IoLoop* loop, bool wait) {
+    int resumed = loop->resumed;
+    for (;;) {
+        startBacklog(loop);
+        reapRing(loop);
+
+        bool done = !wait || loop->resumed != resumed || loop->waiting == 0;
+        if (done && loop->backlogHead != NULL && loop->active < IO_RING_ACTIVE) continue;  // Reaping made room
+        if (done) {
+            if (loop->ring.unsubmitted > 0) enterRing(&loop->ring, 0);
+            return;
+        }
+        enterRing(&loop->ring, 1);
+    }
+}
+
+// Wait for everything on the ring, closes included, and free it all
+static void drainRing(IoLoop* loop) {
+    while (loop->backlogHead != NULL) {
+        IoRequest* request = loop->backlogHead;
+        loop->backlogHead = request->next;
+        freeRequest(request);
+    }
+    loop->backlogTail = NULL;
+
+    while (loop->active > 0) {
+        enterRing(&loop->ring, loop->ring.unsubmitted > 0 ? 0 : 1);
+        reapRing(loop);
+    }
+    freeRing(&loop->ring);
+}
+
+#else
+
+static bool setupRing(Ring* ring) {
+    return false;
+}
+
+static void completeRing(IoLoop* loop, bool wait) {
+}
+
+static void drainRing(IoLoop* loop) {
+}
+
+#endif
+
+static void submitRingRequest(IoLoop* loop, IoRequest* request) {
+    request->next = NULL;
+    if (loop->backlogTail == NULL) {
+        loop->backlogHead = request;
+    } else {
+        loop->backlogTail->next = request;
+    }
+    loop->backlogTail = request;
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+// IO_THREADS
+
+// Read or write the whole file with ordinary blocking calls, on one of the pool's threads
+static void runBlocking(IoRequest* request) {
+    if (request->kind == IO_READ) {
+        request->fd = open(request->path, O_RDONLY | O_CLOEXEC);
+    } else {
+        request->fd = open(request->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (request->fd < 0) {
+        failRequest(request, errno);
+        return;
+    }
+
+    struct stat info;
+    if (request->kind == IO_READ) {
+        if (fstat(request->fd, &info) < 0) {
+            failRequest(request, errno);
+        } else {
+            growReadBuffer(request, (uint64_t)info.st_size);
+        }
+    }
+
+    while (request->error == 0 && request->done < request->size) {
+        ssize_t count;
+        if (request->kind == IO_READ) {
+            count = read(request->fd, request->buffer + request->done, request->size - request->done);
+        } else {
+            count = write(request->fd, request->buffer + request->done, request->size - request->done);
+        }
+
+        if (count < 0) {
+            if (errno != EINTR) failRequest(request, errno);
+        } else if (count == 0) {
+            if (request->kind == IO_READ) break;  // The file shrank since it was stat'ed
+            failRequest(request, EIO);
+        } else {
+            request->done += (size_t)count;
+        }
+    }
+
+    close(request->fd);
+    request->fd = -1;
+}
+
+static void* ioWorker(void* argument) {
+    IoLoop* loop = argument;
+    pthread_mutex_lock(&loop->lock);
+
+    for (;;) {
+        while (loop->queueHead == NULL && !loop->stopping) pthread_cond_wait(&loop->queued, &loop->lock);
+        if (loop->queueHead == NULL) break;  // Stopping, and everything queued is done
+
+        IoRequest* request = loop->queueHead;
+        loop->queueHead = request->next;
+        if (loop->queueHead == NULL) loop->queueTail = NULL;
+
+        pthread_mutex_unlock(&loop->lock);
+        runBlocking(request);
+        pthread_mutex_lock(&loop->lock);
+
+        request->next = loop->finishedHead;
+        loop->finishedHead = request;
+        pthread_cond_signal(&loop->finished);
+    }
+
+    pthread_mutex_unlock(&loop->lock);
+    return NULL;
+}
+
+static void startThreads(IoLoop* loop) {
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->queued, NULL);
+    pthread_cond_init(&loop->finished, NULL);
+    loop->queueHead = NULL;
+    loop->queueTail = NULL;
+    loop->finishedHead = NULL;
+    loop->stopping = false;
+
+    for (int i = 0; i < IO_THREAD_COUNT; i++) {
+        if (pthread_create(&loop->threads[i], NULL, ioWorker, loop) != 0) {
+            fprintf(stderr, "Could not start I/O thread.\n");
+            exit(74);
+        }
+    }
+}
+
+static void submitThreadRequest(IoLoop* loop, IoRequest* request) {
+    request->next = NULL;
+    pthread_mutex_lock(&loop->lock);
+    if (loop->queueTail == NULL) {
+        loop->queueHead = request;
+    } else {
+        loop->queueTail->next = request;
+    }
+    loop->queueTail = request;
+    pthread_cond_signal(&loop->queued);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+static void completeThreads(IoLoop* loop, bool wait) {
+    pthread_mutex_lock(&loop->lock);
+    if (wait) {
+        while (loop->finishedHead == NULL && loop->waiting > 0) pthread_cond_wait(&loop->finished, &loop->lock);
+    }
+    IoRequest* finished = loop->finishedHead;
+    loop->finishedHead = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (finished != NULL) {
+        IoRequest* next = finished->next;
+        resumeRequest(loop, finished);
+        freeRequest(finished);
+        finished = next;
+    }
+}
+
+// Let the workers finish what's queued, then stop them and free every request
+static void stopThreads(IoLoop* loop) {
+    pthread_mutex_lock(&loop->lock);
+    loop->stopping = true;
+    pthread_cond_broadcast(&loop->queued);
+    pthread_mutex_unlock(&loop->lock);
+
+    for (int i = 0; i < IO_THREAD_COUNT; i++) pthread_join(loop->threads[i], NULL);
+
+    while (loop->finishedHead != NULL) {
+        IoRequest* request = loop->finishedHead;
+        loop->finishedHead = request->next;
+        freeRequest(request);
+    }
+    pthread_mutex_destroy(&loop->lock);
+    pthread_cond_destroy(&loop->queued);
+    pthread_cond_destroy(&loop->finished);
+}
+
+// ------------------------------------------------------------------------------------------------------------------
+
+/**
+    The VM's event loop, created the first time a fiber starts I/O. If io_uring can't be set up, because the kernel
+    is too old or it's been disabled, the VM falls back to the thread pool for good
+ */
+static IoLoop* ioLoop(VM* vm) {
+    if (vm->io != NULL) return vm->io;
+
+    IoLoop* loop = ALLOCATE(IoLoop, 1);
+    memset(loop, 0, sizeof(IoLoop));
+    loop->vm = vm;
+
+    if (vm->ioBackend == IO_URING && !setupRing(&loop->ring)) vm->ioBackend = IO_THREADS;
+    loop->backend = vm->ioBackend;
+    if (loop->backend == IO_THREADS) startThreads(loop);
+
+    vm->io = loop;
+    return loop;
+}
+
+/**
+    Finish everything still in flight without resuming anyone, and free the loop. The VM's strings have to outlive
+    this, since the kernel or a worker may still be writing one out
+ */
+void freeIoLoop(IoLoop* loop) {
+    loop->generation++;
+    if (loop->backend == IO_URING) {
+        drainRing(loop);
+    } else {
+        stopThreads(loop);
+    }
+    FREE(IoLoop, loop);
+}
+
+/**
+    Resume the fibers whose I/O has finished by putting them on the ready queue. With *wait*, this blocks until at
+    least one has been, unless no fiber is waiting on I/O at all
+ */
+void completeIo(VM* vm, bool wait) {
+    IoLoop* loop = vm->io;
+    if (loop->backend == IO_URING) {
+        completeRing(loop, wait);
+    } else {
+        completeThreads(loop, wait);
+    }
+}
+
+/**
+    After a runtime error, forget the fibers waiting on I/O. Their requests still run to the end, but nobody is resumed
+ */
+void abandonIo(IoLoop* loop) {
+    loop->generation++;
+    loop->waiting = 0;
+}
+
+// Read the whole file through stdio, right away
+static Value readFileSync(VM* vm, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NIL_VAL;
+
+    struct stat info;
+    if (fstat(fileno(file), &info) < 0 || info.st_size >= INT_MAX) {
+        fclose(file);
+        return NIL_VAL;
+    }
+
+    size_t size = (size_t)info.st_size;
+    char* buffer = ALLOCATE(char, size + 1);
+    size_t length = fread(buffer, sizeof(char), size, file);
+    bool failed = ferror(file) != 0;
+    fclose(file);
+
+    if (failed) {
+        FREE_ARRAY(char, buffer, size + 1);
+        return NIL_VAL;
+    }
+    buffer[length] = '\0';
+    return OBJ_VAL(takeString(vm, buffer, (int)length));
+}
+
+static bool writeFileSync(const char* path, ObjString* data) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    bool written = fwrite(data->chars, sizeof(char), (size_t)data->length, file) == (size_t)data->length;
+    return fclose(file) == 0 && written;
+}
+
+/**
+    Hand *request* to the event loop and suspend the running fiber until it's finished. Queued requests are only
+    submitted when there's nothing left to run, so every fiber gets to start its I/O first
+ */
+static bool startRequest(VM* vm, IoRequest* request, int argCount) {
+    IoLoop* loop = vm->io;
+    loop->waiting++;
+    if (loop->backend == IO_URING) {
+        submitRingRequest(loop, request);
+    } else {
+        submitThreadRequest(loop, request);
+    }
+    return waitForIo(vm, argCount);
+}
+
+bool readFileNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount != 1) {
+        runtimeError(vm, "Expected 1 arguments but got %d.", argCount);
+        return false;
+    }
+    if (!IS_STRING(args[0])) {
+        runtimeError(vm, "Argument to readFile() must be a string.");
+        return false;
+    }
+
+    if (vm->ioBackend == IO_SYNC) {
+        *result = readFileSync(vm, AS_CSTRING(args[0]));
+        return true;
+    }
+
+    ioLoop(vm);
+    return startRequest(vm, newRequest(vm, IO_READ, AS_STRING(args[0])), argCount);
+}
+
+bool writeFileNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount != 2) {
+        runtimeError(vm, "Expected 2 arguments but got %d.", argCount);
+        return false;
+    }
+    if (!IS_STRING(args[0]) || !IS_STRING(args[1])) {
+        runtimeError(vm, "Arguments to writeFile() must be strings.");
+        return false;
+    }
+
+    if (vm->ioBackend == IO_SYNC) {
+        *result = BOOL_VAL(writeFileSync(AS_CSTRING(args[0]), AS_STRING(args[1])));
+        return true;
+    }
+
+    ioLoop(vm);
+    IoRequest* request = newRequest(vm, IO_WRITE, AS_STRING(args[0]));
+    request->buffer = AS_CSTRING(args[1]);  // Written straight from the string's characters
+    request->size = (size_t)AS_STRING(args[1])->length;
+    return startRequest(vm, request, argCount);
+}
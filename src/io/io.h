@@ -0,0 +1,41 @@
+/**
+    Module for file I/O that doesn't stop the script. readFile() and writeFile() called from a fiber hand the work to
+    the VM's event loop and suspend the fiber, and other fibers run. Queued operations are only submitted, all in one
+    batch, once there's nothing else to run or a fiber yields, and whichever finish first resume their fibers. A
+    script that spawns a fiber per file gets every file in flight at once, while one that never spawns simply waits.
+
+    The loop is created the first time it's needed, with the backend the VM asks for:
+    - IO_URING submits opens, reads, writes and closes straight to the kernel through io_uring, with no thread in
+      between. A read goes into a buffer that doubles until the file fits, and that buffer becomes the string's
+      characters, so a file that fits the first buffer is never copied once it's read. A write goes out from the
+      string's own characters
+    - IO_THREADS hands each operation to a small pool of threads doing ordinary blocking calls. It's the fallback when
+      io_uring can't be set up, since epoll can't wait on regular files: they always poll as ready
+    - IO_SYNC reads and writes through stdio right in the native, and never suspends
+
+    Lox strings are immutable and live until the VM is freed, so the kernel or a worker thread can write one out while
+    the script carries on. freeIoLoop() waits for anything still in flight before the VM frees its strings
+ */
+
+#ifndef clox_io_h
+#define clox_io_h
+
+#include "../object/object.h"
+
+typedef enum {
+    IO_URING,
+    IO_THREADS,
+    IO_SYNC
+} IoBackend;
+
+typedef struct sIoLoop IoLoop;
+
+bool parseIoBackend(const char* name, IoBackend* backend);
+void freeIoLoop(IoLoop* loop);
+void completeIo(VM* vm, bool wait);
+void abandonIo(IoLoop* loop);
+
+bool readFileNative(VM* vm, int argCount, Value* args, Value* result);  // readFile(path), a string or nil on failure
+bool writeFileNative(VM* vm, int argCount, Value* args, Value* result);  // writeFile(path, string), true on success
+
+#endif
@@ -0,0 +1,123 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "isolate.h"
+
+/**
+    Shared state for one runIsolates() call. Workers claim jobs by bumping *nextJob*, which is the only thing they ever
+    write to concurrently
+ */
+typedef struct {
+    IsolateJob* jobs;
+    int jobCount;
+    SharedSegment* shared;
+    atomic_int nextJob;
+} IsolatePool;
+
+/**
+    Worker thread. Keeps claiming the next unclaimed job and running it in a brand new VM until every job is taken
+ */
+static void* isolateWorker(void* arg) {
+    IsolatePool* pool = (IsolatePool*)arg;
+
+    for (;;) {
+        int index = atomic_fetch_add(&pool->nextJob, 1);
+        if (index >= pool->jobCount) break;
+
+        IsolateJob* job = &pool->jobs[index];
+
+        VM* vm = malloc(sizeof(VM));
+        if (vm == NULL) {
+            fprintf(stderr, "Not enough memory to create an isolate.\n");
+            exit(74);
+        }
+
+        initSharedVM(vm, pool->shared);
+        job->result = interpret(vm, job->source, job->length);
+        freeVM(vm);
+        free(vm);
+    }
+
+    return NULL;
+}
+
+/**
+    Run every job on a pool of *threadCount* threads and wait for all of them to finish. Jobs are handed out in order,
+    but may finish in any order. If *shared* isn't NULL, every isolate is attached to it. Returns the number of threads
+    actually used, which is at least one and at most one per job
+ */
+int runIsolates(IsolateJob* jobs, int jobCount, int threadCount, SharedSegment* shared) {
+    IsolatePool pool;
+    pool.jobs = jobs;
+    pool.jobCount = jobCount;
+    pool.shared = shared;
+    atomic_init(&pool.nextJob, 0);
+
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > jobCount) threadCount = jobCount;
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * threadCount);
+    if (threads == NULL) {
+        fprintf(stderr, "Not enough memory to start isolate threads.\n");
+        exit(74);
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&threads[i], NULL, isolateWorker, &pool) != 0) {
+            fprintf(stderr, "Could not start isolate thread.\n");
+            exit(71);
+        }
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return threadCount;
+}
+
+/**
+    Run every job on this thread, time-sliced. Each job gets its own VM up front, then the scheduler goes round the
+    unfinished ones in order, letting each run *budget* back-edges plus calls before moving on, until all are done. A
+    script stuck in an infinite loop only ever costs the others one slice per round. If *shared* isn't NULL, every
+    isolate is attached to it
+ */
+void runScheduled(IsolateJob* jobs, int jobCount, uint64_t budget, SharedSegment* shared) {
+    VM** vms = malloc(sizeof(VM*) * jobCount);
+    if (vms == NULL) {
+        fprintf(stderr, "Not enough memory to create isolates.\n");
+        exit(74);
+    }
+
+    int running = 0;
+    for (int i = 0; i < jobCount; i++) {
+        vms[i] = malloc(sizeof(VM));
+        if (vms[i] == NULL) {
+            fprintf(stderr, "Not enough memory to create an isolate.\n");
+            exit(74);
+        }
+
+        initSharedVM(vms[i], shared);
+        vms[i]->budget = budget;
+        jobs[i].result = interpret(vms[i], jobs[i].source, jobs[i].length);
+        if (jobs[i].result == INTERPRET_BUDGET_EXHAUSTED) running++;
+    }
+
+    while (running > 0) {
+        for (int i = 0; i < jobCount; i++) {
+            if (jobs[i].result != INTERPRET_BUDGET_EXHAUSTED) continue;
+
+            jobs[i].result = resumeInterpret(vms[i]);
+            if (jobs[i].result != INTERPRET_BUDGET_EXHAUSTED) running--;
+        }
+    }
+
+    for (int i = 0; i < jobCount; i++) {
+        freeVM(vms[i]);
+        free(vms[i]);
+    }
+    free(vms);
+}
@@ -0,0 +1,24 @@
+/**
+    Module for running many independent scripts in one process. Each script gets its own VM, and so its own value
+    stack, globals, heap and intern table. The only thing isolates can share is a frozen SharedSegment, which is never
+    written to, so they need no locking
+
+    Isolates can run on a pool of threads, or all take turns on one thread, each running for a budget of back-edges
+    plus calls before handing over to the next
+ */
+
+#ifndef clox_isolate_h
+#define clox_isolate_h
+
+#include "../vm/vm.h"
+
+typedef struct {
+    const char* source;
+    size_t length;
+    InterpretResult result;  // Filled in once the isolate has finished running
+} IsolateJob;
+
+int runIsolates(IsolateJob* jobs, int jobCount, int threadCount, SharedSegment* shared);
+void runScheduled(IsolateJob* jobs, int jobCount, uint64_t budget, SharedSegment* shared);
+
+#endif
@@ -0,0 +1,797 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "jit.h"
+#include "../memory/memory.h"
+
+#if defined(__x86_64__) && !defined(CLOX_NO_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+    Machine code layout for one function:
+
+        prologue    save callee saved registers, load the VM state into them, jump to the requested instruction
+        exit        write the stack top back into the VM, restore registers and return
+        templates   one per bytecode instruction, in bytecode order, each falling through to the next. Jumps go
+                    straight to the template of the instruction they land on, so a loop runs without leaving
+                    until the VM's fuel runs out
+        bail stubs  out of line exits taken when a type guard fails
+
+    While compiled code runs, rbx holds the VM, r12 holds the stack top and r13 holds the frame's slots. Compiled code
+    returns the bytecode offset of the instruction the interpreter should run next in eax. The templates rely on the
+    layout of Value, so the JIT has to be revisited if that ever changes
+
+    Number templates have an int path, taken when the operands are both held as ints, and a double path for any other
+    numbers, which converts ints as it loads them. An int result that overflows (or would be -0) falls back to the
+    double path, which recomputes it from the operands
+ */
+_Static_assert(sizeof(Value) == 16, "JIT templates assume 16 byte Values");
+_Static_assert(offsetof(Value, as) == 8, "JIT templates assume the payload follows the type tag");
+_Static_assert(offsetof(Obj, type) == 0, "JIT templates assume objects start with their type");
+_Static_assert(offsetof(ObjArray, values) < 128, "JIT templates reach array fields with 8 bit displacements");
+
+typedef uint32_t (*JitEntry)(VM* vm, Value* slots, uint8_t* target);
+
+// A type guard that jumps to the bail stub of the instruction at *offset* when it fails
+typedef struct {
+    int patch;  // Position of the rel32 operand to fill in with the stub's address
+    int offset;
+} BailFixup;
+
+// A jump to the template of the instruction at bytecode offset *target*, which may not have been emitted yet
+typedef struct {
+    int patch;  // Position of the rel32 operand to fill in once every template is emitted
+    int target;
+} JumpFixup;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    BailFixup* fixups;
+    int fixupCount;
+    int fixupCapacity;
+
+    JumpFixup* jumps;
+    int jumpCount;
+    int jumpCapacity;
+
+    int exit;  // Position of the shared exit sequence
+} Assembler;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(as->code, uint8_t, oldCapacity, as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) emitByte(as, bytes[i]);
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void patch32(Assembler* as, int position, uint32_t value) {
+    for (int i = 0; i < 4; i++) as->code[position + i] = (uint8_t)(value >> (i * 8));
+}
+
+#define EMIT(as, ...) \
+    do { \
+        const uint8_t bytes[] = { __VA_ARGS__ }; \
+        emitBytes(as, bytes, sizeof(bytes)); \
+    } while (false)
+
+// Stack slots relative to the stack top, as 8 bit displacements off r12
+#define TOP     (-16)
+#define SECOND  (-32)
+#define THIRD   (-48)
+#define DISP(disp) ((uint8_t)(int8_t)(disp))
+
+// mov eax, offset; jmp exit
+static void emitExitAt(Assembler* as, int offset) {
+    emitByte(as, 0xB8);
+    emit32(as, (uint32_t)offset);
+    emitByte(as, 0xE9);
+    emit32(as, (uint32_t)(as->exit - (as->count + 4)));
+}
+
+// jcc bail, where *condition* is the second opcode byte of the jcc (0x85 for jne)
+static void emitBail(Assembler* as, uint8_t condition, int offset) {
+    EMIT(as, 0x0F, condition);
+
+    if (as->fixupCapacity < as->fixupCount + 1) {
+        int oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = GROW_CAPACITY(oldCapacity);
+        as->fixups = GROW_ARRAY(as->fixups, BailFixup, oldCapacity, as->fixupCapacity);
+    }
+
+    as->fixups[as->fixupCount].patch = as->count;
+    as->fixups[as->fixupCount].offset = offset;
+    as->fixupCount++;
+    emit32(as, 0);
+}
+
+// cmp dword [r12 + disp], VAL_NUMBER; jne bail
+static void emitDoubleGuard(Assembler* as, int disp, int offset) {
+    EMIT(as, 0x41, 0x83, 0x7C, 0x24, DISP(disp), VAL_NUMBER);
+    emitBail(as, 0x85, offset);
+}
+
+/**
+    A jump to a later point in the same template, where *condition* is the second opcode byte of a jcc, or 0 for a
+    jmp. Returns the position of the rel32 operand for patchForward() to fill in once the point is reached
+ */
+static int emitForward(Assembler* as, uint8_t condition) {
+    if (condition == 0) {
+        emitByte(as, 0xE9);
+    } else {
+        EMIT(as, 0x0F, condition);
+    }
+
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+static void patchForward(Assembler* as, int position) {
+    patch32(as, position, (uint32_t)(as->count - (position + 4)));
+}
+
+// cmp dword [r12 + disp], VAL_INT; jne forward. Returns the jump for patchForward(), which leads to the double path
+static int emitIntCheck(Assembler* as, int disp) {
+    EMIT(as, 0x41, 0x83, 0x7C, 0x24, DISP(disp), VAL_INT);
+    return emitForward(as, 0x85);
+}
+
+// The rel32 operand of a jump to the template for bytecode offset *target*
+static void emitJumpTarget(Assembler* as, int target) {
+    if (as->jumpCapacity < as->jumpCount + 1) {
+        int oldCapacity = as->jumpCapacity;
+        as->jumpCapacity = GROW_CAPACITY(oldCapacity);
+        as->jumps = GROW_ARRAY(as->jumps, JumpFixup, oldCapacity, as->jumpCapacity);
+    }
+
+    as->jumps[as->jumpCount].patch = as->count;
+    as->jumps[as->jumpCount].target = target;
+    as->jumpCount++;
+    emit32(as, 0);
+}
+
+// Write a whole Value to [r12 + disp]: mov dword [r12 + disp], type; mov rax, payload; mov [r12 + disp + 8], rax
+static void emitStoreValue(Assembler* as, int disp, Value value) {
+    uint64_t payload;
+    memcpy(&payload, (uint8_t*)&value + offsetof(Value, as), sizeof(payload));
+
+    EMIT(as, 0x41, 0xC7, 0x44, 0x24, DISP(disp));
+    emit32(as, (uint32_t)value.type);
+    EMIT(as, 0x48, 0xB8);
+    emit64(as, payload);
+    EMIT(as, 0x49, 0x89, 0x44, 0x24, DISP(disp + 8));
+}
+
+static void emitPush(Assembler* as) { EMIT(as, 0x49, 0x83, 0xC4, 0x10); }  // add r12, 16
+static void emitPop(Assembler* as)  { EMIT(as, 0x49, 0x83, 0xEC, 0x10); }  // sub r12, 16
+
+/**
+    Load the number at [r12 + disp] into xmm*reg* as a double, converting it if it's an int, and bail if it isn't a
+    number at all:
+
+        cmp dword [r12 + disp], VAL_INT; jne double
+        cvtsi2sd xmm, dword [r12 + disp + 8]; jmp done
+    double:
+        cmp dword [r12 + disp], VAL_NUMBER; jne bail
+        movsd xmm, [r12 + disp + 8]
+    done:
+ */
+static void emitLoadNumber(Assembler* as, int disp, int reg, int offset) {
+    uint8_t modrm = (uint8_t)(0x44 | (reg << 3));
+
+    EMIT(as, 0x41, 0x83, 0x7C, 0x24, DISP(disp), VAL_INT, 0x75, 9);
+    EMIT(as, 0xF2, 0x41, 0x0F, 0x2A, modrm, 0x24, DISP(disp + 8), 0xEB, 19);
+    emitDoubleGuard(as, disp, offset);
+    EMIT(as, 0xF2, 0x41, 0x0F, 0x10, modrm, 0x24, DISP(disp + 8));
+}
+
+// The second and top values, as doubles in xmm0 and xmm1
+static void emitLoadOperands(Assembler* as, int offset) {
+    emitLoadNumber(as, SECOND, 0, offset);
+    emitLoadNumber(as, TOP, 1, offset);
+}
+
+// The top value as a double in xmm0, then mov rax, constant; movq xmm1, rax
+static void emitLoadConstantOperands(Assembler* as, double constant, int offset) {
+    uint64_t bits;
+    memcpy(&bits, &constant, sizeof(bits));
+
+    emitLoadNumber(as, TOP, 0, offset);
+    EMIT(as, 0x48, 0xB8);
+    emit64(as, bits);
+    EMIT(as, 0x66, 0x48, 0x0F, 0x6E, 0xC8);
+}
+
+/**
+    addsd / subsd / mulsd / divsd xmm0, xmm1, then store xmm0 into [r12 + disp] as a double. The slot may have held an
+    int, so the type is written too
+ */
+static void emitArithmetic(Assembler* as, uint8_t sseOp, int disp) {
+    EMIT(as, 0xF2, 0x0F, sseOp, 0xC1);
+    EMIT(as, 0xF2, 0x41, 0x0F, 0x11, 0x44, 0x24, DISP(disp + 8));
+    EMIT(as, 0x41, 0xC7, 0x44, 0x24, DISP(disp));  // mov dword [r12 + disp], VAL_NUMBER
+    emit32(as, VAL_NUMBER);
+}
+
+// mov dword [r12 + disp], VAL_BOOL; movzx eax, al; mov [r12 + disp + 8], rax
+static void emitStoreBool(Assembler* as, int disp) {
+    EMIT(as, 0x41, 0xC7, 0x44, 0x24, DISP(disp));
+    emit32(as, VAL_BOOL);
+    EMIT(as, 0x0F, 0xB6, 0xC0);
+    EMIT(as, 0x49, 0x89, 0x44, 0x24, DISP(disp + 8));
+}
+
+typedef enum {
+    COMPARE_GREATER,        // a > b
+    COMPARE_LESS,           // a < b
+    COMPARE_GREATER_EQUAL,  // !(a < b)
+    COMPARE_LESS_EQUAL,     // !(a > b)
+    COMPARE_EQUAL,
+    COMPARE_NOT_EQUAL
+} Comparison;
+
+/**
+    Compare xmm0 (a) with xmm1 (b) and store the boolean result into [r12 + disp]. ucomisd reports an unordered result
+    (a NaN operand) as ZF = PF = CF = 1, so seta is false and setbe is true, which matches the interpreter's semantics
+    for both the plain and the negated comparisons
+ */
+static void emitComparison(Assembler* as, Comparison comparison, int disp) {
+    switch (comparison) {
+        case COMPARE_GREATER:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x97, 0xC0);  // ucomisd xmm0, xmm1; seta al
+            break;
+        case COMPARE_LESS:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x97, 0xC0);  // ucomisd xmm1, xmm0; seta al
+            break;
+        case COMPARE_GREATER_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x96, 0xC0);  // ucomisd xmm1, xmm0; setbe al
+            break;
+        case COMPARE_LESS_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x96, 0xC0);  // ucomisd xmm0, xmm1; setbe al
+            break;
+        case COMPARE_EQUAL:
+            // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8);
+            break;
+        case COMPARE_NOT_EQUAL:
+            // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8);
+            break;
+    }
+
+    emitStoreBool(as, disp);
+}
+
+/**
+    Second opcode bytes of the setcc that computes *comparison* from a signed int cmp, and of the jcc that jumps when
+    it's false. Ints are never NaN, so these are the plain signed conditions
+ */
+static uint8_t intSetcc(Comparison comparison) {
+    switch (comparison) {
+        case COMPARE_GREATER:       return 0x9F;  // setg
+        case COMPARE_LESS:          return 0x9C;  // setl
+        case COMPARE_GREATER_EQUAL: return 0x9D;  // setge
+        case COMPARE_LESS_EQUAL:    return 0x9E;  // setle
+        case COMPARE_EQUAL:         return 0x94;  // sete
+        default:                    return 0x95;  // setne
+    }
+}
+
+static uint8_t intJumpUnless(Comparison comparison) {
+    switch (comparison) {
+        case COMPARE_GREATER:       return 0x8E;  // jle
+        case COMPARE_LESS:          return 0x8D;  // jge
+        case COMPARE_GREATER_EQUAL: return 0x8C;  // jl
+        case COMPARE_LESS_EQUAL:    return 0x8F;  // jg
+        case COMPARE_EQUAL:         return 0x85;  // jne
+        default:                    return 0x84;  // je
+    }
+}
+
+/**
+    Compare xmm0 (a) with xmm1 (b) and jump to the template for *target* if the comparison is false, for the compare
+    and branch instructions. Unordered results jump exactly when the interpreter's comparison is false, like
+    emitComparison
+ */
+static void emitBranchUnless(Assembler* as, Comparison comparison, int target) {
+    switch (comparison) {
+        case COMPARE_GREATER:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x86);  // ucomisd xmm0, xmm1; jbe target
+            break;
+        case COMPARE_LESS:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x86);  // ucomisd xmm1, xmm0; jbe target
+            break;
+        case COMPARE_GREATER_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC8, 0x0F, 0x87);  // ucomisd xmm1, xmm0; ja target
+            break;
+        case COMPARE_LESS_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x87);  // ucomisd xmm0, xmm1; ja target
+            break;
+        case COMPARE_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x0F, 0x85);  // ucomisd xmm0, xmm1; jne target; jp target
+            emitJumpTarget(as, target);
+            EMIT(as, 0x0F, 0x8A);
+            break;
+        case COMPARE_NOT_EQUAL:
+            EMIT(as, 0x66, 0x0F, 0x2E, 0xC1, 0x7A, 0x06, 0x0F, 0x84);  // ucomisd xmm0, xmm1; jp over; je target
+            break;
+    }
+
+    emitJumpTarget(as, target);
+}
+
+/**
+    The comparison a compare and branch instruction makes, which it jumps on when false
+ */
+static Comparison branchComparison(uint8_t instruction) {
+    switch (instruction) {
+        case OP_JUMP_IF_NOT_GREATER: case OP_JUMP_IF_NOT_GREATER_CONSTANT: return COMPARE_GREATER;
+        case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_LESS_CONSTANT: return COMPARE_LESS;
+        case OP_JUMP_IF_NOT_GREATER_EQUAL: return COMPARE_GREATER_EQUAL;
+        case OP_JUMP_IF_NOT_LESS_EQUAL: return COMPARE_LESS_EQUAL;
+        case OP_JUMP_IF_NOT_EQUAL: case OP_JUMP_IF_NOT_EQUAL_CONSTANT: return COMPARE_EQUAL;
+        default: return COMPARE_NOT_EQUAL;  // OP_JUMP_IF_EQUAL
+    }
+}
+
+static uint8_t arithmeticOp(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD: case OP_ADD_NUMBER: case OP_ADD_INT: case OP_ADD_CONSTANT: return 0x58;
+        case OP_SUBTRACT: case OP_SUBTRACT_NUMBER: case OP_SUBTRACT_INT: case OP_SUBTRACT_CONSTANT: return 0x5C;
+        case OP_MULTIPLY: case OP_MULTIPLY_NUMBER: case OP_MULTIPLY_INT: case OP_MULTIPLY_CONSTANT: return 0x59;
+        default: return 0x5E;  // Division
+    }
+}
+
+/**
+    Int path of an arithmetic instruction, computing eax = eax op [r12 + disp] (or op the int constant, when *disp*
+    is 0) into [r12 + resultDisp]. Records the jumps to the double path in *slow* and returns how many there are. Ends
+    with a jump over the double path, returned in *done*
+ */
+static int emitIntArithmetic(Assembler* as, uint8_t sseOp, int disp, int32_t constant, int resultDisp, int* slow,
+                             int* done) {
+    int count = 0;
+    EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(resultDisp + 8));  // mov eax, [r12 + resultDisp + 8]
+
+    if (disp != 0) {
+        switch (sseOp) {
+            case 0x58: EMIT(as, 0x41, 0x03, 0x44, 0x24, DISP(disp + 8)); break;  // add eax, [r12 + disp + 8]
+            case 0x5C: EMIT(as, 0x41, 0x2B, 0x44, 0x24, DISP(disp + 8)); break;  // sub eax, [r12 + disp + 8]
+            default:   EMIT(as, 0x41, 0x0F, 0xAF, 0x44, 0x24, DISP(disp + 8)); break;  // imul eax, [...]
+        }
+    } else {
+        switch (sseOp) {
+            case 0x58: emitByte(as, 0x05); break;  // add eax, imm32
+            case 0x5C: emitByte(as, 0x2D); break;  // sub eax, imm32
+            default:   EMIT(as, 0x69, 0xC0); break;  // imul eax, eax, imm32
+        }
+        emit32(as, (uint32_t)constant);
+    }
+
+    slow[count++] = emitForward(as, 0x80);  // jo
+    if (sseOp == 0x59) {
+        // A zero product might be -0, so the double path works out its sign: test eax, eax; jz
+        EMIT(as, 0x85, 0xC0);
+        slow[count++] = emitForward(as, 0x84);
+    }
+
+    EMIT(as, 0x41, 0x89, 0x44, 0x24, DISP(resultDisp + 8));  // mov [r12 + resultDisp + 8], eax
+    *done = emitForward(as, 0);
+    return count;
+}
+
+/**
+    Guards for an array element access, with the array at [r12 + arrayDisp] and the index at [r12 + indexDisp]. Bails
+    unless the array really is one (and for a *store*, isn't shared) and the index is an int within it. Anything else
+    is left to the interpreter, which reports any error. Leaves the element at [rax + rcx * 8]:
+
+        cmp dword [r12 + indexDisp], VAL_INT; jne bail
+        cmp dword [r12 + arrayDisp], VAL_OBJ; jne bail
+        mov rax, [r12 + arrayDisp + 8]; cmp dword [rax], OBJ_ARRAY; jne bail
+        cmp byte [rax + shared], 0; jne bail    (stores only)
+        mov ecx, [r12 + indexDisp + 8]; cmp ecx, [rax + count]; jae bail
+        mov rax, [rax + values]
+ */
+static void emitElementAddress(Assembler* as, int arrayDisp, int indexDisp, bool store, int offset) {
+    EMIT(as, 0x41, 0x83, 0x7C, 0x24, DISP(indexDisp), VAL_INT);
+    emitBail(as, 0x85, offset);
+    EMIT(as, 0x41, 0x83, 0x7C, 0x24, DISP(arrayDisp), VAL_OBJ);
+    emitBail(as, 0x85, offset);
+    EMIT(as, 0x49, 0x8B, 0x44, 0x24, DISP(arrayDisp + 8), 0x83, 0x38, OBJ_ARRAY);
+    emitBail(as, 0x85, offset);
+    if (store) {
+        EMIT(as, 0x80, 0x78, offsetof(ObjArray, shared), 0x00);
+        emitBail(as, 0x85, offset);
+    }
+
+    // A negative index is a huge unsigned one, so the one unsigned compare covers both ends
+    EMIT(as, 0x41, 0x8B, 0x4C, 0x24, DISP(indexDisp + 8), 0x3B, 0x48, offsetof(ObjArray, count));
+    emitBail(as, 0x83, offset);
+    EMIT(as, 0x48, 0x8B, 0x40, offsetof(ObjArray, values));
+}
+
+/**
+    Emit the template for the instruction at *offset* and return the instruction's length. Only number operations and
+    jumps have templates. Anything touching strings, globals, output or other frames just exits to the interpreter
+ */
+static int emitInstruction(Assembler* as, Chunk* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+
+    switch (instruction) {
+        case OP_CONSTANT:
+            emitStoreValue(as, 0, chunk->constants.values[chunk->code[offset + 1]]);
+            emitPush(as);
+            return 2;
+        case OP_NIL:   emitStoreValue(as, 0, NIL_VAL); emitPush(as); return 1;
+        case OP_TRUE:  emitStoreValue(as, 0, BOOL_VAL(true)); emitPush(as); return 1;
+        case OP_FALSE: emitStoreValue(as, 0, BOOL_VAL(false)); emitPush(as); return 1;
+        case OP_POP:   emitPop(as); return 1;
+
+        case OP_GET_LOCAL: {
+            int disp = chunk->code[offset + 1] * (int)sizeof(Value);
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x6F, 0x85);  // movdqu xmm0, [r13 + disp]
+            emit32(as, (uint32_t)disp);
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x7F, 0x44, 0x24, 0x00);  // movdqu [r12], xmm0
+            emitPush(as);
+            return 2;
+        }
+        case OP_SET_LOCAL: {
+            int disp = chunk->code[offset + 1] * (int)sizeof(Value);
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x6F, 0x44, 0x24, DISP(TOP));  // movdqu xmm0, [r12 - 16]
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x7F, 0x85);  // movdqu [r13 + disp], xmm0
+            emit32(as, (uint32_t)disp);
+            return 2;
+        }
+
+        case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY:
+        case OP_ADD_NUMBER: case OP_SUBTRACT_NUMBER: case OP_MULTIPLY_NUMBER:
+        case OP_ADD_INT: case OP_SUBTRACT_INT: case OP_MULTIPLY_INT: {
+            uint8_t sseOp = arithmeticOp(instruction);
+            int slow[4];
+            int slowCount = 0;
+            int done;
+            slow[slowCount++] = emitIntCheck(as, TOP);
+            slow[slowCount++] = emitIntCheck(as, SECOND);
+            slowCount += emitIntArithmetic(as, sseOp, TOP, 0, SECOND, slow + slowCount, &done);
+
+            for (int i = 0; i < slowCount; i++) patchForward(as, slow[i]);
+            emitLoadOperands(as, offset);
+            emitArithmetic(as, sseOp, SECOND);
+            patchForward(as, done);
+            emitPop(as);
+            return 1;
+        }
+
+        case OP_DIVIDE: case OP_DIVIDE_NUMBER:  // Always a double
+            emitLoadOperands(as, offset);
+            emitArithmetic(as, arithmeticOp(instruction), SECOND);
+            emitPop(as);
+            return 1;
+
+        case OP_GREATER: case OP_LESS: case OP_GREATER_NUMBER: case OP_LESS_NUMBER: case OP_GREATER_INT:
+        case OP_LESS_INT: case OP_GREATER_EQUAL: case OP_LESS_EQUAL: case OP_EQUAL: case OP_NOT_EQUAL: {
+            Comparison comparison =
+                instruction == OP_GREATER || instruction == OP_GREATER_NUMBER || instruction == OP_GREATER_INT ?
+                    COMPARE_GREATER :
+                instruction == OP_LESS || instruction == OP_LESS_NUMBER || instruction == OP_LESS_INT ?
+                    COMPARE_LESS :
+                instruction == OP_GREATER_EQUAL ? COMPARE_GREATER_EQUAL :
+                instruction == OP_LESS_EQUAL ? COMPARE_LESS_EQUAL :
+                instruction == OP_EQUAL ? COMPARE_EQUAL : COMPARE_NOT_EQUAL;
+
+            // Int path: mov eax, [r12 - 24]; cmp eax, [r12 - 8]; setcc al
+            int topSlow = emitIntCheck(as, TOP);
+            int secondSlow = emitIntCheck(as, SECOND);
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(SECOND + 8), 0x41, 0x3B, 0x44, 0x24, DISP(TOP + 8));
+            EMIT(as, 0x0F, intSetcc(comparison), 0xC0);
+            emitStoreBool(as, SECOND);
+            int done = emitForward(as, 0);
+
+            // Double path. Equality of anything but two numbers is left to the interpreter through the guards
+            patchForward(as, topSlow);
+            patchForward(as, secondSlow);
+            emitLoadOperands(as, offset);
+            emitComparison(as, comparison, SECOND);
+            patchForward(as, done);
+            emitPop(as);
+            return 1;
+        }
+
+        case OP_ADD_CONSTANT: case OP_SUBTRACT_CONSTANT: case OP_MULTIPLY_CONSTANT:
+        case OP_GREATER_CONSTANT: case OP_LESS_CONSTANT: case OP_EQUAL_CONSTANT: {
+            Value constant = chunk->constants.values[chunk->code[offset + 1]];
+            if (!IS_NUMBER(constant)) break;  // Strings and other constants are left to the interpreter
+
+            Comparison comparison = instruction == OP_GREATER_CONSTANT ? COMPARE_GREATER :
+                                    instruction == OP_LESS_CONSTANT ? COMPARE_LESS : COMPARE_EQUAL;
+            bool arithmetic = instruction != OP_GREATER_CONSTANT && instruction != OP_LESS_CONSTANT &&
+                              instruction != OP_EQUAL_CONSTANT;
+
+            // An int constant gets an int path, against the constant as an immediate
+            int slow[3];
+            int slowCount = 0;
+            int done = -1;
+            if (IS_INT(constant)) {
+                slow[slowCount++] = emitIntCheck(as, TOP);
+                if (arithmetic) {
+                    slowCount += emitIntArithmetic(as, arithmeticOp(instruction), 0, AS_INT(constant), TOP,
+                                                   slow + slowCount, &done);
+                } else {
+                    EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(TOP + 8), 0x3D);  // mov eax, [r12 - 8]; cmp eax, imm32
+                    emit32(as, (uint32_t)AS_INT(constant));
+                    EMIT(as, 0x0F, intSetcc(comparison), 0xC0);
+                    emitStoreBool(as, TOP);
+                    done = emitForward(as, 0);
+                }
+            }
+
+            for (int i = 0; i < slowCount; i++) patchForward(as, slow[i]);
+            emitLoadConstantOperands(as, AS_NUMBER(constant), offset);
+            if (arithmetic) {
+                emitArithmetic(as, arithmeticOp(instruction), TOP);
+            } else {
+                emitComparison(as, comparison, TOP);
+            }
+            if (done != -1) patchForward(as, done);
+            return 2;
+        }
+
+        case OP_NEGATE: {
+            // Int path: mov eax, [r12 - 8]; neg eax; then bail on the smallest int (jo) and zero (jz), which become
+            // doubles
+            int doubleNegate = emitIntCheck(as, TOP);
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(TOP + 8), 0xF7, 0xD8);
+            emitBail(as, 0x80, offset);
+            emitBail(as, 0x84, offset);
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, DISP(TOP + 8));  // mov [r12 - 8], eax
+            int done = emitForward(as, 0);
+
+            patchForward(as, doubleNegate);
+            emitDoubleGuard(as, TOP, offset);
+            EMIT(as, 0x49, 0x0F, 0xBA, 0x7C, 0x24, DISP(TOP + 8), 63);  // btc qword [r12 - 8], 63
+            patchForward(as, done);
+            return 1;
+        }
+
+        case OP_JUMP:
+            emitByte(as, 0xE9);  // jmp target
+            emitJumpTarget(as, jumpTarget(chunk, offset));
+            return 3;
+
+        case OP_LOOP:
+            // Spend a unit of the VM's fuel and jump back: sub qword [rbx + fuel], 1; jnz target. The last unit is
+            // put back and left for the interpreter's OP_LOOP to spend, which stops the script there: inc qword
+            // [rbx + fuel], then exit at this instruction
+            EMIT(as, 0x48, 0x83, 0xAB);
+            emit32(as, (uint32_t)offsetof(VM, fuel));
+            EMIT(as, 0x01, 0x0F, 0x85);
+            emitJumpTarget(as, jumpTarget(chunk, offset));
+            EMIT(as, 0x48, 0xFF, 0x83);
+            emit32(as, (uint32_t)offsetof(VM, fuel));
+            emitExitAt(as, offset);
+            return 3;
+
+        case OP_JUMP_IF_FALSE: {
+            // Falsey is nil, or a bool whose payload is false. The tested value stays on the stack
+            int target = jumpTarget(chunk, offset);
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(TOP));  // mov eax, [r12 - 16]
+            EMIT(as, 0x83, 0xF8, VAL_NIL, 0x0F, 0x84);  // cmp eax, VAL_NIL; je target
+            emitJumpTarget(as, target);
+            EMIT(as, 0x83, 0xF8, VAL_BOOL, 0x75, 12);  // cmp eax, VAL_BOOL; jne over the next two instructions
+            EMIT(as, 0x41, 0x80, 0x7C, 0x24, DISP(TOP + 8), 0x00);  // cmp byte [r12 - 8], 0
+            EMIT(as, 0x0F, 0x84);  // je target
+            emitJumpTarget(as, target);
+            return 3;
+        }
+
+        case OP_JUMP_IF_NOT_EQUAL: case OP_JUMP_IF_EQUAL: case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL: case OP_JUMP_IF_NOT_LESS: case OP_JUMP_IF_NOT_LESS_EQUAL: {
+            Comparison comparison = branchComparison(instruction);
+            int target = jumpTarget(chunk, offset);
+
+            // Int path: mov eax, [r12 - 24]; mov ecx, [r12 - 8]; sub r12, 32; cmp eax, ecx; jcc target
+            int topSlow = emitIntCheck(as, TOP);
+            int secondSlow = emitIntCheck(as, SECOND);
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(SECOND + 8), 0x41, 0x8B, 0x4C, 0x24, DISP(TOP + 8));
+            EMIT(as, 0x49, 0x83, 0xEC, 0x20, 0x39, 0xC8, 0x0F, intJumpUnless(comparison));
+            emitJumpTarget(as, target);
+            int done = emitForward(as, 0);
+
+            // Double path. Equality of anything but two numbers is left to the interpreter through the guards
+            patchForward(as, topSlow);
+            patchForward(as, secondSlow);
+            emitLoadOperands(as, offset);
+            EMIT(as, 0x49, 0x83, 0xEC, 0x20);  // sub r12, 32
+            emitBranchUnless(as, comparison, target);
+            patchForward(as, done);
+            return 3;
+        }
+
+        case OP_JUMP_IF_NOT_EQUAL_CONSTANT: case OP_JUMP_IF_NOT_GREATER_CONSTANT: case OP_JUMP_IF_NOT_LESS_CONSTANT: {
+            Value constant = chunk->constants.values[chunk->code[offset + 1]];
+            if (!IS_NUMBER(constant)) break;
+
+            Comparison comparison = branchComparison(instruction);
+            int target = jumpTarget(chunk, offset);
+            int doubleBranch = -1;
+            int done = -1;
+            if (IS_INT(constant)) {
+                // Int path: mov eax, [r12 - 8]; sub r12, 16; cmp eax, imm32; jcc target
+                doubleBranch = emitIntCheck(as, TOP);
+                EMIT(as, 0x41, 0x8B, 0x44, 0x24, DISP(TOP + 8), 0x49, 0x83, 0xEC, 0x10, 0x3D);
+                emit32(as, (uint32_t)AS_INT(constant));
+                EMIT(as, 0x0F, intJumpUnless(comparison));
+                emitJumpTarget(as, target);
+                done = emitForward(as, 0);
+                patchForward(as, doubleBranch);
+            }
+
+            emitLoadConstantOperands(as, AS_NUMBER(constant), offset);
+            emitPop(as);
+            emitBranchUnless(as, comparison, target);
+            if (done != -1) patchForward(as, done);
+            return 4;
+        }
+
+        case OP_GET_INDEX:
+            // movsd xmm0, [rax + rcx * 8], then store it in place of the array as a double
+            emitElementAddress(as, SECOND, TOP, false, offset);
+            EMIT(as, 0xF2, 0x0F, 0x10, 0x04, 0xC8);
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x11, 0x44, 0x24, DISP(SECOND + 8));
+            EMIT(as, 0x41, 0xC7, 0x44, 0x24, DISP(SECOND));  // mov dword [r12 - 32], VAL_NUMBER
+            emit32(as, VAL_NUMBER);
+            emitPop(as);
+            return 1;
+
+        case OP_SET_INDEX:
+            // The value is loaded as a double before the array is looked at, so every guard comes before the store:
+            // movsd [rax + rcx * 8], xmm0. Then the value itself replaces the array as the result
+            emitLoadNumber(as, TOP, 0, offset);
+            emitElementAddress(as, THIRD, SECOND, true, offset);
+            EMIT(as, 0xF2, 0x0F, 0x11, 0x04, 0xC8);
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x6F, 0x4C, 0x24, DISP(TOP));  // movdqu xmm1, [r12 - 16]
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x7F, 0x4C, 0x24, DISP(THIRD));  // movdqu [r12 - 48], xmm1
+            EMIT(as, 0x49, 0x83, 0xEC, 0x20);  // sub r12, 32
+            return 1;
+
+        default:
+            break;
+    }
+
+    // No template. Hand this instruction to the interpreter, which re-enters compiled code after it
+    emitExitAt(as, offset);
+    return instructionSize(instruction);
+}
+
+/**
+    Compile *function* to machine code. On failure the function just keeps running in the interpreter. Either way the
+    function is marked so it is never attempted again
+ */
+bool jitCompile(ObjFunction* function) {
+    function->jitTried = true;
+    if (function->shared) return false;  // Run by several VMs at once. Keep it simple and leave it interpreted
+    if (function->registers != NULL) return false;  // Templates are only written for the stack bytecode
+
+    Chunk* chunk = &function->chunk;
+    Assembler as = {0};
+    uint32_t* entries = ALLOCATE(uint32_t, chunk->count);
+
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r13, rsi; mov r12, [rbx + stackTop]; jmp rdx
+    EMIT(&as, 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF5, 0x4C, 0x8B, 0xA3);
+    emit32(&as, (uint32_t)offsetof(VM, stackTop));
+    EMIT(&as, 0xFF, 0xE2);
+
+    // mov [rbx + stackTop], r12; pop r13; pop r12; pop rbx; ret
+    as.exit = as.count;
+    EMIT(&as, 0x4C, 0x89, 0xA3);
+    emit32(&as, (uint32_t)offsetof(VM, stackTop));
+    EMIT(&as, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+    for (int offset = 0; offset < chunk->count;) {
+        entries[offset] = (uint32_t)as.count;
+        offset += emitInstruction(&as, chunk, offset);
+    }
+
+    for (int i = 0; i < as.jumpCount; i++) {
+        JumpFixup* jump = &as.jumps[i];
+        patch32(&as, jump->patch, entries[jump->target] - (uint32_t)(jump->patch + 4));
+    }
+
+    // Guards are recorded in bytecode order, so all the guards of one instruction share a stub
+    int stub = -1;
+    for (int i = 0; i < as.fixupCount; i++) {
+        if (i == 0 || as.fixups[i].offset != as.fixups[i - 1].offset) {
+            stub = as.count;
+            emitExitAt(&as, as.fixups[i].offset);
+        }
+        patch32(&as, as.fixups[i].patch, (uint32_t)(stub - (as.fixups[i].patch + 4)));
+    }
+
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mappedSize = ((size_t)as.count + pageSize - 1) / pageSize * pageSize;
+    uint8_t* code = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool mapped = code != MAP_FAILED;
+
+    if (mapped) {
+        memcpy(code, as.code, as.count);
+        if (mprotect(code, mappedSize, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, mappedSize);
+            mapped = false;
+        }
+    }
+
+    FREE_ARRAY(uint8_t, as.code, as.capacity);
+    FREE_ARRAY(BailFixup, as.fixups, as.fixupCapacity);
+    FREE_ARRAY(JumpFixup, as.jumps, as.jumpCapacity);
+
+    if (!mapped) {
+        FREE_ARRAY(uint32_t, entries, chunk->count);
+        return false;
+    }
+
+    JitCode* jit = ALLOCATE(JitCode, 1);
+    jit->code = code;
+    jit->mappedSize = mappedSize;
+    jit->entries = entries;
+    jit->entryCount = chunk->count;
+    function->jit = jit;
+    return true;
+}
+
+/**
+    Run compiled code for *frame* starting at its current instruction, until the code reaches an instruction it has to
+    hand back. Returns the instruction pointer the interpreter should continue from
+ */
+uint8_t* jitRun(VM* vm, CallFrame* frame) {
+    JitCode* jit = frame->function->jit;
+    uint8_t* code = frame->function->chunk.code;
+
+    JitEntry entry = (JitEntry)(void*)jit->code;
+    uint32_t resume = entry(vm, frame->slots, jit->code + jit->entries[frame->ip - code]);
+    return code + resume;
+}
+
+void freeJitCode(JitCode* jit) {
+    munmap(jit->code, jit->mappedSize);
+    FREE_ARRAY(uint32_t, jit->entries, jit->entryCount);
+    FREE(JitCode, jit);
+}
+
+#else
+
+// No code generator for this architecture. Every function stays in the interpreter
+
+bool jitCompile(ObjFunction* function) {
+    function->jitTried = true;
+    return false;
+}
+
+uint8_t* jitRun(VM* vm, CallFrame* frame) {
+    (void)vm;
+    return frame->ip;
+}
+
+void freeJitCode(JitCode* jit) {
+    (void)jit;
+}
+
+#endif
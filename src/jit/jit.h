@@ -0,0 +1,29 @@
+/**
+    Baseline template JIT for x86-64. Every instruction of a function's chunk is translated into a fixed template of
+    machine code, with the VM's value stack still serving as the operand stack. Instructions without a template, and
+    instructions whose type guards fail at runtime, exit back to the interpreter, which runs that one instruction and
+    then re-enters the compiled code right after it.
+
+    Only x86-64 has a code generator. Everywhere else, or when built with -DCLOX_NO_JIT, jitCompile always fails and
+    functions stay interpreted
+ */
+
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "../common.h"
+#include "../object/object.h"
+#include "../vm/vm.h"
+
+struct sJitCode {
+    uint8_t* code;  // Executable mapping holding the machine code
+    size_t mappedSize;
+    uint32_t* entries;  // Offset into *code* for every bytecode offset that starts an instruction
+    int entryCount;
+};
+
+bool jitCompile(ObjFunction* function);
+uint8_t* jitRun(VM* vm, CallFrame* frame);
+void freeJitCode(JitCode* jit);
+
+#endif
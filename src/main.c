@@ -1,83 +1,432 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "./chunk/chunk.h"
+#include "./compiler/compiler.h"
 #include "./debug/debug.h"
+#include "./isolate/isolate.h"
+#include "./output/output.h"
+#include "./server/server.h"
+#include "./snapshot/snapshot.h"
 #include "./vm/vm.h"
 
-static void repl() {
-    char line[1024];  // Maximum line length for this basic repl
+/**
+    Parse *text* as a whole decimal count from 1 to *max*. Returns false for anything else, including a sign, trailing
+    characters or a value that doesn't fit
+ */
+static bool parseCount(const char* text, uint64_t max, uint64_t* count) {
+    if (*text < '0' || *text > '9') return false;  // strtoull() would accept leading spaces and a minus sign
+
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0' || value == 0 || value > max) return false;
+
+    *count = value;
+    return true;
+}
+
+/**
+    Append a line of stdin to *entry*, growing it as needed so no line is ever cut short. Returns false at the end of
+    input
+ */
+static bool readLine(char** entry, size_t* length, size_t* capacity) {
+    size_t start = *length;
     for (;;) {
-        printf("> ");
+        if (*capacity - *length < 2) {
+            *capacity = *capacity < 256 ? 256 : *capacity * 2;
+            *entry = realloc(*entry, *capacity);
+            if (*entry == NULL) {
+                fprintf(stderr, "Not enough memory for the REPL.\n");
+                exit(74);
+            }
+        }
+
+        size_t room = *capacity - *length;
+        if (!fgets(*entry + *length, room > INT32_MAX ? INT32_MAX : (int)room, stdin)) return *length > start;
+        *length += strlen(*entry + *length);
+        if ((*entry)[*length - 1] == '\n') return true;
+    }
+}
+
+static bool isBlank(const char* chars, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (chars[i] != ' ' && chars[i] != '\t' && chars[i] != '\r' && chars[i] != '\n') return false;
+    }
+    return true;
+}
 
-        if (!fgets(line, sizeof(line), stdin)) {
-            printf("\n");
+/**
+    How far into brackets and strings an entry is, carried from line to line. The REPL only tries to compile an entry
+    that's closed them all, since compiling a long pasted function again after every line of it would make pasting
+    take time quadratic in its length
+ */
+typedef struct {
+    int depth;
+    bool inString;
+} EntryState;
+
+static void scanLine(EntryState* state, const char* chars, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = chars[i];
+        if (state->inString) {
+            if (c == '"') state->inString = false;
+        } else if (c == '"') {
+            state->inString = true;
+        } else if (c == '/' && i + 1 < length && chars[i + 1] == '/') {
+            break;  // Comment to the end of the line
+        } else if (c == '(' || c == '{' || c == '[') {
+            state->depth++;
+        } else if (c == ')' || c == '}' || c == ']') {
+            state->depth--;
+        }
+    }
+}
+
+/**
+    Read and run one entry at a time. An entry that stops part way through, like a function whose closing brace
+    hasn't been typed yet, carries on over as many lines as it takes, with a "..." prompt. A blank line there runs it
+    as it is, which reports what's missing
+ */
+static void repl(VM* vm) {
+    ReplSession* session = newReplSession(vm);
+    char* entry = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    EntryState state = {0, false};
+
+    for (;;) {
+        if (length == 0) {
+            writeOutput("> ", 2);
+        } else {
+            writeOutput("... ", 4);
+        }
+        flushOutput();
+
+        size_t lineStart = length;
+        if (!readLine(&entry, &length, &capacity)) {
+            if (length > 0) interpretEntry(vm, session, entry, length, NULL);
+            endOutputLine();
             break;
         }
 
-        interpret(line);
+        bool blank = isBlank(entry + lineStart, length - lineStart);
+        if (blank && lineStart == 0) {
+            length = 0;
+            continue;
+        }
+
+        scanLine(&state, entry + lineStart, length - lineStart);
+        if (!blank && (state.depth > 0 || state.inString)) continue;
+
+        bool incomplete = false;
+        interpretEntry(vm, session, entry, length, blank ? NULL : &incomplete);
+        if (!incomplete) {
+            length = 0;
+            state = (EntryState){0, false};
+        }
     }
+
+    free(entry);
+    freeReplSession(session);
 }
 
 /**
-    Read a file and put it into memory. Needs to first determine the size of the file by
-    going to the end, and then finally reads the contents and puts into buffer
+    Map a file into memory read-only. Nothing is copied up front: pages are read in as the scanner reaches them, and
+    stay shared with the page cache. *length* is set to the file's size. The mapping has no terminating NUL, which
+    the scanner doesn't need
  */
-static char* readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-
-    if (file == NULL) {
+static const char* mapFile(const char* path, size_t* length) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    *length = (size_t)info.st_size;
+    if (*length == 0) {  // mmap can't map an empty range
+        close(file);
+        return "";
+    }
 
-    char* buffer = malloc(fileSize + 1);  // Buffer is the whole dang source code!
+    void* source = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);  // The mapping keeps the file alive on its own
 
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    if (source == MAP_FAILED) {
+        fprintf(stderr, "Could not map file \"%s\".\n", path);
         exit(74);
     }
 
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    return source;
+}
 
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);  // If the read fails somehow
-        exit(74);
+static void unmapFile(const char* source, size_t length) {
+    if (length > 0) munmap((void*)source, length);
+}
+
+/**
+    Build the shared segment for a prelude, which is either a script to run or a snapshot of one to map in. Exits if
+    the script fails or the snapshot can't be loaded
+ */
+static SharedSegment* loadPrelude(const char* path) {
+    size_t length;
+    const char* prelude = mapFile(path, &length);
+
+    SharedSegment* shared;
+    if (isSnapshot(prelude, length)) {
+        unmapFile(prelude, length);
+        shared = loadSnapshot(path);
+        if (shared == NULL) exit(74);
+    } else {
+        shared = buildSharedSegment(prelude, length);
+        unmapFile(prelude, length);
+        if (shared == NULL) exit(65);
     }
+    return shared;
+}
+
+static void runFile(VM* vm, const char* path, bool stream) {
+    size_t length;
+    const char* source = mapFile(path, &length);
 
-    buffer[bytesRead] = '\0';
+    InterpretResult result;
+    if (stream) {
+        if (length > 0) madvise((void*)source, length, MADV_SEQUENTIAL);
+        result = interpretStream(vm, source, length, length > 0);
+    } else {
+        result = interpret(vm, source, length);
+    }
+    unmapFile(source, length);
 
-    fclose(file);
-    return buffer;
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_BUDGET_EXHAUSTED) {
+        flushOutput();
+        fprintf(stderr, "Script ran out of budget.\n");
+        exit(75);
+    }
 }
 
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+/**
+    Run each script in its own isolated VM on a pool of *threadCount* threads, then report throughput to stderr. If
+    *budget* isn't 0, the scripts all run on this thread instead, taking turns *budget* back-edges plus calls at a
+    time. Exits with the status of the first script that failed, if any did. If *preludePath* isn't NULL, the prelude
+    is run once up front and every isolate shares its strings and globals
+ */
+static void runIsolateFiles(int threadCount, uint64_t budget, const char* preludePath, int pathCount,
+                            const char* paths[]) {
+    SharedSegment* shared = preludePath != NULL ? loadPrelude(preludePath) : NULL;
+
+    IsolateJob* jobs = malloc(sizeof(IsolateJob) * pathCount);
+    if (jobs == NULL) {
+        fprintf(stderr, "Not enough memory to run isolates.\n");
+        exit(74);
+    }
+
+    for (int i = 0; i < pathCount; i++) {
+        jobs[i].source = mapFile(paths[i], &jobs[i].length);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (budget != 0) {
+        runScheduled(jobs, pathCount, budget, shared);
+    } else {
+        threadCount = runIsolates(jobs, pathCount, threadCount, shared);  // Clamped to what was actually used
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (budget != 0) {
+        fprintf(stderr, "%d scripts in slices of %llu on one thread in %.3fs (%.1f scripts/s)\n",
+                pathCount, (unsigned long long)budget, seconds, pathCount / seconds);
+    } else {
+        fprintf(stderr, "%d scripts on %d threads in %.3fs (%.1f scripts/s)\n",
+                pathCount, threadCount, seconds, pathCount / seconds);
+    }
+
+    InterpretResult result = INTERPRET_OK;
+    for (int i = 0; i < pathCount; i++) {
+        if (result == INTERPRET_OK) result = jobs[i].result;
+        unmapFile(jobs[i].source, jobs[i].length);
+    }
+    free(jobs);
+    if (shared != NULL) freeSharedSegment(shared);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+/**
+    Serve requests on *socketPath* until stopped. The options are a thread count, one per CPU by default, a prelude
+    run once that every request's VM starts from, and a budget of back-edges plus calls for each request
+ */
+static void serve(const char* socketPath, int argc, const char* argv[]) {
+    int threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* preludePath = NULL;
+    uint64_t budget = 0;
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--threads") == 0) {
+            threadCount = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--prelude") == 0) {
+            preludePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--budget") == 0 && !parseCount(argv[i + 1], UINT64_MAX, &budget)) {
+            fprintf(stderr, "Budget \"%s\" isn't a count of at least 1.\n", argv[i + 1]);
+            exit(64);
+        }
+    }
+    if (threadCount < 1) threadCount = 1;
+
+    SharedSegment* shared = preludePath != NULL ? loadPrelude(preludePath) : NULL;
+    runServer(socketPath, threadCount, shared, budget);
+}
+
+/**
+    Run a script on the server at *socketPath* and exit with its status, as if it had run here. The script's source
+    is sent, unless *sendPath* is set, and then only its absolute path, for the server to read
+ */
+static void runOnServer(const char* socketPath, const char* path, bool sendPath) {
+    int status;
+    if (sendPath) {
+        char* absolute = realpath(path, NULL);
+        if (absolute == NULL) {
+            fprintf(stderr, "Could not open file \"%s\".\n", path);
+            exit(74);
+        }
+        status = requestRun(socketPath, SERVE_PATH, absolute, strlen(absolute), STDOUT_FILENO, STDERR_FILENO);
+        free(absolute);
+    } else {
+        size_t length;
+        const char* source = mapFile(path, &length);
+        status = requestRun(socketPath, SERVE_SOURCE, source, length, STDOUT_FILENO, STDERR_FILENO);
+        unmapFile(source, length);
+    }
+
+    if (status < 0) {
+        fprintf(stderr, "Could not run \"%s\" on the server at \"%s\".\n", path, socketPath);
+        exit(74);
+    }
+    exit(status);
+}
+
+/**
+    Run the prelude at *preludePath* and write what it leaves behind to a snapshot at *imagePath*, which --prelude
+    then takes in its place
+ */
+static void snapshot(const char* preludePath, const char* imagePath) {
+    SharedSegment* shared = loadPrelude(preludePath);
+    bool written = writeSnapshot(shared, imagePath);
+    freeSharedSegment(shared);
+    exit(written ? 0 : 74);
+}
+
 int main(int argc, const char* argv[]) {
-    initVM();
+    atexit(flushOutput);  // Errors exit() straight from here, with the script's output still buffered
+
+    bool schedule = argc >= 4 && strcmp(argv[1], "--schedule") == 0;
+    if (argc >= 4 && (schedule || strcmp(argv[1], "--isolates") == 0)) {
+        int threadCount = schedule ? 1 : atoi(argv[2]);
+        uint64_t budget = schedule ? strtoull(argv[2], NULL, 10) : 0;
+        if (schedule && budget == 0) budget = 1;  // Every script needs to get somewhere each turn
+
+        if (argc >= 6 && strcmp(argv[3], "--prelude") == 0) {
+            runIsolateFiles(threadCount, budget, argv[4], argc - 5, &argv[5]);
+        } else {
+            runIsolateFiles(threadCount, budget, NULL, argc - 3, &argv[3]);
+        }
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        serve(argv[2], argc - 3, &argv[3]);
+        return 0;
+    }
+    if (argc >= 4 && strcmp(argv[1], "--snapshot") == 0) snapshot(argv[2], argv[3]);
+    if (argc >= 4 && strcmp(argv[1], "--client") == 0) {
+        bool sendPath = argc >= 5 && strcmp(argv[3], "--path") == 0;
+        runOnServer(argv[2], argv[sendPath ? 4 : 3], sendPath);
+    }
+
+    // Options are collected first, since the VM can only be attached to a prelude's segment as it's initialized
+    bool jit = false;
+    bool stream = false;
+    bool lazy = false;
+    bool profile = false;
+    uint32_t hotThreshold = HOT_THRESHOLD;
+    uint64_t budget = 0;
+    uint64_t count;
+    IoBackend ioBackend = IO_URING;
+    SharedSegment* shared = NULL;
+    while (argc >= 2 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[1], "--stream") == 0) {
+            stream = true;  // Compile and run one top level declaration at a time
+        } else if (strcmp(argv[1], "--lazy") == 0) {
+            lazy = true;  // Compile each function's body on its first call, instead of all of them up front
+        } else if (strcmp(argv[1], "--profile") == 0) {
+            profile = true;  // Report the hottest functions to stderr at exit
+        } else if (strcmp(argv[1], "--hot") == 0 && argc >= 3 && parseCount(argv[2], UINT32_MAX, &count)) {
+            hotThreshold = (uint32_t)count;  // At least 1, since tier-up happens on reaching it
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--budget") == 0 && argc >= 3) {
+            budget = strtoull(argv[2], NULL, 10);  // Stop the script after this many back-edges plus calls
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--io") == 0 && argc >= 3 && parseIoBackend(argv[2], &ioBackend)) {
+            argc--;  // How readFile() and writeFile() do their I/O: uring (the default), threads or sync
+            argv++;
+        } else if (strcmp(argv[1], "--prelude") == 0 && argc >= 3 && shared == NULL) {
+            shared = loadPrelude(argv[2]);  // A script or a snapshot, whose globals the script starts with
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
+
+    VM vm;
+    initSharedVM(&vm, shared);
+    vm.jitEnabled = jit;
+    vm.lazyFunctions = lazy;
+    vm.hotThreshold = hotThreshold;
+    vm.budget = budget;
+    vm.ioBackend = ioBackend;
 
     if (argc == 1) {
-        repl();
+        repl(&vm);
     } else if (argc == 2) {
-        runFile(argv[1]);
+        runFile(&vm, argv[1], stream);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [--jit] [--stream] [--lazy] [--profile] [--hot <count>] [--budget <count>]\n"
+                        "            [--io uring|threads|sync] [--prelude <path>] [path]\n"
+                        "       clox --snapshot <prelude> <image>\n"
+                        "       clox --isolates <threads> [--prelude <path>] <path>...\n"
+                        "       clox --schedule <budget> [--prelude <path>] <path>...\n"
+                        "       clox --serve <socket> [--threads <count>] [--prelude <path>] [--budget <count>]\n"
+                        "       clox --client <socket> [--path] <path>\n");
         exit(64);
     }
 
-    freeVM();
+    if (profile) printProfile(&vm);
+    freeVM(&vm);
+    if (shared != NULL) freeSharedSegment(shared);
     return 0;
 }
\ No newline at end of file
@@ -1,9 +1,21 @@
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "../common.h"
 #include "memory.h"
+#include "../jit/jit.h"
+#include "../registers/registers.h"
 #include "../vm/vm.h"
 
+#ifdef DEBUG_ALLOCATION_STATS
+#include <sys/resource.h>
+
+// Per thread, so isolates running on other threads don't race on them or show up in each other's numbers
+static _Thread_local uint64_t allocationCount;
+static _Thread_local uint64_t reallocationCount;
+static _Thread_local uint64_t bytesAllocated;
+#endif
+
 /**
     Handle all cases of memory management in clox. Allocates new blocks, frees up existing blocks, and resizes existing
     blocks
@@ -14,11 +26,62 @@ void* reallocate(void* previous, size_t oldSize, size_t newSize) {
         return NULL;
     }
 
+    #ifdef DEBUG_ALLOCATION_STATS
+        if (previous == NULL) {
+            allocationCount++;
+        } else {
+            reallocationCount++;
+        }
+        if (newSize > oldSize) bytesAllocated += newSize - oldSize;
+    #endif
+
     return realloc(previous, newSize);  // equivalent to malloc if oldSize == 0
 }
 
 static void freeObject(Obj* object) {
     switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            FREE_ARRAY(double, array->values, array->count);
+            FREE(ObjArray, object);
+            break;
+        }
+        case OBJ_CLASS:
+            FREE(ObjClass, object);
+            break;
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+            FREE_ARRAY(CallFrame, fiber->frames, fiber->frameCapacity);
+            FREE(ObjFiber, object);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            #ifdef CLOX_FIELD_TABLES
+                freeTable(&instance->fields);
+            #else
+                FREE_ARRAY(Value, instance->fields, instance->capacity);
+            #endif
+            FREE(ObjInstance, object);
+            break;
+        }
+        case OBJ_SHAPE:
+            freeTable(&((ObjShape*)object)->transitions);
+            FREE(ObjShape, object);
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            freeChunk(&function->chunk);
+            if (function->jit != NULL) freeJitCode(function->jit);
+            if (function->registers != NULL) freeRegisterCode(function->registers);
+            if (function->lazy != NULL) freeLazyBody(function->lazy);
+            FREE(ObjFunction, object);
+            break;
+        }
+        case OBJ_NATIVE:
+            FREE(ObjNative, object);
+            break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
             FREE_ARRAY(char, string->chars, string->length + 1);
@@ -29,13 +92,36 @@ static void freeObject(Obj* object) {
 }
 
 /**
-    Free all heap allocated objects created by the compiler & vm
+    Free every object in a linked list of heap objects
  */
-void freeObjects() {
-    Obj* object = vm.objects;
+void freeObjectList(Obj* objects) {
+    Obj* object = objects;
     while (object != NULL) {
         Obj* next = object->next;
         freeObject(object);
         object = next;
     }
-}
\ No newline at end of file
+}
+
+/**
+    Free all heap allocated objects created by the compiler & vm
+ */
+void freeObjects(VM* vm) {
+    freeObjectList(vm->objects);
+    vm->objects = NULL;
+}
+
+#ifdef DEBUG_ALLOCATION_STATS
+/**
+    Print how many times this thread allocated or resized a block through reallocate(), the total bytes those calls
+    asked for, and the peak resident set size of the whole process
+ */
+void printAllocationStats(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "allocations %llu, reallocations %llu, bytes %llu, peak RSS %ld KB\n",
+            (unsigned long long)allocationCount, (unsigned long long)reallocationCount,
+            (unsigned long long)bytesAllocated, usage.ru_maxrss);
+}
+#endif
@@ -25,6 +25,11 @@
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
 void* reallocate(void* previous, size_t oldSize, size_t newSize);
-void freeObjects();
+void freeObjectList(Obj* objects);
+void freeObjects(VM* vm);
+
+#ifdef DEBUG_ALLOCATION_STATS
+void printAllocationStats(void);
+#endif
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "../memory/memory.h"
 #include "object.h"
+#include "../output/output.h"
 #include "../table/table.h"
 #include "../value/value.h"
 #include "../vm/vm.h"
@@ -12,31 +13,196 @@
     objectType refers to the value of the ObjType type field that exists on the base Obj struct. Macro exists to avoid
     having to manullaly cast void* into desired pointer type every time
  */
-#define ALLOCATE_OBJ(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(vm, type, objectType) \
+    (type*)allocateObject(vm, sizeof(type), objectType)
 
 /**
     Allocate space for a new lox Object and set its type equal to *type*
  */
-static Obj* allocateObject(size_t size, ObjType type) {
+static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
     Obj* object = (Obj*)reallocate(NULL, 0, size);
     object->type = type;
 
-    object->next = vm.objects;  // Add to the heap objects linked list
-    vm.objects = object;
+    object->next = vm->objects;  // Add to the heap objects linked list
+    vm->objects = object;
     return object;
 }
 
+ObjClass* newClass(VM* vm, ObjString* name) {
+    ObjClass* klass = ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
+    klass->name = name;
+    klass->shape = NULL;  // Nulled out first in case allocating the shape ever triggers a GC
+    klass->shape = newShape(vm, NULL, NULL);
+    return klass;
+}
+
+/**
+    New fiber that will run *function*. Its stacks aren't allocated until it first runs
+ */
+ObjFiber* newFiber(VM* vm, ObjFunction* function) {
+    ObjFiber* fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->scheduled = false;
+    fiber->shared = false;
+    fiber->function = function;
+    fiber->caller = NULL;
+    fiber->nextReady = NULL;
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    return fiber;
+}
+
+ObjInstance* newInstance(VM* vm, ObjClass* klass) {
+    ObjInstance* instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    instance->klass = klass;
+    instance->shared = false;
+    #ifdef CLOX_FIELD_TABLES
+        initTable(&instance->fields);
+    #else
+        instance->shape = klass->shape;
+        instance->fields = NULL;
+        instance->capacity = 0;
+    #endif
+    return instance;
+}
+
+ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name) {
+    ObjShape* shape = ALLOCATE_OBJ(vm, ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->slotCount = parent != NULL ? parent->slotCount + 1 : 0;
+    shape->shared = false;
+    initTable(&shape->transitions);
+    return shape;
+}
+
+/**
+    Slot that holds the field *name* in instances of *shape*, or -1 if they don't have it. Walks up from the newest
+    field, which is slow for instances with many fields, but inline caches mean it only happens on a miss
+ */
+int findSlot(ObjShape* shape, ObjString* name) {
+    for (; shape->parent != NULL; shape = shape->parent) {
+        if (shape->name == name) return shape->slotCount - 1;
+    }
+
+    return -1;
+}
+
+static ShapeOverlay* findOverlay(ShapeOverlay* overlays, int capacity, ObjShape* shape) {
+    uint32_t index = (uint32_t)(((uintptr_t)shape >> 4) * 2654435761u) & (capacity - 1);
+    while (overlays[index].shape != NULL && overlays[index].shape != shape) index = (index + 1) & (capacity - 1);
+    return &overlays[index];
+}
+
+/**
+    This VM's transitions from the shared shape *shape*. Every VM attached to a segment adds its own fields to the
+    segment's shapes, so each keeps the children it makes in a table of its own, and instances of a prelude class in
+    one VM share shapes just like instances of a class of its own do
+ */
+static Table* overlayTransitions(VM* vm, ObjShape* shape) {
+    if (vm->shapeOverlayCount + 1 > vm->shapeOverlayCapacity * 3 / 4) {
+        int capacity = GROW_CAPACITY(vm->shapeOverlayCapacity);
+        ShapeOverlay* overlays = ALLOCATE(ShapeOverlay, capacity);
+        for (int i = 0; i < capacity; i++) overlays[i].shape = NULL;
+
+        for (int i = 0; i < vm->shapeOverlayCapacity; i++) {
+            ShapeOverlay* entry = &vm->shapeOverlays[i];
+            if (entry->shape != NULL) *findOverlay(overlays, capacity, entry->shape) = *entry;
+        }
+
+        FREE_ARRAY(ShapeOverlay, vm->shapeOverlays, vm->shapeOverlayCapacity);
+        vm->shapeOverlays = overlays;
+        vm->shapeOverlayCapacity = capacity;
+    }
+
+    ShapeOverlay* overlay = findOverlay(vm->shapeOverlays, vm->shapeOverlayCapacity, shape);
+    if (overlay->shape == NULL) {
+        overlay->shape = shape;
+        initTable(&overlay->transitions);
+        vm->shapeOverlayCount++;
+    }
+    return &overlay->transitions;
+}
+
+/**
+    Shape of an instance of *shape* once the field *name* is added to it. Instances that add the same field to the same
+    shape end up sharing the new shape. A shared shape can't be written, so the transitions this VM adds to one are
+    kept in the VM instead, see overlayTransitions()
+ */
+ObjShape* addField(VM* vm, ObjShape* shape, ObjString* name) {
+    Value existing;
+    if (tableGet(&shape->transitions, name, &existing)) return (ObjShape*)AS_OBJ(existing);
+
+    Table* transitions = shape->shared ? overlayTransitions(vm, shape) : &shape->transitions;
+    if (shape->shared && tableGet(transitions, name, &existing)) return (ObjShape*)AS_OBJ(existing);
+
+    ObjShape* child = newShape(vm, shape, name);
+    tableSet(transitions, name, OBJ_VAL(child));
+    return child;
+}
+
+ObjFunction* newFunction(VM* vm) {
+    ObjFunction* function = ALLOCATE_OBJ(vm, ObjFunction, OBJ_FUNCTION);
+
+    function->arity = 0;
+    function->maxSlots = 0;
+    function->shared = false;
+    function->jitTried = false;
+    function->calls = 0;
+    function->backEdges = 0;
+    function->jit = NULL;
+    function->registers = NULL;
+    function->lazy = NULL;
+    function->name = NULL;
+    initChunk(&function->chunk);
+    return function;
+}
+
+// Copy *length* characters of a function's source, starting at its parameter list on *line*
+LazyBody* newLazyBody(const char* source, int length, int line) {
+    LazyBody* body = reallocate(NULL, 0, sizeof(LazyBody) + length);
+    body->length = length;
+    body->line = line;
+    memcpy(body->source, source, length);
+    return body;
+}
+
+void freeLazyBody(LazyBody* body) {
+    reallocate(body, sizeof(LazyBody) + body->length, 0);
+}
+
+/**
+    Allocate an array of *count* elements. The elements are left uninitialized for the caller to fill, since most
+    arrays are the output of a bulk native that's about to write every one of them
+ */
+ObjArray* newArray(VM* vm, int count) {
+    ObjArray* array = ALLOCATE_OBJ(vm, ObjArray, OBJ_ARRAY);
+    array->shared = false;
+    array->count = count;
+    array->values = ALLOCATE(double, count);
+    return array;
+}
+
+ObjNative* newNative(VM* vm, NativeFn function) {
+    ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
+    native->function = function;
+    return native;
+}
+
 /**
     Allocate space for a new lox String Object and set its fields appropriately. Intern the object's string
  */
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash) {
+    ObjString* string = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
 
-    tableSet(&vm.strings, string, NIL_VAL);  // Set the char array in the set of interned strings
+    tableSet(&vm->strings, string, NIL_VAL);  // Set the char array in the set of interned strings
 
     return string;
 }
@@ -44,7 +210,7 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash) {
 /**
     Implementation of an FNV-1a hash on a string
  */
-static uint32_t hashString(const char* key, int length) {
+uint32_t hashString(const char* key, int length) {
     uint32_t hash = 2166136261u;
 
     for (int i = 0; i < length; i++) {
@@ -55,12 +221,25 @@ static uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
+/**
+    Look up an interned string. The VM's shared segment is checked first, and only strings that aren't in it can be in
+    the VM's own table
+ */
+static ObjString* findInterned(VM* vm, const char* chars, int length, uint32_t hash) {
+    if (vm->shared != NULL) {
+        ObjString* shared = tableFindString(&vm->shared->strings, chars, length, hash);
+        if (shared) return shared;
+    }
+
+    return tableFindString(&vm->strings, chars, length, hash);
+}
+
 /**
     Create a new object using an existing string in memory. Used to transfer ownership of strings between StrObjs
  */
-ObjString* takeString(char* chars, int length) {
+ObjString* takeString(VM* vm, char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
 
     if (interned) {
         // Free the string that was passed in and return the interned string
@@ -68,7 +247,7 @@ ObjString* takeString(char* chars, int length) {
         return interned;
     }
 
-    return allocateString(chars, length, hash);
+    return allocateString(vm, chars, length, hash);
 }
 
 /**
@@ -76,22 +255,61 @@ ObjString* takeString(char* chars, int length) {
     because not all strings will be expressly written literals in the code (e.g. some may be created by string
     concatenation), so for every string value in lox, we allocate a new array of chars on the lox heap
  */
-ObjString* copyString(const char* chars, int length) {
+ObjString* copyString(VM* vm, const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
     if (interned) return interned;
 
     char* heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
 
-    return allocateString(heapChars, length, hash);
+    return allocateString(vm, heapChars, length, hash);
+}
+
+static void printArray(ObjArray* array) {
+    writeOutput("[", 1);
+    for (int i = 0; i < array->count; i++) {
+        if (i > 0) writeOutput(", ", 2);
+        writeNumber(array->values[i]);
+    }
+    writeOutput("]", 1);
+}
+
+static void printFunction(ObjFunction* function) {
+    if (function->name == NULL) {
+        writeOutput("<script>", 8);
+        return;
+    }
+
+    printOutput("<fn %s>", function->name->chars);
 }
 
 void printObject(Value value) {
     switch (OBJ_TYPE(value)) {
+        case OBJ_ARRAY:
+            printArray(AS_ARRAY(value));
+            break;
+        case OBJ_CLASS:
+            writeOutput(AS_CLASS(value)->name->chars, AS_CLASS(value)->name->length);
+            break;
+        case OBJ_FIBER:
+            writeOutput("<fiber>", 7);
+            break;
+        case OBJ_INSTANCE:
+            printOutput("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        case OBJ_SHAPE:
+            writeOutput("<shape>", 7);  // Never a value in Lox code
+            break;
+        case OBJ_FUNCTION:
+            printFunction(AS_FUNCTION(value));
+            break;
+        case OBJ_NATIVE:
+            writeOutput("<native fn>", 11);
+            break;
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            writeOutput(AS_CSTRING(value), AS_STRING(value)->length);
             break;
     }
 }
\ No newline at end of file
@@ -2,16 +2,49 @@
 #define clox_object_h
 
 #include "../common.h"
+#include "../chunk/chunk.h"
+#include "../table/table.h"
 #include "../value/value.h"
 
+// Forward declaration of the VM struct. Every object belongs to the heap of exactly one VM
+typedef struct sVM VM;
+
+// Machine code generated for a function by the JIT. Only defined when the JIT is built in
+typedef struct sJitCode JitCode;
+
+// Register based translation of a function's bytecode. Only produced when built with -DCLOX_REGISTER_VM
+typedef struct sRegisterCode RegisterCode;
+
+// A single ongoing function call, defined with the VM
+typedef struct sCallFrame CallFrame;
+
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 
+#define IS_ARRAY(value)     isObjType(value, OBJ_ARRAY)
+#define IS_CLASS(value)     isObjType(value, OBJ_CLASS)
+#define IS_FIBER(value)     isObjType(value, OBJ_FIBER)
+#define IS_FUNCTION(value)  isObjType(value, OBJ_FUNCTION)
+#define IS_INSTANCE(value)  isObjType(value, OBJ_INSTANCE)
+#define IS_NATIVE(value)    isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)    isObjType(value, OBJ_STRING)
 
+#define AS_ARRAY(value)     ((ObjArray*)AS_OBJ(value))
+#define AS_CLASS(value)     ((ObjClass*)AS_OBJ(value))
+#define AS_FIBER(value)     ((ObjFiber*)AS_OBJ(value))
+#define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
+#define AS_INSTANCE(value)  ((ObjInstance*)AS_OBJ(value))
+#define AS_NATIVE(value)    (((ObjNative*)AS_OBJ(value))->function)
 #define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
 
 typedef enum {
+    OBJ_ARRAY,
+    OBJ_CLASS,
+    OBJ_FIBER,
+    OBJ_FUNCTION,
+    OBJ_INSTANCE,
+    OBJ_NATIVE,
+    OBJ_SHAPE,
     OBJ_STRING
 } ObjType;
 
@@ -29,8 +62,141 @@ struct sObjString {
     uint32_t hash;  // The hash code of the string
 };
 
-ObjString* takeString(char* chars, int length);
-ObjString* copyString(const char* chars, int length);
+/**
+    The body of a function that was only pre-parsed, to be compiled on its first call. It's the function's source from
+    its parameter list to its closing brace, copied out of the script, since by the time most functions are called the
+    script's source is gone
+ */
+typedef struct {
+    int length;
+    int line;  // Line the parameter list starts on, so errors in the body are reported with the script's lines
+    char source[];
+} LazyBody;
+
+/**
+    A compiled Lox function. Each function owns its own chunk of bytecode. The top level script is compiled into an
+    implicit function with a NULL name. A function that's only been pre-parsed has its arity and name, but an empty
+    chunk until *lazy* is compiled
+ */
+typedef struct {
+    Obj obj;
+    int arity;  // Number of parameters the function expects
+    int maxSlots;  // Most stack slots the function ever uses at once, counting the callee and arguments
+    bool shared;  // Owned by a SharedSegment and possibly running on several threads, so its code must not be rewritten
+    bool jitTried;  // Set once the JIT has attempted this function, so a failed compile is not retried on every call
+    uint32_t calls;  // Hotness counters, see tierUp(). Never counted for shared functions
+    uint32_t backEdges;  // Loop iterations the interpreter has run. Loops in compiled code aren't counted
+    JitCode* jit;  // NULL until the function is JIT compiled
+    RegisterCode* registers;  // NULL if the function runs its stack bytecode
+    LazyBody* lazy;  // Body still to be compiled, see compileLazy(). NULL once it has been, or if it never was lazy
+    Chunk chunk;
+    ObjString* name;
+} ObjFunction;
+
+/**
+    Native functions receive their arguments as a pointer directly into the VM's value stack, so calling one never
+    allocates or copies. *args* is only valid for the duration of the call. A native sets *result* and returns true,
+    or reports a runtime error and returns false
+ */
+typedef bool (*NativeFn)(VM* vm, int argCount, Value* args, Value* result);
+
+typedef struct {
+    Obj obj;
+    NativeFn function;
+} ObjNative;
+
+/**
+    Hidden class. Instances that had the same fields added in the same order share a shape, and a shape is all it
+    takes to know which slot of an instance holds a field. Each shape is its parent plus one field, so the shapes of a
+    class form a tree rooted at the class's empty shape, and adding a field to an instance moves it one edge down
+ */
+struct sObjShape {
+    Obj obj;
+    struct sObjShape* parent;  // NULL for a class's root shape
+    ObjString* name;  // Field this shape adds to its parent. It's stored in slot slotCount - 1
+    int slotCount;  // Fields an instance of this shape has
+    bool shared;  // Owned by a SharedSegment, so its transitions are read only. VMs keep their own, see addField()
+    Table transitions;  // Field name -> the child shape that adds it
+};
+
+typedef struct {
+    Obj obj;
+    ObjString* name;
+    ObjShape* shape;  // Root shape, the shape of every new instance
+} ObjClass;
+
+/**
+    Instance of a class. Fields live in a flat array of slots, laid out by the instance's shape. Built with
+    -DCLOX_FIELD_TABLES, every instance keeps its fields in its own hash table instead, for comparison
+ */
+typedef struct {
+    Obj obj;
+    ObjClass* klass;
+    bool shared;  // Owned by a SharedSegment, so its fields are read only
+#ifdef CLOX_FIELD_TABLES
+    Table fields;
+#else
+    ObjShape* shape;
+    Value* fields;
+    int capacity;  // Slots allocated. Grows as fields are added, and may be more than the shape uses
+#endif
+} ObjInstance;
+
+/**
+    Dense array of numbers. Elements are stored as raw doubles, half the size of Values, so bulk natives can run SIMD
+    kernels straight over them (see array.h)
+ */
+typedef struct {
+    Obj obj;
+    bool shared;  // Owned by a SharedSegment, so its elements are read only
+    int count;
+    double* values;
+} ObjArray;
+
+typedef enum {
+    FIBER_NEW,        // Its function hasn't started yet
+    FIBER_SUSPENDED,  // Stopped in a call to yield()
+    FIBER_WAITING,    // Stopped in a call to readFile() or writeFile() until the I/O finishes
+    FIBER_RUNNING,    // Running, or waiting on a fiber it resumed
+    FIBER_DONE        // Its function has returned
+} FiberState;
+
+/**
+    A coroutine with its own value stack and CallFrame stack (see fiber.h). Both start out just big enough for the
+    fiber's function and grow by moving, so a fiber that never calls deeply stays small. While a fiber runs, the VM
+    holds its stack top and frame count, and they're only written back here when it switches away
+ */
+typedef struct sObjFiber {
+    Obj obj;
+    FiberState state;
+    bool scheduled;  // Spawned, so only the scheduler runs it, and yield() hands over to the next ready fiber
+    bool shared;  // Owned by a SharedSegment, so it can't be run
+    ObjFunction* function;
+    struct sObjFiber* caller;  // The fiber that resumed this one, which yield() goes back to. NULL if there's none
+    struct sObjFiber* nextReady;  // Next fiber in the VM's ready queue
+
+    Value* stack;  // Base of the value stack. NULL until the fiber starts, and again once it's done
+    Value* stackTop;
+    int stackCapacity;
+    CallFrame* frames;
+    int frameCount;
+    int frameCapacity;
+} ObjFiber;
+
+ObjArray* newArray(VM* vm, int count);
+ObjClass* newClass(VM* vm, ObjString* name);
+ObjFiber* newFiber(VM* vm, ObjFunction* function);
+ObjInstance* newInstance(VM* vm, ObjClass* klass);
+ObjShape* newShape(VM* vm, ObjShape* parent, ObjString* name);
+int findSlot(ObjShape* shape, ObjString* name);
+ObjShape* addField(VM* vm, ObjShape* shape, ObjString* name);
+ObjFunction* newFunction(VM* vm);
+LazyBody* newLazyBody(const char* source, int length, int line);
+void freeLazyBody(LazyBody* body);
+ObjNative* newNative(VM* vm, NativeFn function);
+uint32_t hashString(const char* key, int length);
+ObjString* takeString(VM* vm, char* chars, int length);
+ObjString* copyString(VM* vm, const char* chars, int length);
 void printObject(Value value);
 
 /**
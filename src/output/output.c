@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+static _Thread_local char buffer[OUTPUT_BUFFER_BYTES];
+static _Thread_local size_t used;
+
+// Whether stdout is a terminal, in which case every line is flushed as it ends like stdio would. -1 until checked
+static _Thread_local int interactive = -1;
+
+// Where this thread's output goes instead of stdout and stderr. NULL for those
+static _Thread_local OutputSink sink;
+static _Thread_local void* sinkContext;
+
+static void writeAll(OutputStream stream, const char* chars, size_t length) {
+    if (sink != NULL) {
+        sink(sinkContext, stream, chars, length);
+        return;
+    }
+
+    int fd = stream == OUTPUT_STDOUT ? STDOUT_FILENO : STDERR_FILENO;
+    while (length > 0) {
+        ssize_t written = write(fd, chars, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;  // Nowhere to report it, and stdio would have dropped the output too
+        }
+
+        chars += written;
+        length -= (size_t)written;
+    }
+}
+
+/**
+    Send everything this thread writes to *write* from now on, both the script's output and its error messages, or
+    back to stdout and stderr if it's NULL. Whatever is buffered goes out first, to wherever it was headed. Output to
+    a sink is never flushed line by line
+ */
+void setOutputSink(OutputSink write, void* context) {
+    flushOutput();
+    sink = write;
+    sinkContext = context;
+    interactive = write != NULL ? 0 : -1;
+}
+
+void flushOutput(void) {
+    writeAll(OUTPUT_STDOUT, buffer, used);
+    used = 0;
+}
+
+void writeOutput(const char* chars, size_t length) {
+    if (length > OUTPUT_BUFFER_BYTES - used) {
+        flushOutput();
+        if (length > OUTPUT_BUFFER_BYTES) {
+            writeAll(OUTPUT_STDOUT, chars, length);
+            return;
+        }
+    }
+
+    memcpy(buffer + used, chars, length);
+    used += length;
+}
+
+/**
+    Write formatted output, like printf. Only used for debugging output, so it doesn't need to be fast
+ */
+void printOutput(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if ((size_t)length >= OUTPUT_BUFFER_BYTES - used) flushOutput();
+
+    if ((size_t)length < OUTPUT_BUFFER_BYTES) {
+        va_start(args, format);
+        vsnprintf(buffer + used, OUTPUT_BUFFER_BYTES - used, format, args);
+        va_end(args);
+        used += (size_t)length;
+        return;
+    }
+
+    char* chars = malloc((size_t)length + 1);
+    if (chars == NULL) return;
+    va_start(args, format);
+    vsnprintf(chars, (size_t)length + 1, format, args);
+    va_end(args);
+    writeAll(OUTPUT_STDOUT, chars, (size_t)length);
+    free(chars);
+}
+
+/**
+    Write a compile or runtime error message, like fprintf(stderr, ...). It's not buffered, so call flushOutput()
+    first for it to come after what the script has printed
+ */
+void vprintError(const char* format, va_list args) {
+    char chars[256];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(chars, sizeof(chars), format, copy);
+    va_end(copy);
+    if (length < 0) return;
+
+    if ((size_t)length < sizeof(chars)) {
+        writeAll(OUTPUT_STDERR, chars, (size_t)length);
+        return;
+    }
+
+    char* longChars = malloc((size_t)length + 1);
+    if (longChars == NULL) return;
+    vsnprintf(longChars, (size_t)length + 1, format, args);
+    writeAll(OUTPUT_STDERR, longChars, (size_t)length);
+    free(longChars);
+}
+
+void printError(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintError(format, args);
+    va_end(args);
+}
+
+/**
+    End a line of output. The buffer is flushed at line ends once it's half full, so unless a single line is longer
+    than that, lines are written out whole, and isolates printing at the same time never split each other's lines
+ */
+void endOutputLine(void) {
+    writeOutput("\n", 1);
+
+    if (interactive == -1) interactive = isatty(STDOUT_FILENO);
+    if (interactive || used >= OUTPUT_BUFFER_BYTES / 2) flushOutput();
+}
+
+void writeNumber(double number) {
+    char chars[NUMBER_BUFFER_BYTES];
+    writeOutput(chars, (size_t)formatNumber(number, chars));
+}
+
+static int formatInteger(uint32_t value, char* chars);
+
+/**
+    Write a number held as an int. Printed the same as the equal double would be, which %g writes in scientific
+    notation from a million up
+ */
+void writeInteger(int32_t integer) {
+    if (integer <= -1000000 || integer >= 1000000) {
+        writeNumber(integer);
+        return;
+    }
+
+    char chars[NUMBER_BUFFER_BYTES];
+    int length = 0;
+    if (integer < 0) chars[length++] = '-';
+    length += formatInteger(integer < 0 ? (uint32_t)-integer : (uint32_t)integer, chars + length);
+    writeOutput(chars, (size_t)length);
+}
+
+// Every power of ten a double holds exactly
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22
+};
+
+/**
+    Write the decimal digits of *value* to *chars* and return how many there were
+ */
+static int formatInteger(uint32_t value, char* chars) {
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = 0; i < count; i++) chars[i] = digits[count - 1 - i];
+    return count;
+}
+
+/**
+    Format a finite, nonzero number the way %g does, from its first six significant digits. Returns 0 if it can't be
+    sure of rounding those digits the same way printf would, and printf has to do it instead
+
+    Scaling by an exact power of ten is a single rounding, so the scaled value is within 2^-33 of the exact one. That
+    only matters when the exact value is almost halfway between two six digit numbers, and those are left to printf
+ */
+static int formatSignificant(double number, char* chars) {
+    double magnitude = fabs(number);
+    if (magnitude < 1e-16 || magnitude >= 1e22) return 0;
+
+    // Decimal exponent of the leading digit, estimated from the binary exponent. The estimate can be one off, which
+    // the range check below corrects
+    uint64_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    int exponent = (int)(((int)((bits >> 52) & 0x7ff) - 1023) * 0.30103);
+    double scaled;
+    for (;;) {
+        int shift = 5 - exponent;
+        scaled = shift >= 0 ? magnitude * powersOfTen[shift] : magnitude / powersOfTen[-shift];
+
+        if (scaled < 1e5) {
+            exponent--;
+        } else if (scaled >= 1e6) {
+            exponent++;
+        } else {
+            break;
+        }
+    }
+
+    uint32_t whole = (uint32_t)scaled;
+    double fraction = scaled - whole;
+    if (fabs(fraction - 0.5) < 1e-9) return 0;
+
+    uint32_t digits = whole + (fraction > 0.5);
+    if (digits == 1000000) {  // Rounded up to the next power of ten
+        digits = 100000;
+        exponent++;
+    }
+
+    char significant[6];
+    formatInteger(digits, significant);
+
+    int significantCount = 6;  // Trailing zeros are never printed
+    while (significantCount > 1 && significant[significantCount - 1] == '0') significantCount--;
+
+    int length = 0;
+    if (number < 0) chars[length++] = '-';
+
+    if (exponent < -4 || exponent >= 6) {
+        // Scientific notation: d.ddddde+XX, with at least two exponent digits
+        chars[length++] = significant[0];
+        if (significantCount > 1) {
+            chars[length++] = '.';
+            memcpy(chars + length, significant + 1, significantCount - 1);
+            length += significantCount - 1;
+        }
+
+        chars[length++] = 'e';
+        chars[length++] = exponent < 0 ? '-' : '+';
+        int exponentMagnitude = exponent < 0 ? -exponent : exponent;
+        if (exponentMagnitude < 10) chars[length++] = '0';
+        length += formatInteger((uint32_t)exponentMagnitude, chars + length);
+    } else if (exponent >= 0) {
+        // Plain notation with the point after the leading exponent + 1 digits
+        int integerDigits = exponent + 1;
+        memcpy(chars + length, significant, integerDigits);
+        length += integerDigits;
+
+        if (significantCount > integerDigits) {
+            chars[length++] = '.';
+            memcpy(chars + length, significant + integerDigits, significantCount - integerDigits);
+            length += significantCount - integerDigits;
+        }
+    } else {
+        // Plain notation below one: 0.000ddd
+        chars[length++] = '0';
+        chars[length++] = '.';
+        for (int i = -1; i > exponent; i--) chars[length++] = '0';
+        memcpy(chars + length, significant, significantCount);
+        length += significantCount;
+    }
+
+    chars[length] = '\0';
+    return length;
+}
+
+/**
+    Format a number exactly as printf("%g") would, into *chars*, which must hold NUMBER_BUFFER_BYTES. Returns the
+    length. Integers and most other numbers are formatted directly. NaN, infinity, and numbers too tiny, too huge or
+    too close to a rounding boundary to be sure of, go to snprintf
+ */
+int formatNumber(double number, char* chars) {
+    if (number == 0) {
+        int length = signbit(number) ? 2 : 1;
+        memcpy(chars, signbit(number) ? "-0" : "0", length + 1);
+        return length;
+    }
+
+    if (number > -1e6 && number < 1e6 && number == (int32_t)number) {
+        int length = 0;
+        int32_t integer = (int32_t)number;
+        if (integer < 0) chars[length++] = '-';
+        length += formatInteger(integer < 0 ? (uint32_t)-integer : (uint32_t)integer, chars + length);
+        chars[length] = '\0';
+        return length;
+    }
+
+    if (isfinite(number)) {
+        int length = formatSignificant(number, chars);
+        if (length > 0) return length;
+    }
+
+    return snprintf(chars, NUMBER_BUFFER_BYTES, "%g", number);
+}
@@ -0,0 +1,40 @@
+/**
+    Module for everything a script (or the debugging output) writes to stdout. Output collects in a large buffer that
+    is written out with one write() when it fills up, when flushOutput() is called, and when the VM is freed, instead
+    of going through stdio call by call. The buffer is per thread, so isolates never contend for it
+
+    Compile and runtime errors go through here too, unbuffered, so a thread can send a script's output and errors
+    somewhere other than stdout and stderr with setOutputSink(). The server does that to hand them back to its client
+ */
+
+#ifndef clox_output_h
+#define clox_output_h
+
+#include <stdarg.h>
+
+#include "../common.h"
+
+#define OUTPUT_BUFFER_BYTES (64 * 1024)
+
+// Longest string formatNumber() can produce, including the terminating NUL
+#define NUMBER_BUFFER_BYTES 32
+
+typedef enum {
+    OUTPUT_STDOUT,
+    OUTPUT_STDERR
+} OutputStream;
+
+typedef void (*OutputSink)(void* context, OutputStream stream, const char* chars, size_t length);
+
+void setOutputSink(OutputSink write, void* context);
+void writeOutput(const char* chars, size_t length);
+void printOutput(const char* format, ...);
+void writeNumber(double number);
+void writeInteger(int32_t integer);
+void endOutputLine(void);
+void flushOutput(void);
+int formatNumber(double number, char* buffer);
+void printError(const char* format, ...);
+void vprintError(const char* format, va_list args);
+
+#endif
@@ -0,0 +1,48 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "region.h"
+
+size_t pageSize(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+size_t roundUpToPage(size_t bytes) {
+    size_t page = pageSize();
+    return (bytes + page - 1) / page * page;
+}
+
+/**
+    Reserve at least *bytes* of address space, with none of it committed. The size actually reserved, a whole number of
+    pages, goes in *reservedBytes*. Returns NULL if the space can't be reserved
+ */
+void* reserveRegion(size_t bytes, size_t* reservedBytes) {
+    *reservedBytes = roundUpToPage(bytes);
+
+    void* region = mmap(NULL, *reservedBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return region == MAP_FAILED ? NULL : region;
+}
+
+void releaseRegion(void* base, size_t reservedBytes) {
+    if (base != NULL) munmap(base, reservedBytes);
+}
+
+/**
+    Commit enough of the region at *base*, which has *committed* bytes committed so far, that its first *needed* bytes
+    can be used. Growth at least doubles the committed size, and is never less than *minimum*, so something that grows
+    a little at a time doesn't mprotect every time. Nothing past *usable* is ever committed. Returns the new committed
+    size, or 0 if *needed* is past *usable* or the memory can't be committed
+ */
+size_t commitRegion(void* base, size_t committed, size_t needed, size_t minimum, size_t usable) {
+    needed = roundUpToPage(needed);
+    if (needed <= committed) return committed;
+    if (needed > usable) return 0;
+
+    size_t target = committed * 2;
+    if (target < needed) target = needed;
+    if (target < minimum) target = minimum;
+    if (target > usable) target = usable;
+
+    if (mprotect(base, target, PROT_READ | PROT_WRITE) != 0) return 0;
+    return target;
+}
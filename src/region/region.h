@@ -0,0 +1,18 @@
+/**
+    Module for regions of address space that are reserved up front and only backed by memory as they're needed. The
+    value stack and the compiler's arena both live in one. A reservation starts out entirely PROT_NONE, and is
+    committed from its start, so whatever lives in it never moves as it grows
+ */
+
+#ifndef clox_region_h
+#define clox_region_h
+
+#include "../common.h"
+
+size_t pageSize(void);
+size_t roundUpToPage(size_t bytes);
+void* reserveRegion(size_t bytes, size_t* reservedBytes);
+void releaseRegion(void* base, size_t reservedBytes);
+size_t commitRegion(void* base, size_t committed, size_t needed, size_t minimum, size_t usable);
+
+#endif
@@ -0,0 +1,362 @@
+#include "registers.h"
+#include "../memory/memory.h"
+
+/**
+    Where the value at one depth of the (now virtual) operand stack currently lives
+ */
+typedef enum {
+    OPERAND_HOME,      // In the register for its own stack depth
+    OPERAND_ALIAS,     // Still only in the register *index*, a local below it that hasn't been reassigned since
+    OPERAND_CONSTANT   // Still only in the constant table at *index*
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    uint8_t index;
+} Operand;
+
+typedef struct {
+    Chunk* chunk;
+    RegisterCode* registers;
+    Operand stack[UINT8_COUNT];
+    int height;
+    int line;  // Line of the stack instruction being translated
+    int lastDestination;  // Position of the destination operand of the last instruction, if it produced the top value
+    bool failed;
+} Translator;
+
+static void emitByte(Translator* translator, uint8_t byte) {
+    RegisterCode* registers = translator->registers;
+    if (registers->capacity < registers->count + 1) {
+        int oldCapacity = registers->capacity;
+        registers->capacity = GROW_CAPACITY(oldCapacity);
+        registers->code = GROW_ARRAY(registers->code, uint8_t, oldCapacity, registers->capacity);
+        registers->lines = GROW_ARRAY(registers->lines, int, oldCapacity, registers->capacity);
+    }
+
+    registers->code[registers->count] = byte;
+    registers->lines[registers->count] = translator->line;
+    registers->count++;
+}
+
+static void emitBytes(Translator* translator, uint8_t byte1, uint8_t byte2, uint8_t byte3) {
+    emitByte(translator, byte1);
+    emitByte(translator, byte2);
+    emitByte(translator, byte3);
+}
+
+static void push(Translator* translator, OperandKind kind, int index) {
+    if (translator->height == UINT8_COUNT) {
+        translator->failed = true;  // A register number wouldn't fit in its operand byte
+        return;
+    }
+
+    translator->stack[translator->height].kind = kind;
+    translator->stack[translator->height].index = (uint8_t)index;
+    translator->height++;
+}
+
+/**
+    Make sure the value at *depth* is actually stored in its own register
+ */
+static void materialize(Translator* translator, int depth) {
+    Operand* operand = &translator->stack[depth];
+
+    switch (operand->kind) {
+        case OPERAND_HOME:
+            return;
+        case OPERAND_ALIAS:
+            emitBytes(translator, REG_MOVE, depth, operand->index);
+            break;
+        case OPERAND_CONSTANT:
+            emitBytes(translator, REG_LOAD_CONSTANT, depth, operand->index);
+            break;
+    }
+
+    operand->kind = OPERAND_HOME;
+}
+
+/**
+    Return a register holding the value at *depth*, loading it into its own register only if it's a constant
+ */
+static uint8_t operandRegister(Translator* translator, int depth) {
+    Operand* operand = &translator->stack[depth];
+    if (operand->kind == OPERAND_ALIAS) return operand->index;
+
+    materialize(translator, depth);
+    return (uint8_t)depth;
+}
+
+/**
+    Pop *popCount* values and push the result of an instruction that is about to be emitted with its destination
+    operand at *position*, which is the register of the result's own depth
+ */
+static void pushResult(Translator* translator, int popCount, int position) {
+    translator->height -= popCount;
+    push(translator, OPERAND_HOME, translator->height);
+    translator->lastDestination = position;
+}
+
+static int registerBinaryOp(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:         return REG_EQUAL;
+        case OP_NOT_EQUAL:     return REG_NOT_EQUAL;
+        case OP_GREATER:       case OP_GREATER_NUMBER:  case OP_GREATER_INT:  return REG_GREATER;
+        case OP_GREATER_EQUAL: return REG_GREATER_EQUAL;
+        case OP_LESS:          case OP_LESS_NUMBER:     case OP_LESS_INT:     return REG_LESS;
+        case OP_LESS_EQUAL:    return REG_LESS_EQUAL;
+        case OP_ADD:           case OP_ADD_NUMBER:      case OP_ADD_INT:      case OP_ADD_STRING: return REG_ADD;
+        case OP_SUBTRACT:      case OP_SUBTRACT_NUMBER: case OP_SUBTRACT_INT: return REG_SUBTRACT;
+        case OP_MULTIPLY:      case OP_MULTIPLY_NUMBER: case OP_MULTIPLY_INT: return REG_MULTIPLY;
+        case OP_DIVIDE:        case OP_DIVIDE_NUMBER:   return REG_DIVIDE;
+        default:               return -1;
+    }
+}
+
+// Form of a binary instruction that takes its right operand from the constant table. -1 if there isn't one
+static int registerConstantOp(int registerOp) {
+    switch (registerOp) {
+        case REG_EQUAL:    return REG_EQUAL_CONSTANT;
+        case REG_GREATER:  return REG_GREATER_CONSTANT;
+        case REG_LESS:     return REG_LESS_CONSTANT;
+        case REG_ADD:      return REG_ADD_CONSTANT;
+        case REG_SUBTRACT: return REG_SUBTRACT_CONSTANT;
+        case REG_MULTIPLY: return REG_MULTIPLY_CONSTANT;
+        default:           return -1;
+    }
+}
+
+static int superinstructionOp(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL_CONSTANT:    return REG_EQUAL_CONSTANT;
+        case OP_GREATER_CONSTANT:  return REG_GREATER_CONSTANT;
+        case OP_LESS_CONSTANT:     return REG_LESS_CONSTANT;
+        case OP_ADD_CONSTANT:      return REG_ADD_CONSTANT;
+        case OP_SUBTRACT_CONSTANT: return REG_SUBTRACT_CONSTANT;
+        case OP_MULTIPLY_CONSTANT: return REG_MULTIPLY_CONSTANT;
+        default:                   return -1;
+    }
+}
+
+/**
+    Store the top value into local *slot*. If the top value was just computed, its instruction is retargeted to write
+    the local directly, which turns `a = b + c` into a single REG_ADD. Copies of the local's old value that are still
+    waiting on the stack get their own registers first
+ */
+static void setLocal(Translator* translator, int lastDestination, uint8_t slot) {
+    int top = translator->height - 1;
+    bool aliased = false;
+
+    for (int depth = slot + 1; depth < translator->height; depth++) {
+        Operand* operand = &translator->stack[depth];
+        if (operand->kind == OPERAND_ALIAS && operand->index == slot) aliased = true;
+    }
+
+    if (top == slot) return;
+
+    if (!aliased && lastDestination != -1) {
+        translator->registers->code[lastDestination] = slot;
+        translator->stack[top].kind = OPERAND_ALIAS;
+        translator->stack[top].index = slot;
+    } else {
+        for (int depth = slot + 1; depth < translator->height; depth++) {
+            Operand* operand = &translator->stack[depth];
+            if (operand->kind == OPERAND_ALIAS && operand->index == slot) materialize(translator, depth);
+        }
+
+        Operand* value = &translator->stack[top];
+        if (value->kind == OPERAND_CONSTANT) {
+            emitBytes(translator, REG_LOAD_CONSTANT, slot, value->index);
+        } else if (value->kind != OPERAND_ALIAS || value->index != slot) {
+            emitBytes(translator, REG_MOVE, slot, operandRegister(translator, top));
+        }
+    }
+
+    translator->stack[slot].kind = OPERAND_HOME;
+}
+
+static void binaryOp(Translator* translator, int registerOp) {
+    int right = translator->height - 1;
+    int left = translator->height - 2;
+    int constantOp = registerConstantOp(registerOp);
+
+    if (constantOp != -1 && translator->stack[right].kind == OPERAND_CONSTANT) {
+        uint8_t a = operandRegister(translator, left);
+        emitByte(translator, constantOp);
+        int position = translator->registers->count;
+        emitBytes(translator, left, a, translator->stack[right].index);
+        pushResult(translator, 2, position);
+        return;
+    }
+
+    uint8_t b = operandRegister(translator, right);
+    uint8_t a = operandRegister(translator, left);
+    emitByte(translator, registerOp);
+    int position = translator->registers->count;
+    emitBytes(translator, left, a, b);
+    pushResult(translator, 2, position);
+}
+
+/**
+    Translate one stack instruction and return its length
+ */
+static int translateInstruction(Translator* translator, int offset) {
+    Chunk* chunk = translator->chunk;
+    uint8_t instruction = chunk->code[offset];
+    uint8_t operand = offset + 1 < chunk->count ? chunk->code[offset + 1] : 0;
+    int top = translator->height - 1;
+
+    int lastDestination = translator->lastDestination;
+    translator->lastDestination = -1;
+    translator->line = chunk->lines[offset];
+
+    switch (instruction) {
+        case OP_CONSTANT:
+            push(translator, OPERAND_CONSTANT, operand);
+            return 2;
+
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            emitByte(translator, instruction == OP_NIL ? REG_LOAD_NIL :
+                                 instruction == OP_TRUE ? REG_LOAD_TRUE : REG_LOAD_FALSE);
+            emitByte(translator, translator->height);
+            push(translator, OPERAND_HOME, translator->height);
+            return 1;
+
+        case OP_POP:
+            translator->height--;
+            return 1;
+
+        case OP_GET_LOCAL: {
+            Operand local = translator->stack[operand];
+            if (local.kind == OPERAND_HOME) {
+                push(translator, OPERAND_ALIAS, operand);
+            } else {
+                push(translator, local.kind, local.index);
+            }
+            return 2;
+        }
+        case OP_SET_LOCAL:
+            setLocal(translator, lastDestination, operand);
+            return 2;
+
+        case OP_GET_GLOBAL: {
+            emitByte(translator, REG_GET_GLOBAL);
+            int position = translator->registers->count;
+            emitByte(translator, translator->height);
+            emitByte(translator, operand);
+            pushResult(translator, 0, position);
+            return 2;
+        }
+        case OP_DEFINE_GLOBAL:
+            emitBytes(translator, REG_DEFINE_GLOBAL, operandRegister(translator, top), operand);
+            translator->height--;
+            return 2;
+        case OP_SET_GLOBAL:
+            emitBytes(translator, REG_SET_GLOBAL, operandRegister(translator, top), operand);
+            return 2;
+
+        case OP_EQUAL_CONSTANT: case OP_GREATER_CONSTANT: case OP_LESS_CONSTANT:
+        case OP_ADD_CONSTANT: case OP_SUBTRACT_CONSTANT: case OP_MULTIPLY_CONSTANT: {
+            uint8_t a = operandRegister(translator, top);
+            emitByte(translator, superinstructionOp(instruction));
+            int position = translator->registers->count;
+            emitBytes(translator, top, a, operand);
+            pushResult(translator, 1, position);
+            return 2;
+        }
+
+        case OP_NOT:
+        case OP_NEGATE: {
+            uint8_t source = operandRegister(translator, top);
+            emitByte(translator, instruction == OP_NOT ? REG_NOT : REG_NEGATE);
+            int position = translator->registers->count;
+            emitByte(translator, top);
+            emitByte(translator, source);
+            pushResult(translator, 1, position);
+            return 1;
+        }
+
+        case OP_PRINT: {
+            uint8_t source = operandRegister(translator, top);
+            emitByte(translator, REG_PRINT);
+            emitByte(translator, source);
+            translator->height--;
+            return 1;
+        }
+
+        case OP_CALL: {
+            // The callee and arguments have to be laid out in consecutive registers, where the callee's frame expects
+            int base = translator->height - operand - 1;
+            for (int depth = base; depth < translator->height; depth++) materialize(translator, depth);
+
+            emitBytes(translator, REG_CALL, base, operand);
+            translator->height = base;
+            push(translator, OPERAND_HOME, base);
+            return 2;
+        }
+
+        case OP_RETURN: {
+            uint8_t source = operandRegister(translator, top);
+            emitByte(translator, REG_RETURN);
+            emitByte(translator, source);
+            translator->height--;
+            return 1;
+        }
+
+        default: {
+            int registerOp = registerBinaryOp(instruction);
+            if (registerOp == -1) {
+                translator->failed = true;  // Nothing to translate this instruction into
+                return 1;
+            }
+
+            binaryOp(translator, registerOp);
+            return 1;
+        }
+    }
+}
+
+/**
+    Translate *function*'s stack bytecode into register code. Returns false, leaving the function with only its stack
+    bytecode, if it uses an instruction or more registers than the register code can express
+ */
+bool translateToRegisters(ObjFunction* function) {
+    if (function->maxSlots > UINT8_COUNT) return false;
+
+    RegisterCode* registers = ALLOCATE(RegisterCode, 1);
+    registers->count = 0;
+    registers->capacity = 0;
+    registers->code = NULL;
+    registers->lines = NULL;
+
+    Translator translator;
+    translator.chunk = &function->chunk;
+    translator.registers = registers;
+    translator.height = 0;
+    translator.line = 0;
+    translator.lastDestination = -1;
+    translator.failed = false;
+
+    // The callee and its arguments are already in their own registers when the function starts
+    for (int slot = 0; slot <= function->arity; slot++) push(&translator, OPERAND_HOME, slot);
+
+    for (int offset = 0; offset < function->chunk.count && !translator.failed;) {
+        offset += translateInstruction(&translator, offset);
+    }
+
+    if (translator.failed) {
+        freeRegisterCode(registers);
+        return false;
+    }
+
+    function->registers = registers;
+    return true;
+}
+
+void freeRegisterCode(RegisterCode* registers) {
+    FREE_ARRAY(uint8_t, registers->code, registers->capacity);
+    FREE_ARRAY(int, registers->lines, registers->capacity);
+    FREE(RegisterCode, registers);
+}
@@ -0,0 +1,62 @@
+/**
+    Register based variant of the bytecode, used instead of the stack bytecode when clox is built with
+    -DCLOX_REGISTER_VM. Instructions are three-address: they name the frame slots (registers) they read and the slot
+    they write, so evaluating an expression over locals doesn't copy every operand onto the top of the stack first.
+
+    The compiler still produces stack bytecode, and then translates each function into register code. Stack depth is
+    known statically, so the value at stack depth d is simply given register d. While translating, values that are
+    only copies of a local or a constant are tracked without emitting anything, and instructions read them straight
+    from where they already are. A function the translator can't handle keeps only its stack bytecode and runs in the
+    stack interpreter, which the register interpreter hands off to on calls and returns
+ */
+
+#ifndef clox_registers_h
+#define clox_registers_h
+
+#include "../common.h"
+#include "../object/object.h"
+
+// Operands in the comments: R is a register (frame slot) and K a constant table index, each one byte
+typedef enum {
+    REG_LOAD_CONSTANT,      // R[dst] = K
+    REG_LOAD_NIL,           // R[dst] = nil
+    REG_LOAD_TRUE,
+    REG_LOAD_FALSE,
+    REG_MOVE,               // R[dst] = R[src]
+    REG_GET_GLOBAL,         // R[dst] = globals[K]
+    REG_DEFINE_GLOBAL,      // globals[K] = R[src]
+    REG_SET_GLOBAL,
+    REG_EQUAL,              // R[dst] = R[a] == R[b]
+    REG_NOT_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_EQUAL_CONSTANT,     // R[dst] = R[a] == K
+    REG_GREATER_CONSTANT,
+    REG_LESS_CONSTANT,
+    REG_ADD_CONSTANT,
+    REG_SUBTRACT_CONSTANT,
+    REG_MULTIPLY_CONSTANT,
+    REG_NOT,                // R[dst] = !R[src]
+    REG_NEGATE,
+    REG_PRINT,              // print R[src]
+    REG_CALL,               // R[base] = R[base](R[base + 1] ... R[base + argCount])
+    REG_RETURN              // return R[src]
+} RegisterOp;
+
+struct sRegisterCode {
+    int count;
+    int capacity;
+    uint8_t* code;
+    int* lines;  // Source line of every byte, like Chunk's lines
+};
+
+bool translateToRegisters(ObjFunction* function);
+void freeRegisterCode(RegisterCode* registers);
+
+#endif
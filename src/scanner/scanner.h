@@ -1,10 +1,13 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "../common.h"
+
 typedef enum {
     // Single character tokens
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
-    TOKEN_LEFT_BRACE, TOKEN_RiGHT_BRACE,
+    TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
 
@@ -39,7 +42,14 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+typedef struct {
+    const char* start;  // Start of the lexeme currently being scanned
+    const char* current;
+    const char* end;  // One past the last character of the source. The source doesn't need a terminating NUL
+    int line;
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source, size_t length);
+Token scanToken(Scanner* scanner);
 
 #endif
\ No newline at end of file
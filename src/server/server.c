@@ -0,0 +1,335 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "../output/output.h"
+#include "../vm/vm.h"
+
+#define FRAME_HEADER_BYTES 5
+
+typedef struct {
+    int listener;
+    SharedSegment* shared;
+    uint64_t budget;  // Back-edges plus calls each request may run. 0 for no limit
+} Server;
+
+/**
+    A frame as it's read. The payload buffer is reused from one frame to the next, and always has a NUL after the
+    payload, so a path can be used as it is
+ */
+typedef struct {
+    char tag;
+    char* payload;
+    uint32_t length;
+    size_t capacity;
+} Frame;
+
+static const char* listeningPath;  // Removed when the server is stopped
+
+static bool sendAll(int socket, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(socket, bytes, length, MSG_NOSIGNAL);  // A client that's gone is an error, not a signal
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool sendFrame(int socket, char tag, const char* payload, size_t length) {
+    char header[FRAME_HEADER_BYTES];
+    uint32_t size = (uint32_t)length;
+    header[0] = tag;
+    memcpy(header + 1, &size, sizeof(size));
+
+    // Header and payload in one call, which is all it takes unless the socket's buffer is full
+    struct iovec parts[2] = {{header, sizeof(header)}, {(void*)payload, length}};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) return false;
+
+    if ((size_t)sent < sizeof(header)) {
+        return sendAll(socket, header + sent, sizeof(header) - (size_t)sent) && sendAll(socket, payload, length);
+    }
+    size_t payloadSent = (size_t)sent - sizeof(header);
+    return sendAll(socket, payload + payloadSent, length - payloadSent);
+}
+
+static bool receiveAll(int socket, char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(socket, bytes, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+
+        bytes += received;
+        length -= (size_t)received;
+    }
+    return true;
+}
+
+/**
+    Read the next frame into *frame*. Returns false if the connection ends part way, or the frame's length is over
+    *maxLength*, since the length is whatever the peer says it is
+ */
+static bool readFrame(int socket, Frame* frame, uint32_t maxLength) {
+    char header[FRAME_HEADER_BYTES];
+    if (!receiveAll(socket, header, sizeof(header))) return false;
+    frame->tag = header[0];
+    memcpy(&frame->length, header + 1, sizeof(frame->length));
+    if (frame->length > maxLength) return false;
+
+    if (frame->length >= frame->capacity) {
+        char* payload = realloc(frame->payload, (size_t)frame->length + 1);
+        if (payload == NULL) return false;
+        frame->payload = payload;
+        frame->capacity = (size_t)frame->length + 1;
+    }
+
+    frame->payload[frame->length] = '\0';
+    return receiveAll(socket, frame->payload, frame->length);
+}
+
+static bool writeAllTo(int fd, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// The status `clox <path>` exits with
+static uint8_t exitStatus(InterpretResult result) {
+    switch (result) {
+        case INTERPRET_OK: return 0;
+        case INTERPRET_COMPILE_ERROR: return 65;
+        case INTERPRET_RUNTIME_ERROR: return 70;
+        case INTERPRET_BUDGET_EXHAUSTED: return 75;
+    }
+    return 70;
+}
+
+/**
+    Read a whole script into memory. The server can't map it like `clox <path>` does, since the file could be
+    truncated while it runs, which would kill the whole server rather than one request. Returns NULL on failure
+ */
+static char* readScript(const char* path, size_t* length) {
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) return NULL;
+
+    struct stat info;
+    char* source = NULL;
+    if (fstat(file, &info) == 0) source = malloc((size_t)info.st_size + 1);
+
+    size_t done = 0;
+    while (source != NULL && done < (size_t)info.st_size) {
+        ssize_t count = read(file, source + done, (size_t)info.st_size - done);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;  // Shrank since it was stat'ed, or failed
+        done += (size_t)count;
+    }
+    close(file);
+
+    *length = done;
+    return source;
+}
+
+// Output sink for a request: every write becomes a frame to the client. If the client has gone, the script runs on
+static void sendOutput(void* context, OutputStream stream, const char* chars, size_t length) {
+    int client = (int)(intptr_t)context;
+    sendFrame(client, stream == OUTPUT_STDOUT ? SERVE_STDOUT : SERVE_STDERR, chars, length);
+}
+
+// Run a script, and tell the client if it was stopped for running out of budget, like `clox <path>` does
+static uint8_t runRequest(VM* vm, const char* source, size_t length) {
+    InterpretResult result = interpret(vm, source, length);
+    if (result == INTERPRET_BUDGET_EXHAUSTED) {
+        flushOutput();  // After what the script printed
+        printError("Script ran out of budget.\n");
+    }
+    return exitStatus(result);
+}
+
+static void serveClient(VM* vm, int client, Frame* request) {
+    if (!readFrame(client, request, SERVE_REQUEST_MAX)) return;  // Nothing is run, and the client sees no status
+
+    setOutputSink(sendOutput, (void*)(intptr_t)client);
+    uint8_t status;
+    if (request->tag == SERVE_SOURCE) {
+        status = runRequest(vm, request->payload, request->length);
+    } else if (request->tag == SERVE_PATH) {
+        size_t length;
+        char* source = readScript(request->payload, &length);
+        if (source == NULL) {
+            printError("Could not open file \"%s\".\n", request->payload);
+            status = 74;
+        } else {
+            status = runRequest(vm, source, length);
+            free(source);
+        }
+    } else {
+        printError("Unknown request.\n");
+        status = 64;
+    }
+    setOutputSink(NULL, NULL);  // Sends whatever the script printed last
+
+    sendFrame(client, SERVE_EXIT, (const char*)&status, 1);
+}
+
+// Wait for the next client. Returns -1 only if the listening socket is gone
+static int acceptClient(int listener) {
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client >= 0) return client;
+        if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK) return -1;
+        if (errno != EINTR && errno != ECONNABORTED) usleep(1000);  // Out of descriptors or memory for now
+    }
+}
+
+/**
+    One worker. Its VM is initialized before it waits for a client, and freed after the client is served, so all a
+    request waits for is compiling and running the script. The compiler's arena outlives the VMs, so its memory is
+    already mapped in for the next request too
+ */
+static void* serveRequests(void* argument) {
+    Server* server = argument;
+    VM* vm = malloc(sizeof(VM));
+    Frame request = {0, NULL, 0, 0};
+    Arena arena;
+    if (vm == NULL) {
+        fprintf(stderr, "Not enough memory for a server VM.\n");
+        exit(74);
+    }
+    initArena(&arena);
+
+    for (;;) {
+        initSharedVM(vm, server->shared);
+        vm->compileArena = &arena;
+        vm->budget = server->budget;
+        int client = acceptClient(server->listener);
+        if (client < 0) {
+            freeVM(vm);
+            break;
+        }
+
+        serveClient(vm, client, &request);
+        close(client);
+        freeVM(vm);
+    }
+
+    freeArena(&arena);
+    free(request.payload);
+    free(vm);
+    return NULL;
+}
+
+static void stopServer(int signal) {
+    unlink(listeningPath);
+    _exit(0);
+}
+
+/**
+    Serve requests on a Unix domain socket at *socketPath* with *threadCount* workers, one of them this thread, until
+    the process is stopped with SIGINT or SIGTERM, which removes the socket. A socket left behind by a server that
+    didn't get to remove it is replaced. If *shared* isn't NULL, every VM starts from its strings and globals. If
+    *budget* isn't 0, a request that runs more back-edges plus calls than that is stopped, so a script stuck in a
+    loop can't hold a worker forever
+ */
+void runServer(const char* socketPath, int threadCount, SharedSegment* shared, uint64_t budget) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", socketPath);
+        exit(64);
+    }
+    strcpy(address.sun_path, socketPath);
+
+    struct stat info;
+    if (lstat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(socketPath);
+
+    Server server;
+    server.shared = shared;
+    server.budget = budget;
+    server.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server.listener < 0 || bind(server.listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server.listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "Could not listen on \"%s\": %s.\n", socketPath, strerror(errno));
+        exit(74);
+    }
+
+    listeningPath = socketPath;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    fprintf(stderr, "Serving on %s with %d threads\n", socketPath, threadCount);
+
+    for (int i = 1; i < threadCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveRequests, &server) != 0) {
+            fprintf(stderr, "Could not start a server thread.\n");
+            exit(74);
+        }
+        pthread_detach(thread);
+    }
+    serveRequests(&server);
+}
+
+/**
+    Send one request to the server at *socketPath*, copy what the script prints to *outFd* and its errors to *errFd*
+    as they arrive, and return its exit status. Returns -1 if the server can't be reached or goes away part way
+ */
+int requestRun(const char* socketPath, char tag, const char* payload, size_t length, int outFd, int errFd) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socketPath);
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) return -1;
+    if (connect(server, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        !sendFrame(server, tag, payload, length)) {
+        close(server);
+        return -1;
+    }
+
+    int status = -1;
+    Frame frame = {0, NULL, 0, 0};
+    while (readFrame(server, &frame, UINT32_MAX)) {  // Output is as long as the script makes it
+        if (frame.tag == SERVE_EXIT) {
+            status = frame.length == 1 ? (uint8_t)frame.payload[0] : -1;
+            break;
+        }
+        writeAllTo(frame.tag == SERVE_STDOUT ? outFd : errFd, frame.payload, frame.length);
+    }
+
+    free(frame.payload);
+    close(server);
+    return status;
+}
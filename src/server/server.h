@@ -0,0 +1,30 @@
+/**
+    Module for running scripts on behalf of other processes. `clox --serve <socket>` listens on a Unix domain socket
+    with a pool of worker threads. Each worker initializes a VM before it takes a connection, so a request pays for
+    neither process startup nor initVM(). A request is a script's source, or a path the server reads the script from.
+    The server streams back what the script prints and its error messages as they're written, then the status
+    `clox <path>` would have exited with. Once a request is done its VM is freed and a fresh one made ready, so
+    nothing a script defines is seen by the next, and requests on different workers run at the same time. With a
+    budget, a request that runs too long is stopped with the status `clox --budget` exits with
+
+    Messages both ways are frames: a tag byte, a 32 bit length in the host's byte order, and that many bytes. A
+    connection carries one request, which the server drops unread if it's longer than SERVE_REQUEST_MAX
+ */
+
+#ifndef clox_server_h
+#define clox_server_h
+
+#include "../shared/shared.h"
+
+#define SERVE_SOURCE 's'  // To the server: the script's source
+#define SERVE_PATH 'p'  // To the server: the path of the script, which the server reads
+#define SERVE_STDOUT 'o'  // To the client: output the script printed
+#define SERVE_STDERR 'e'  // To the client: compile and runtime errors
+#define SERVE_EXIT 'x'  // To the client: one byte, the exit status. Always the last frame
+
+#define SERVE_REQUEST_MAX (64 * 1024 * 1024)  // Longest request the server reads. Longer scripts are sent by path
+
+void runServer(const char* socketPath, int threadCount, SharedSegment* shared, uint64_t budget);
+int requestRun(const char* socketPath, char tag, const char* payload, size_t length, int outFd, int errFd);
+
+#endif
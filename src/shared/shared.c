@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "../memory/memory.h"
+#include "shared.h"
+#include "../vm/vm.h"
+
+/**
+    Run *prelude* in a scratch VM and take ownership of everything it left behind: its interned strings, its globals
+    (including the functions it defined, and with them their chunks and constant pools) and its heap. Returns NULL if
+    the prelude failed to compile or run
+ */
+SharedSegment* buildSharedSegment(const char* prelude, size_t length) {
+    VM* builder = malloc(sizeof(VM));
+    SharedSegment* segment = malloc(sizeof(SharedSegment));
+    if (builder == NULL || segment == NULL) {
+        fprintf(stderr, "Not enough memory to build the shared segment.\n");
+        exit(74);
+    }
+
+    initVM(builder);
+    if (interpret(builder, prelude, length) != INTERPRET_OK) {
+        freeVM(builder);
+        free(builder);
+        free(segment);
+        return NULL;
+    }
+
+    // Functions in the segment can run on many threads at once, so mark them to keep the VM from quickening them.
+    // Shapes, instances and arrays are marked so no VM adds transitions to them or writes fields or elements, and
+    // fibers so no VM runs them
+    for (Obj* object = builder->objects; object != NULL; object = object->next) {
+        switch (object->type) {
+            case OBJ_ARRAY:    ((ObjArray*)object)->shared = true; break;
+            case OBJ_FIBER:    ((ObjFiber*)object)->shared = true; break;
+            case OBJ_FUNCTION: ((ObjFunction*)object)->shared = true; break;
+            case OBJ_SHAPE:    ((ObjShape*)object)->shared = true; break;
+            case OBJ_INSTANCE: ((ObjInstance*)object)->shared = true; break;
+            default: break;
+        }
+    }
+
+    // Move the builder's tables and heap into the segment, then tear the builder down with nothing left in it
+    segment->strings = builder->strings;
+    segment->globals = builder->globals;
+    segment->objects = builder->objects;
+    segment->image = NULL;
+    segment->imageSize = 0;
+
+    initTable(&builder->strings);
+    initTable(&builder->globals);
+    builder->objects = NULL;
+
+    freeVM(builder);
+    free(builder);
+    return segment;
+}
+
+/**
+    Free a segment and everything in it. Only safe once no VM is attached to it anymore. A segment loaded from a
+    snapshot goes with its mapping
+ */
+void freeSharedSegment(SharedSegment* segment) {
+    if (segment->image != NULL) {
+        munmap(segment->image, segment->imageSize);
+        free(segment);
+        return;
+    }
+
+    freeTable(&segment->strings);
+    freeTable(&segment->globals);
+    freeObjectList(segment->objects);
+    free(segment);
+}
@@ -0,0 +1,28 @@
+/**
+    Module for the shared segment: strings and compiled code that many VMs can use at once. A segment is built once by
+    running a prelude script, then frozen. After that nothing in it is ever written, so any number of isolates can
+    read it from any thread without locks
+
+    A VM attached to a segment checks the segment's intern table before its own, so a string that exists in the
+    segment is never duplicated in the VM, and interned string identity still holds across both
+ */
+
+#ifndef clox_shared_h
+#define clox_shared_h
+
+#include "../common.h"
+#include "../table/table.h"
+#include "../value/value.h"
+
+typedef struct {
+    Table strings;  // Frozen intern table. Keys are the only copies of these strings in any attached VM
+    Table globals;  // Globals defined by the prelude. Copied into each attached VM's globals on startup
+    Obj* objects;  // Every object the prelude created. Owned by the segment and freed with it
+    void* image;  // Mapping of the snapshot the segment was loaded from, which holds all of the above. Or NULL
+    size_t imageSize;
+} SharedSegment;
+
+SharedSegment* buildSharedSegment(const char* prelude, size_t length);
+void freeSharedSegment(SharedSegment* segment);
+
+#endif
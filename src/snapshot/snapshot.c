@@ -0,0 +1,494 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../memory/memory.h"
+#include "../object/object.h"
+#include "../registers/registers.h"
+#include "snapshot.h"
+#include "../vm/vm.h"
+
+#define SNAPSHOT_MAGIC "cloxsnap"
+#define SNAPSHOT_VERSION 1
+#define BLOCK_ALIGNMENT 16  // Enough for any struct in the heap
+
+// Address pointers in an image are written for. Far from where Linux puts the binary, the heap and other mappings, so
+// it's nearly always free, and then nothing but the natives needs relocating
+#define SNAPSHOT_BASE ((uintptr_t)0x200000000000)
+
+/**
+    Start of an image. The blocks follow it, then the two relocation tables. Each relocation is the offset of a
+    pointer sized slot in the image: a pointer relocation holds a pointer into the image as if it were mapped at
+    SNAPSHOT_BASE, and a native relocation holds a native's offset from codeBase()
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;  // See layoutStamp()
+    uint64_t codeStamp;  // See codeStamp()
+    uint64_t segment;  // Offset of the SharedSegment
+    uint64_t relocations;
+    uint64_t relocationCount;
+    uint64_t natives;
+    uint64_t nativeCount;
+} SnapshotHeader;
+
+// A block of the heap being written, and where it goes in the image
+typedef struct {
+    const uint8_t* address;
+    size_t size;
+    size_t offset;
+} Block;
+
+typedef struct {
+    Block* blocks;  // Sorted by address once they've all been added
+    int blockCount;
+    int blockCapacity;
+    size_t size;  // Bytes of the image laid out so far
+    uint8_t* image;
+
+    uint64_t* relocations;
+    int relocationCount;
+    int relocationCapacity;
+    uint64_t* natives;
+    int nativeCount;
+    int nativeCapacity;
+    bool failed;  // Found a pointer to something outside the heap being written
+} Writer;
+
+static uintptr_t codeBase(void) {
+    return (uintptr_t)&loadSnapshot;
+}
+
+/**
+    Distance between two functions in different parts of the binary. It moves with nearly any change to the code in
+    between, which is the cheapest way to tell an image came from another build
+ */
+static uint64_t codeStamp(void) {
+    return (uint64_t)((uintptr_t)&interpret - codeBase());
+}
+
+// Hash of the sizes of everything an image holds, so a build with different struct layouts is caught too
+static uint32_t layoutStamp(void) {
+    size_t sizes[] = {
+        sizeof(void*), sizeof(Value), sizeof(Entry), sizeof(SharedSegment), sizeof(ObjString), sizeof(ObjFunction),
+        sizeof(ObjNative), sizeof(ObjClass), sizeof(ObjShape), sizeof(ObjInstance), sizeof(ObjArray),
+        sizeof(ObjFiber), sizeof(CallFrame), sizeof(PropertyCache), sizeof(RegisterCode)
+    };
+
+    uint32_t stamp = 2166136261u;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        stamp ^= (uint32_t)sizes[i];
+        stamp *= 16777619;
+    }
+    return stamp;
+}
+
+static size_t align(size_t size) {
+    return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+}
+
+static void addBlock(Writer* writer, const void* address, size_t size) {
+    if (address == NULL || size == 0) return;
+
+    if (writer->blockCount == writer->blockCapacity) {
+        int oldCapacity = writer->blockCapacity;
+        writer->blockCapacity = GROW_CAPACITY(oldCapacity);
+        writer->blocks = GROW_ARRAY(writer->blocks, Block, oldCapacity, writer->blockCapacity);
+    }
+
+    writer->size = align(writer->size);
+    writer->blocks[writer->blockCount++] = (Block){ address, size, writer->size };
+    writer->size += size;
+}
+
+static void addTableBlocks(Writer* writer, Table* table) {
+    addBlock(writer, table->entries, sizeof(Entry) * table->capacity);
+}
+
+/**
+    Add an object and every block it owns. Pointers it holds to other objects need no blocks of their own, since
+    every object is added in turn
+ */
+static void addObjectBlocks(Writer* writer, Obj* object) {
+    switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            addBlock(writer, array, sizeof(ObjArray));
+            addBlock(writer, array->values, sizeof(double) * array->count);
+            break;
+        }
+        case OBJ_CLASS:
+            addBlock(writer, object, sizeof(ObjClass));
+            break;
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            addBlock(writer, fiber, sizeof(ObjFiber));
+            addBlock(writer, fiber->stack, sizeof(Value) * fiber->stackCapacity);
+            addBlock(writer, fiber->frames, sizeof(CallFrame) * fiber->frameCapacity);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            addBlock(writer, function, sizeof(ObjFunction));
+            addBlock(writer, function->chunk.code, chunkBlockSize(&function->chunk));
+            if (function->registers != NULL) {
+                RegisterCode* registers = function->registers;
+                addBlock(writer, registers, sizeof(RegisterCode));
+                addBlock(writer, registers->code, registers->capacity);
+                addBlock(writer, registers->lines, sizeof(int) * registers->capacity);
+            }
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            addBlock(writer, instance, sizeof(ObjInstance));
+            #ifdef CLOX_FIELD_TABLES
+                addTableBlocks(writer, &instance->fields);
+            #else
+                addBlock(writer, instance->fields, sizeof(Value) * instance->capacity);
+            #endif
+            break;
+        }
+        case OBJ_NATIVE:
+            addBlock(writer, object, sizeof(ObjNative));
+            break;
+        case OBJ_SHAPE:
+            addBlock(writer, object, sizeof(ObjShape));
+            addTableBlocks(writer, &((ObjShape*)object)->transitions);
+            break;
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            addBlock(writer, string, sizeof(ObjString));
+            addBlock(writer, string->chars, string->length + 1);
+            break;
+        }
+    }
+}
+
+static int compareBlocks(const void* a, const void* b) {
+    const uint8_t* first = ((const Block*)a)->address;
+    const uint8_t* second = ((const Block*)b)->address;
+    return first < second ? -1 : first > second;
+}
+
+// Block that *address* points into, or NULL if it isn't in any of them
+static Block* findBlock(Writer* writer, const void* address) {
+    int low = 0;
+    int high = writer->blockCount - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        Block* block = &writer->blocks[middle];
+        if ((const uint8_t*)address < block->address) {
+            high = middle - 1;
+        } else if ((const uint8_t*)address >= block->address + block->size) {
+            low = middle + 1;
+        } else {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// Offset in the image of something in the heap being written, or 0 if it isn't in it
+static size_t imageOffset(Writer* writer, const void* address) {
+    Block* block = findBlock(writer, address);
+    if (block == NULL) return 0;
+    return block->offset + (size_t)((const uint8_t*)address - block->address);
+}
+
+// Where a field of the heap being written was copied to in the image
+static void* inImage(Writer* writer, const void* field) {
+    return writer->image + imageOffset(writer, field);
+}
+
+static void addRelocation(uint64_t** relocations, int* count, int* capacity, uint64_t slot) {
+    if (*count == *capacity) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *relocations = GROW_ARRAY(*relocations, uint64_t, oldCapacity, *capacity);
+    }
+    (*relocations)[(*count)++] = slot;
+}
+
+/**
+    Replace the copy of the pointer in *field* with where its target will be in the image, and record it for loading.
+    The target is found from *base*, the start of what it points into, which is only different from the target itself
+    for a pointer that can be one past the end of its block, like a stack top
+ */
+static void relocateFrom(Writer* writer, void* field, const void* base) {
+    const uint8_t* target = *(const uint8_t**)field;
+    if (target == NULL) return;  // Copied as it is
+
+    size_t offset = imageOffset(writer, base);
+    if (offset == 0) {
+        writer->failed = true;
+        return;
+    }
+
+    *(uintptr_t*)inImage(writer, field) = SNAPSHOT_BASE + offset + (size_t)(target - (const uint8_t*)base);
+    addRelocation(&writer->relocations, &writer->relocationCount, &writer->relocationCapacity,
+                  imageOffset(writer, field));
+}
+
+#define RELOCATE(writer, field) relocateFrom(writer, &(field), (field))
+
+static void relocateValues(Writer* writer, Value* values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (IS_OBJ(values[i])) RELOCATE(writer, values[i].as.obj);
+    }
+}
+
+static void relocateTable(Writer* writer, Table* table) {
+    RELOCATE(writer, table->entries);
+    for (int i = 0; i < table->capacity; i++) {
+        RELOCATE(writer, table->entries[i].key);
+        relocateValues(writer, &table->entries[i].value, 1);
+    }
+}
+
+static void relocateNative(Writer* writer, ObjNative* native) {
+    *(uintptr_t*)inImage(writer, &native->function) = (uintptr_t)native->function - codeBase();
+    addRelocation(&writer->natives, &writer->nativeCount, &writer->nativeCapacity,
+                  imageOffset(writer, &native->function));
+}
+
+static void relocateObject(Writer* writer, Obj* object) {
+    RELOCATE(writer, object->next);
+
+    switch (object->type) {
+        case OBJ_ARRAY:
+            RELOCATE(writer, ((ObjArray*)object)->values);
+            break;
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            RELOCATE(writer, klass->name);
+            RELOCATE(writer, klass->shape);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            RELOCATE(writer, fiber->function);
+            RELOCATE(writer, fiber->caller);
+            RELOCATE(writer, fiber->nextReady);
+            RELOCATE(writer, fiber->stack);
+            relocateFrom(writer, &fiber->stackTop, fiber->stack);
+            RELOCATE(writer, fiber->frames);
+            if (fiber->stack != NULL) relocateValues(writer, fiber->stack, (int)(fiber->stackTop - fiber->stack));
+
+            for (int i = 0; i < fiber->frameCount; i++) {
+                RELOCATE(writer, fiber->frames[i].function);
+                RELOCATE(writer, fiber->frames[i].ip);
+                RELOCATE(writer, fiber->frames[i].slots);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            Chunk* chunk = &function->chunk;
+            RELOCATE(writer, function->name);
+            // The rest of a compacted chunk is laid out after its code, and an empty part points at the block's end
+            RELOCATE(writer, chunk->code);
+            relocateFrom(writer, &chunk->lines, chunk->code);
+            relocateFrom(writer, &chunk->constants.values, chunk->code);
+            relocateFrom(writer, &chunk->caches, chunk->code);
+            relocateValues(writer, chunk->constants.values, chunk->constants.count);
+
+            for (int i = 0; i < chunk->cacheCount; i++) {
+                for (int way = 0; way < CACHE_WAYS; way++) {
+                    RELOCATE(writer, chunk->caches[i].shapes[way]);
+                    RELOCATE(writer, chunk->caches[i].next[way]);
+                }
+            }
+
+            if (function->registers != NULL) {
+                RELOCATE(writer, function->registers);
+                RELOCATE(writer, function->registers->code);
+                RELOCATE(writer, function->registers->lines);
+            }
+
+            // Machine code isn't written. A loaded function that's JIT compiled again gets it fresh
+            *(JitCode**)inImage(writer, &function->jit) = NULL;
+            *(bool*)inImage(writer, &function->jitTried) = false;
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            RELOCATE(writer, instance->klass);
+            #ifdef CLOX_FIELD_TABLES
+                relocateTable(writer, &instance->fields);
+            #else
+                RELOCATE(writer, instance->shape);
+                RELOCATE(writer, instance->fields);
+                relocateValues(writer, instance->fields, instance->shape->slotCount);
+            #endif
+            break;
+        }
+        case OBJ_NATIVE:
+            relocateNative(writer, (ObjNative*)object);
+            break;
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            RELOCATE(writer, shape->parent);
+            RELOCATE(writer, shape->name);
+            relocateTable(writer, &shape->transitions);
+            break;
+        }
+        case OBJ_STRING:
+            RELOCATE(writer, ((ObjString*)object)->chars);
+            break;
+    }
+}
+
+static void freeWriter(Writer* writer) {
+    FREE_ARRAY(Block, writer->blocks, writer->blockCapacity);
+    FREE_ARRAY(uint64_t, writer->relocations, writer->relocationCapacity);
+    FREE_ARRAY(uint64_t, writer->natives, writer->nativeCapacity);
+    free(writer->image);
+}
+
+/**
+    Write *segment* to an image at *path*. Returns false, having said why on stderr, if the segment holds a pointer
+    to anything outside itself or the file can't be written
+ */
+bool writeSnapshot(SharedSegment* segment, const char* path) {
+    Writer writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.size = sizeof(SnapshotHeader);
+
+    addBlock(&writer, segment, sizeof(SharedSegment));
+    addTableBlocks(&writer, &segment->strings);
+    addTableBlocks(&writer, &segment->globals);
+    for (Obj* object = segment->objects; object != NULL; object = object->next) {
+        addObjectBlocks(&writer, object);
+    }
+    qsort(writer.blocks, writer.blockCount, sizeof(Block), compareBlocks);
+    writer.size = align(writer.size);  // So the relocation tables after the blocks are aligned
+
+    writer.image = calloc(1, writer.size);
+    if (writer.image == NULL) {
+        fprintf(stderr, "Not enough memory to write a snapshot.\n");
+        exit(74);
+    }
+    for (int i = 0; i < writer.blockCount; i++) {
+        memcpy(writer.image + writer.blocks[i].offset, writer.blocks[i].address, writer.blocks[i].size);
+    }
+
+    relocateTable(&writer, &segment->strings);
+    relocateTable(&writer, &segment->globals);
+    RELOCATE(&writer, segment->objects);
+    *(void**)inImage(&writer, &segment->image) = NULL;
+    *(size_t*)inImage(&writer, &segment->imageSize) = 0;
+    for (Obj* object = segment->objects; object != NULL; object = object->next) {
+        relocateObject(&writer, object);
+    }
+
+    if (writer.failed) {
+        fprintf(stderr, "The prelude holds on to something outside its heap, so it can't be snapshot.\n");
+        freeWriter(&writer);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.layout = layoutStamp();
+    header.codeStamp = codeStamp();
+    header.segment = imageOffset(&writer, segment);
+    header.relocations = writer.size;
+    header.relocationCount = (uint64_t)writer.relocationCount;
+    header.natives = header.relocations + sizeof(uint64_t) * writer.relocationCount;
+    header.nativeCount = (uint64_t)writer.nativeCount;
+    memcpy(writer.image, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL &&
+                   fwrite(writer.image, 1, writer.size, file) == writer.size &&
+                   fwrite(writer.relocations, sizeof(uint64_t), writer.relocationCount, file) ==
+                       (size_t)writer.relocationCount &&
+                   fwrite(writer.natives, sizeof(uint64_t), writer.nativeCount, file) == (size_t)writer.nativeCount;
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (!written) fprintf(stderr, "Could not write snapshot \"%s\".\n", path);
+
+    freeWriter(&writer);
+    return written;
+}
+
+// Whether *bytes* start like an image. Says nothing about whether it will load
+bool isSnapshot(const char* bytes, size_t length) {
+    return length >= sizeof(SnapshotHeader) && memcmp(bytes, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1) == 0;
+}
+
+// Whether *count* aligned slots, at *offset* and after, are all within an image of *size* bytes
+static bool fits(uint64_t offset, uint64_t count, uint64_t size) {
+    return offset % sizeof(uint64_t) == 0 && offset <= size && count <= (size - offset) / sizeof(uint64_t);
+}
+
+// Add *base* to each slot in a relocation table. Returns false if a slot is outside the image
+static bool relocate(uint8_t* image, size_t size, uint64_t tableOffset, uint64_t count, uintptr_t base) {
+    const uint64_t* slots = (const uint64_t*)(image + tableOffset);
+    for (uint64_t i = 0; i < count; i++) {
+        if (!fits(slots[i], 1, size)) return false;
+        *(uintptr_t*)(image + slots[i]) += base;
+    }
+    return true;
+}
+
+/**
+    Map the image at *path* and relocate it into a segment, which is used just like one from buildSharedSegment().
+    Pages that nothing is relocated in stay shared with the page cache, and with every other process using the image.
+    Returns NULL, having said why on stderr, if the file can't be read or isn't an image from this build
+ */
+SharedSegment* loadSnapshot(const char* path) {
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (file < 0 || fstat(file, &info) != 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        if (file >= 0) close(file);
+        return NULL;
+    }
+
+    size_t size = (size_t)info.st_size;
+    uint8_t* image = size >= sizeof(SnapshotHeader) ?
+                     mmap((void*)SNAPSHOT_BASE, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) : MAP_FAILED;
+    close(file);  // The mapping keeps the file alive on its own
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Could not map snapshot \"%s\".\n", path);
+        return NULL;
+    }
+
+    SnapshotHeader* header = (SnapshotHeader*)image;
+    if (!isSnapshot((const char*)image, size) || header->version != SNAPSHOT_VERSION ||
+        header->layout != layoutStamp() || header->codeStamp != codeStamp() ||
+        !fits(header->relocations, header->relocationCount, size) ||
+        !fits(header->natives, header->nativeCount, size) ||
+        !fits(header->segment, sizeof(SharedSegment) / sizeof(uint64_t), size)) {
+        fprintf(stderr, "\"%s\" isn't a snapshot written by this build of clox.\n", path);
+        munmap(image, size);
+        return NULL;
+    }
+
+    // The address is only a hint, and if something else is already there the pointers are moved to where it went
+    uintptr_t moved = (uintptr_t)image - SNAPSHOT_BASE;
+    if ((moved != 0 && !relocate(image, size, header->relocations, header->relocationCount, moved)) ||
+        !relocate(image, size, header->natives, header->nativeCount, codeBase())) {
+        fprintf(stderr, "Snapshot \"%s\" is damaged.\n", path);
+        munmap(image, size);
+        return NULL;
+    }
+
+    SharedSegment* segment = malloc(sizeof(SharedSegment));
+    if (segment == NULL) {
+        fprintf(stderr, "Not enough memory to load a snapshot.\n");
+        exit(74);
+    }
+    memcpy(segment, image + header->segment, sizeof(SharedSegment));
+    segment->image = image;
+    segment->imageSize = size;
+    return segment;
+}
@@ -0,0 +1,25 @@
+/**
+    Module for snapshot images of a shared segment. Building a segment means scanning, compiling, running and
+    interning the whole prelude. A snapshot writes the result out instead: every object the prelude left behind, the
+    blocks they own (string characters, compacted chunks, fields, elements, table entries) and the segment's two
+    tables, copied byte for byte into one file, with each pointer replaced by its offset in the file.
+
+    Loading an image maps the file privately and adds the mapping's address to every pointer it recorded, which is a
+    single loop over a relocation table, so startup costs one mmap plus touching the pages that hold pointers.
+    Pointers to natives are stored relative to the binary's code in the same way. Nothing is compiled or interned
+
+    An image only works with the build of clox that wrote it, since it holds structs exactly as they're laid out in
+    memory and natives by where they are in the code. Loading checks for that as well as it cheaply can
+ */
+
+#ifndef clox_snapshot_h
+#define clox_snapshot_h
+
+#include "../common.h"
+#include "../shared/shared.h"
+
+bool writeSnapshot(SharedSegment* segment, const char* path);
+bool isSnapshot(const char* bytes, size_t length);
+SharedSegment* loadSnapshot(const char* path);
+
+#endif
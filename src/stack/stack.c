@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../region/region.h"
+#include "stack.h"
+
+/**
+    Reserve address space for a new stack and commit the first STACK_COMMIT_BYTES of it. The last page of the
+    reservation is never committed, so running off the end faults instead of silently writing into whatever is mapped
+    next
+ */
+void initValueStack(ValueStack* stack) {
+    void* region = reserveRegion(STACK_RESERVE_BYTES, &stack->reservedBytes);
+    if (region == NULL) {
+        fprintf(stderr, "Could not reserve memory for the value stack.\n");
+        exit(74);
+    }
+
+    stack->values = (Value*)region;
+    stack->limit = stack->values;
+
+    if (!ensureValueStack(stack, stack->values + STACK_COMMIT_BYTES / sizeof(Value))) {
+        fprintf(stderr, "Could not commit memory for the value stack.\n");
+        exit(74);
+    }
+}
+
+void freeValueStack(ValueStack* stack) {
+    releaseRegion(stack->values, stack->reservedBytes);
+
+    stack->values = NULL;
+    stack->limit = NULL;
+    stack->reservedBytes = 0;
+}
+
+/**
+    Make sure every slot below *top* is committed, growing the committed region if need be, by enough that a deep
+    recursion doesn't commit once per call. Returns false if *top* would reach into the guard page, which means the
+    stack has overflowed
+ */
+bool ensureValueStack(ValueStack* stack, Value* top) {
+    if (top <= stack->limit) return true;
+
+    size_t committed = commitRegion(stack->values, (size_t)((char*)stack->limit - (char*)stack->values),
+                                    (size_t)((char*)top - (char*)stack->values), STACK_COMMIT_BYTES,
+                                    stack->reservedBytes - pageSize());  // The last page is the guard page
+    if (committed == 0) return false;
+
+    stack->limit = (Value*)((char*)stack->values + committed);
+    return true;
+}
@@ -0,0 +1,28 @@
+/**
+    Module for the VM's value stack. The stack lives in one large region of address space that is reserved up front
+    and only backed by memory as it's needed, so growing it never moves it and pointers into it stay valid
+ */
+
+#ifndef clox_stack_h
+#define clox_stack_h
+
+#include "../common.h"
+#include "../value/value.h"
+
+// Address space reserved for a value stack. Only the committed prefix of this actually uses memory
+#define STACK_RESERVE_BYTES (64 * 1024 * 1024)
+
+// Memory committed when a stack is created, and the minimum amount committed each time it grows
+#define STACK_COMMIT_BYTES (64 * 1024)
+
+typedef struct {
+    Value* values;  // Base of the reserved region. Never moves
+    Value* limit;  // One past the last committed slot. Touching slots from here on will fault
+    size_t reservedBytes;  // Size of the whole reservation, including the trailing guard page
+} ValueStack;
+
+void initValueStack(ValueStack* stack);
+void freeValueStack(ValueStack* stack);
+bool ensureValueStack(ValueStack* stack, Value* top);
+
+#endif
@@ -6,7 +6,9 @@
 #include "table.h"
 #include "../value/value.h"
 
-#define TABLE_MAX_LOAD 0.75
+// Kept at half full so linear probing stays short: at three quarters, clustering made a lookup in a small table of
+// globals take seven probes. Capacities are always powers of two, so a mask stands in for the modulo
+#define TABLE_MAX_LOAD 0.5
 
 void initTable(Table* table) {
     table->count = 0;
@@ -25,7 +27,7 @@ void freeTable(Table* table) {
     to be done on Entries arrays that aren't part of Tables yet
  */
 static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
+    uint32_t index = key->hash & (capacity - 1);
     Entry* tombstone = NULL;
 
     // Probe until you find the entry or a bucket that can contain the new entry. Guaranteed to find entry or an empty
@@ -49,7 +51,7 @@ static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
             return entry;
         }
 
-        index = (index + 1) % capacity;
+        index = (index + 1) & (capacity - 1);
     }
 }
 
@@ -148,7 +150,7 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
     // If the table is empty, we definitely won't find it
     if (!table->entries) return NULL;
 
-    uint32_t index = hash % table->capacity;
+    uint32_t index = hash & (table->capacity - 1);
 
     for (;;) {
         Entry* entry = &(table->entries[index]);
@@ -162,6 +164,6 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
         }
 
         // Try the next slot
-        index = (index + 1) % table->capacity;
+        index = (index + 1) & (table->capacity - 1);
     }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "../object/object.h"
 #include "../memory/memory.h"
+#include "../output/output.h"
 #include "value.h"
 
 /*
@@ -38,21 +39,28 @@ void freeValueArray(ValueArray* array) {
 
 void printValue(Value value) {
     switch (value.type) {
-        case VAL_BOOL:   printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NIL:    printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        case VAL_BOOL:   AS_BOOL(value) ? writeOutput("true", 4) : writeOutput("false", 5); break;
+        case VAL_NIL:    writeOutput("nil", 3); break;
+        case VAL_NUMBER: writeNumber(AS_DOUBLE(value)); break;
+        case VAL_INT:    writeInteger(AS_INT(value)); break;
         case VAL_OBJ:    printObject(value); break;
     }
 }
 
 bool valuesEqual(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        if (IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+        return AS_NUMBER(a) == AS_NUMBER(b);  // A number in each form, or two doubles
+    }
+
     if (a.type != b.type) return false;
 
     // Can't compare structs with memcmps because of different padding values for different struct types
     switch (a.type) {
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL: return true;
-        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_NUMBER:
+        case VAL_INT: return false;  // Unreachable, numbers were compared above
         case VAL_OBJ:  {
             return AS_OBJ(a) == AS_OBJ(b);
         }
@@ -13,10 +13,17 @@
 typedef struct sObj Obj;
 typedef struct sObjString ObjString;
 
+/**
+    Lox has a single number type, but a number that is a whole number in int32 range is usually held as VAL_INT, so
+    loop counters and indices stay in integer arithmetic. Which form a number is in is never visible to a script:
+    operators work on both, results that don't fit an int32 (or would be -0) are doubles, and the two forms of the
+    same number are equal and print the same
+ */
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
-    VAL_NUMBER,
+    VAL_NUMBER,  // A double
+    VAL_INT,
     VAL_OBJ  // Any Lox value that lives in the heap at runtime
 } ValueType;
 
@@ -30,6 +37,7 @@ typedef struct {
     union {
         bool boolean;
         double number;
+        int32_t integer;
         Obj* obj;
     } as;
 } Value;
@@ -37,19 +45,32 @@ typedef struct {
 // Macros to check the ValueType of a Value
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
-#define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_NUMBER(value)  ((value).type == VAL_NUMBER || (value).type == VAL_INT)  // Either form
+#define IS_DOUBLE(value)  ((value).type == VAL_NUMBER)
+#define IS_INT(value)     ((value).type == VAL_INT)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
 
 // Macros to get C primitives out of Value *as* fields. Should always be guarded with the corresponding IS_TYPE macro
 #define AS_BOOL(value)    ((value).as.boolean)
-#define AS_NUMBER(value)  ((value).as.number)
+#define AS_NUMBER(value)  numberValue(value)  // Either form, as a double
+#define AS_DOUBLE(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
 #define AS_OBJ(value)     ((value).as.obj)
 
 // Macros to instantiate new Values from C primitives
 #define BOOL_VAL(value)   ((Value){ VAL_BOOL, { .boolean = value } })
 #define NIL_VAL           ((Value){ VAL_NIL, { .number = 0 } })
 #define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = value } })
-#define OBJ_VAL(value)    ((Value){ VAL_OBJ, { .obj = value } })
+#define INT_VAL(value)    ((Value){ VAL_INT, { .integer = value } })
+#define OBJ_VAL(object)   ((Value){ VAL_OBJ, { .obj = (Obj*)object } })
+
+/**
+    The value of a number in either form as a double. A function rather than a macro so its argument is only
+    evaluated once
+ */
+static inline double numberValue(Value value) {
+    return value.type == VAL_INT ? (double)value.as.integer : value.as.number;
+}
 
 typedef struct {
     int capacity;
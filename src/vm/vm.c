@@ -1,53 +1,325 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "../common.h"
+#include "../array/array.h"
 #include "../compiler/compiler.h"
 #include "../debug/debug.h"
+#include "../fiber/fiber.h"
+#include "../io/io.h"
+#include "../jit/jit.h"
 #include "../memory/memory.h"
 #include "../object/object.h"
+#include "../output/output.h"
+#include "../registers/registers.h"
 #include "vm.h"
 
 /**
     VM to interpret bytecode created by compiler
  */
 
-// Using a single global VM object for now. If we ever used clox as a production compiler,
-// instead pass a pointer to a VM to every function
-VM vm;
+// There is no global VM. Every function takes a pointer to the VM it operates on, so each VM is an isolated
+// interpreter with its own stack, globals, heap and intern table
 
-static void resetStack() {
-    vm.stackTop = vm.stack;
+/**
+    Native clock() function. Returns the elapsed processor time in seconds, mostly useful for benchmarking Lox code
+ */
+static bool clockNative(VM* vm, int argCount, Value* args, Value* result) {
+    *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+/**
+    Native string() function. Returns a number, boolean or nil as the string print would write, and a string as it is
+ */
+static bool stringNative(VM* vm, int argCount, Value* args, Value* result) {
+    if (argCount != 1) {
+        runtimeError(vm, "Expected 1 arguments but got %d.", argCount);
+        return false;
+    }
+
+    Value value = args[0];
+    if (IS_STRING(value)) {
+        *result = value;
+        return true;
+    }
+
+    char buffer[NUMBER_BUFFER_BYTES];
+    int length;
+    if (IS_NUMBER(value)) {
+        length = formatNumber(AS_NUMBER(value), buffer);
+    } else if (IS_BOOL(value)) {
+        length = AS_BOOL(value) ? 4 : 5;
+        memcpy(buffer, AS_BOOL(value) ? "true" : "false", (size_t)length);
+    } else if (IS_NIL(value)) {
+        length = 3;
+        memcpy(buffer, "nil", 3);
+    } else {
+        runtimeError(vm, "Argument to string() must be a number, string, boolean or nil.");
+        return false;
+    }
+
+    *result = OBJ_VAL(copyString(vm, buffer, length));
+    return true;
+}
+
+/**
+    Go back to the main script with an empty stack, leaving behind any fibers that were running
+ */
+static void resetStack(VM* vm) {
+    abandonFibers(vm);
+
+    vm->fiber = &vm->mainFiber;
+    vm->mainFiber.state = FIBER_RUNNING;
+    vm->frames = vm->mainFrames;
+    vm->frameCount = 0;
+    vm->frameCapacity = FRAMES_MAX;
+    vm->stackTop = vm->stack.values;
+    vm->stackLimit = vm->stack.limit;
 }
 
 /**
-    Prints an error message to stderr using a format string and any number of corresponding variables. Resets value
-    stack afterwards
+    Prints an error message to stderr (or the thread's output sink) using a format string and any number of
+    corresponding variables. Resets value stack afterwards. Natives report their errors with it too
  */
-static void runtimeError(const char* format, ...) {
+void runtimeError(VM* vm, const char* format, ...) {
+    flushOutput();  // Everything the script printed before the error comes first
+
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vprintError(format, args);
     va_end(args);
-    fputs("\n", stderr);
+    printError("\n");
+
+    // Print a stack trace from the innermost call outward, carrying on through the fibers that resumed this one
+    for (ObjFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        CallFrame* frames = fiber == vm->fiber ? vm->frames : fiber->frames;
+        int frameCount = fiber == vm->fiber ? vm->frameCount : fiber->frameCount;
 
-    size_t instruction = vm.ip - vm.chunk->code;
-    // Get line associated with error using the index of the byte
-    fprintf(stderr, "[line %d] in script\n", vm.chunk->lines[instruction]);
+        for (int i = frameCount - 1; i >= 0; i--) {
+            CallFrame* frame = &frames[i];
+            ObjFunction* function = frame->function;
 
-    resetStack();
+            // ip has already moved past the failed instruction, so -1 to get the line associated with the error
+            int line;
+            if (function->registers != NULL) {
+                line = function->registers->lines[frame->ip - function->registers->code - 1];
+            } else {
+                line = function->chunk.lines[frame->ip - function->chunk.code - 1];
+            }
+            printError("[line %d] in ", line);
+
+            if (function->name == NULL) {
+                printError("script\n");
+            } else {
+                printError("%s()\n", function->name->chars);
+            }
+        }
+    }
+
+    resetStack(vm);
 }
 
-void initVM() {
-    resetStack();
-    vm.objects = NULL;
-    initTable(&vm.strings);
+/**
+    Bind a C function to a global variable. Both the name and the native are pushed onto the stack while the globals
+    table is written to so that they'd be reachable if a garbage collection happened during tableSet
+ */
+static void defineNative(VM* vm, const char* name, NativeFn function) {
+    push(vm, OBJ_VAL(copyString(vm, name, (int)strlen(name))));
+    push(vm, OBJ_VAL(newNative(vm, function)));
+    tableSet(&vm->globals, AS_STRING(vm->stack.values[0]), vm->stack.values[1]);
+    pop(vm);
+    pop(vm);
+}
+
+static void defineNatives(VM* vm) {
+    defineNative(vm, "clock", clockNative);
+    defineNative(vm, "array", arrayNative);
+    defineNative(vm, "length", lengthNative);
+    defineNative(vm, "add", addNative);
+    defineNative(vm, "scale", scaleNative);
+    defineNative(vm, "greater", greaterNative);
+    defineNative(vm, "less", lessNative);
+    defineNative(vm, "sum", sumNative);
+    defineNative(vm, "dot", dotNative);
+    defineNative(vm, "min", minNative);
+    defineNative(vm, "max", maxNative);
+    defineNative(vm, "fiber", fiberNative);
+    defineNative(vm, "resume", resumeNative);
+    defineNative(vm, "yield", yieldNative);
+    defineNative(vm, "spawn", spawnNative);
+    defineNative(vm, "done", doneNative);
+    defineNative(vm, "readFile", readFileNative);
+    defineNative(vm, "writeFile", writeFileNative);
+    defineNative(vm, "string", stringNative);
 }
 
-void freeVM() {
-    freeTable(&vm.strings);
-    freeObjects();
+void initVM(VM* vm) {
+    initSharedVM(vm, NULL);
+}
+
+/**
+    Initialize a VM attached to a shared segment. The segment has to be attached before anything is interned, so a
+    string in the segment never gets a second copy in this VM. The prelude's globals become this VM's starting globals
+ */
+void initSharedVM(VM* vm, SharedSegment* shared) {
+    initValueStack(&vm->stack);
+
+    ObjFiber* main = &vm->mainFiber;
+    memset(main, 0, sizeof(ObjFiber));
+    main->obj.type = OBJ_FIBER;
+    main->stack = vm->stack.values;
+    vm->fiber = main;
+    vm->readyHead = NULL;
+    vm->readyTail = NULL;
+    vm->fiberSwitches = 0;
+    vm->io = NULL;
+    vm->ioBackend = IO_URING;
+    resetStack(vm);
+    vm->objects = NULL;
+    vm->shared = shared;
+    vm->shapeOverlays = NULL;
+    vm->shapeOverlayCount = 0;
+    vm->shapeOverlayCapacity = 0;
+    vm->jitEnabled = false;
+    vm->hotThreshold = HOT_THRESHOLD;
+    vm->tierUps = 0;
+    vm->budget = 0;
+    vm->fuel = UINT64_MAX;
+    vm->compileArena = NULL;
+    vm->lazyFunctions = false;
+
+    #ifdef DEBUG_DISPATCH_STATS
+        vm->dispatchCount = 0;
+        vm->previousInstruction = OP_RETURN;
+        memset(vm->pairCounts, 0, sizeof(vm->pairCounts));
+    #endif
+    initTable(&vm->globals);
+    initTable(&vm->strings);
+
+    // The segment's globals already hold the natives, or whatever the prelude defined in their place
+    if (shared != NULL) {
+        tableAddAll(&shared->globals, &vm->globals);
+    } else {
+        defineNatives(vm);
+    }
+}
+
+#ifdef DEBUG_DISPATCH_STATS
+/**
+    Print the total number of instructions dispatched and the most frequent pairs of consecutive instructions. Pairs
+    near the top of this list are the candidates for new superinstructions
+ */
+static void printDispatchStats(VM* vm) {
+    fprintf(stderr, "dispatched %llu instructions\n", (unsigned long long)vm->dispatchCount);
+
+    for (int rank = 0; rank < 10; rank++) {
+        int bestFirst = 0, bestSecond = 0;
+        for (int first = 0; first < UINT8_COUNT; first++) {
+            for (int second = 0; second < UINT8_COUNT; second++) {
+                if (vm->pairCounts[first][second] > vm->pairCounts[bestFirst][bestSecond]) {
+                    bestFirst = first;
+                    bestSecond = second;
+                }
+            }
+        }
+
+        uint64_t count = vm->pairCounts[bestFirst][bestSecond];
+        if (count == 0) break;
+
+        fprintf(stderr, "%12llu  %s, %s\n", (unsigned long long)count, opcodeName(bestFirst), opcodeName(bestSecond));
+        vm->pairCounts[bestFirst][bestSecond] = 0;  // So the next rank finds the next most frequent pair
+    }
+}
+#endif
+
+static uint64_t hotness(const FunctionProfile* profile) {
+    return (uint64_t)profile->calls + profile->backEdges;
+}
+
+static int compareProfiles(const void* a, const void* b) {
+    uint64_t hotnessA = hotness(a);
+    uint64_t hotnessB = hotness(b);
+    return hotnessA < hotnessB ? 1 : hotnessA > hotnessB ? -1 : 0;
+}
+
+/**
+    Fill *profiles* with the hotness counters of at most *capacity* of the VM's hottest functions, hottest first, and
+    return how many were filled in. Functions that were never called are left out
+ */
+int getProfile(VM* vm, FunctionProfile* profiles, int capacity) {
+    int count = 0;
+
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        if (object->type != OBJ_FUNCTION) continue;
+
+        ObjFunction* function = (ObjFunction*)object;
+        if (function->calls == 0) continue;
+
+        FunctionProfile profile;
+        profile.function = function;
+        profile.calls = function->calls;
+        profile.backEdges = function->backEdges;
+        profile.hot = hotness(&profile) >= vm->hotThreshold;
+        profile.compiled = function->jit != NULL;
+
+        if (count < capacity) {
+            profiles[count++] = profile;
+            continue;
+        }
+
+        // Full, so it only goes in if it's hotter than the coldest one kept so far
+        int coldest = 0;
+        for (int i = 1; i < count; i++) {
+            if (hotness(&profiles[i]) < hotness(&profiles[coldest])) coldest = i;
+        }
+        if (hotness(&profile) > hotness(&profiles[coldest])) profiles[coldest] = profile;
+    }
+
+    qsort(profiles, count, sizeof(FunctionProfile), compareProfiles);
+    return count;
+}
+
+#define PROFILE_ROWS 10
+
+/**
+    Print the hottest functions and the tier each one ended up in to stderr
+ */
+void printProfile(VM* vm) {
+    FunctionProfile profiles[PROFILE_ROWS];
+    int count = getProfile(vm, profiles, PROFILE_ROWS);
+
+    fprintf(stderr, "%d functions tiered up at %u calls plus back-edges\n", vm->tierUps, vm->hotThreshold);
+    fprintf(stderr, "%12s %12s  %-6s %s\n", "calls", "back-edges", "tier", "function");
+    for (int i = 0; i < count; i++) {
+        FunctionProfile* profile = &profiles[i];
+        ObjString* name = profile->function->name;
+        fprintf(stderr, "%12u %12u  %-6s %s\n", profile->calls, profile->backEdges,
+                profile->compiled ? "jit" : profile->hot ? "hot" : "cold", name != NULL ? name->chars : "<script>");
+    }
+}
+
+void freeVM(VM* vm) {
+    #ifdef DEBUG_DISPATCH_STATS
+        printDispatchStats(vm);
+    #endif
+    #ifdef DEBUG_ALLOCATION_STATS
+        printAllocationStats();
+    #endif
+
+    flushOutput();
+    if (vm->io != NULL) freeIoLoop(vm->io);  // Before the strings it may still be writing out are freed
+    freeTable(&vm->globals);
+    freeTable(&vm->strings);
+    for (int i = 0; i < vm->shapeOverlayCapacity; i++) {
+        if (vm->shapeOverlays[i].shape != NULL) freeTable(&vm->shapeOverlays[i].transitions);
+    }
+    FREE_ARRAY(ShapeOverlay, vm->shapeOverlays, vm->shapeOverlayCapacity);
+    freeObjects(vm);
+    freeValueStack(&vm->stack);
 }
 
 
@@ -56,23 +328,139 @@ void freeVM() {
 
     When pushing an Object, such as a string (StrObj), we read its Value constant struct from the constant array, which
     contains a pointer to the Object, which itself contains a pointer to the dynamically allocated value (in this case a
-    string). No
+    string).
+
+    There's no bounds check here. Every function knows the most stack it can ever use, and call() makes sure that much
+    is available before the function starts running
  */
-void push(Value value) {
-    *vm.stackTop = value;
-    vm.stackTop++;
+void push(VM* vm, Value value) {
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
-Value pop() {
-    vm.stackTop--;
-    return *vm.stackTop;
+Value pop(VM* vm) {
+    vm->stackTop--;
+    return *vm->stackTop;
 }
 
 /**
     Return but don't pop off the value at *distance* distance from the top of the stack
  */
-static Value peek(int distance) {
-    return vm.stackTop[-1 - distance];
+static Value peek(VM* vm, int distance) {
+    return vm->stackTop[-1 - distance];
+}
+
+/**
+    Tiering. Every call and every loop back-edge the interpreter runs counts towards a function's hotness, and once
+    calls plus back-edges reach vm->hotThreshold the function is tiered up, which hands it to the JIT if that's
+    enabled. A hot loop doesn't have to wait for the next call to benefit, because the interpreter can enter compiled
+    code at any instruction, and does so on the loop's next iteration.
+
+    Quickening has no threshold, since specializing an instruction costs no more than running it. Shared functions
+    are run by several threads at once, so they aren't counted, and they're never compiled anyway
+ */
+static void tierUp(VM* vm, ObjFunction* function) {
+    vm->tierUps++;
+    if (vm->jitEnabled && !function->jitTried) jitCompile(function);
+}
+
+/**
+    Metering. Like hotness, fuel is only spent on calls and loop back-edges, since a script can't run forever without
+    one or the other. With no budget the fuel starts at UINT64_MAX, which never runs out in practice, so the check is
+    the same decrement and well predicted branch either way.
+
+    The check comes after the call or jump has fully happened, with the new instruction pointer saved in the frame, so
+    returning INTERPRET_BUDGET_EXHAUSTED leaves the VM exactly where run() can pick it up again
+ */
+static void refuel(VM* vm) {
+    vm->fuel = vm->budget == 0 ? UINT64_MAX : vm->budget;
+}
+
+/**
+    Compile the body of a function that was only pre-parsed. A body with an error can't run, so the call fails like
+    any other runtime error, after the compile error itself is reported. The next call reports it again
+ */
+bool compileBody(VM* vm, ObjFunction* function) {
+    if (compileLazy(vm, function)) return true;
+
+    runtimeError(vm, "Could not compile %s().", function->name->chars);
+    return false;
+}
+
+/**
+    Set up a new CallFrame for *function*. The callee and its arguments are already on the stack, so the frame's slots
+    window just starts at the callee and nothing gets copied
+ */
+bool callFunction(VM* vm, ObjFunction* function, int argCount) {
+    if (function->lazy != NULL && !compileBody(vm, function)) return false;
+
+    if (argCount != function->arity) {
+        runtimeError(vm, "Expected %d arguments but got %d.", function->arity, argCount);
+        return false;
+    }
+
+    if (vm->frameCount == vm->frameCapacity && !growFrames(vm)) {
+        runtimeError(vm, "Stack overflow.");
+        return false;
+    }
+
+    Value* top = vm->stackTop - argCount - 1 + function->maxSlots;
+    if (top > vm->stackLimit && !growStack(vm, top)) {
+        runtimeError(vm, "Stack overflow.");
+        return false;
+    }
+
+    Value* slots = vm->stackTop - argCount - 1;  // Only once there's room, since a fiber's stack moves as it grows
+
+    if (!function->shared && ++function->calls + function->backEdges == vm->hotThreshold) tierUp(vm, function);
+
+    CallFrame* frame = &vm->frames[vm->frameCount++];
+    frame->function = function;
+    frame->ip = function->registers != NULL ? function->registers->code : function->chunk.code;
+    frame->slots = slots;
+    return true;
+}
+
+/**
+    Call a Lox or native function, or a class. Natives are handed a pointer to their arguments on the stack and run to
+    completion right away, then the callee and arguments are discarded and replaced with the result. Calling a class
+    replaces it with a new instance
+ */
+static bool callValue(VM* vm, Value callee, int argCount) {
+    if (IS_OBJ(callee)) {
+        switch (OBJ_TYPE(callee)) {
+            case OBJ_CLASS: {
+                if (argCount != 0) {
+                    runtimeError(vm, "Expected 0 arguments but got %d.", argCount);
+                    return false;
+                }
+
+                vm->stackTop[-1] = OBJ_VAL(newInstance(vm, AS_CLASS(callee)));  // In place of the class
+                return true;
+            }
+
+            case OBJ_FUNCTION:
+                return callFunction(vm, AS_FUNCTION(callee), argCount);
+
+            case OBJ_NATIVE: {
+                NativeFn native = AS_NATIVE(callee);
+                uint32_t switches = vm->fiberSwitches;
+                Value result;
+                if (!native(vm, argCount, vm->stackTop - argCount, &result)) return false;
+                if (vm->fiberSwitches != switches) return true;  // Switched fibers, and already took the call off the stack
+
+                vm->stackTop -= argCount + 1;
+                push(vm, result);
+                return true;
+            }
+
+            default:
+                break;  // Non-callable object type
+        }
+    }
+
+    runtimeError(vm, "Can only call functions and classes.");
+    return false;
 }
 
 /**
@@ -82,19 +470,391 @@ static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-    ObjString* a = AS_STRING(pop());
-    ObjString* b = AS_STRING(pop());
+/**
+    Arithmetic on two numbers held as ints. Each returns false when the result isn't an int, either because it
+    overflowed or because it's -0, and has to be computed in doubles instead
+ */
+static inline bool addInts(int32_t a, int32_t b, int32_t* result) {
+    return !__builtin_add_overflow(a, b, result);
+}
+
+static inline bool subtractInts(int32_t a, int32_t b, int32_t* result) {
+    return !__builtin_sub_overflow(a, b, result);
+}
+
+static inline bool multiplyInts(int32_t a, int32_t b, int32_t* result) {
+    return !__builtin_mul_overflow(a, b, result) && (*result != 0 || (a >= 0 && b >= 0));
+}
 
+/**
+    Negate a number in either form. Only zero and the smallest int don't have an int negation
+ */
+static inline Value negateNumber(Value value) {
+    if (IS_INT(value) && AS_INT(value) != 0 && AS_INT(value) != INT32_MIN) return INT_VAL(-AS_INT(value));
+    return NUMBER_VAL(-AS_NUMBER(value));
+}
+
+static ObjString* concatenateStrings(VM* vm, ObjString* a, ObjString* b) {
     int length = a->length + b->length;
     char* chars = ALLOCATE(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = takeString(chars, length);
-    push(OBJ_VAL(result));
+    return takeString(vm, chars, length);
+}
+
+static void concatenate(VM* vm) {
+    ObjString* b = AS_STRING(pop(vm));  // Right operand is on top of the stack
+    ObjString* a = AS_STRING(pop(vm));
+    push(vm, OBJ_VAL(concatenateStrings(vm, a, b)));
+}
+
+#ifndef CLOX_FIELD_TABLES
+/**
+    Inline cache miss. Finds *name* on an instance of *shape* and returns its slot, or -1 if the instance doesn't have
+    it. For a store, a missing field is added, and *next* is set to the shape the instance moves to. The other cache
+    entries are checked first, and if they miss too the shape is searched and the result added as a new entry, as long
+    as there's room. Caches of shared functions are never written, and neither are entries for storing to shared
+    shapes, so a store to a shared instance always comes through here
+ */
+static int lookupProperty(VM* vm, ObjFunction* function, PropertyCache* cache, ObjShape* shape, ObjString* name,
+                          bool store, ObjShape** next) {
+    for (int i = 1; i < cache->count; i++) {
+        if (cache->shapes[i] == shape) {
+            *next = cache->next[i];
+            return cache->slots[i];
+        }
+    }
+
+    *next = shape;
+    int slot = findSlot(shape, name);
+    if (slot == -1) {
+        if (!store) return -1;
+        *next = addField(vm, shape, name);
+        slot = shape->slotCount;
+    }
+
+    if (!function->shared && cache->count < CACHE_WAYS && !(store && shape->shared)) {
+        cache->shapes[cache->count] = shape;
+        cache->next[cache->count] = *next;
+        cache->slots[cache->count] = slot;
+        cache->count++;
+    }
+    return slot;
+}
+#endif
+
+/**
+    Read the property *name* of *instance* into *value*. Returns false if the instance doesn't have it
+ */
+static inline bool getProperty(VM* vm, ObjFunction* function, PropertyCache* cache, ObjInstance* instance,
+                               ObjString* name, Value* value) {
+    #ifdef CLOX_FIELD_TABLES
+        return tableGet(&instance->fields, name, value);
+    #else
+        ObjShape* shape = instance->shape;
+        int slot;
+        if (cache->shapes[0] == shape) {
+            slot = cache->slots[0];
+        } else {
+            ObjShape* next;
+            slot = lookupProperty(vm, function, cache, shape, name, false, &next);
+            if (slot == -1) return false;
+        }
+
+        *value = instance->fields[slot];
+        return true;
+    #endif
+}
+
+/**
+    Set the field *name* of *instance*, adding it if it's new. Returns false if the instance is shared, and read only
+ */
+static inline bool setProperty(VM* vm, ObjFunction* function, PropertyCache* cache, ObjInstance* instance,
+                               ObjString* name, Value value) {
+    #ifdef CLOX_FIELD_TABLES
+        if (instance->shared) return false;
+        tableSet(&instance->fields, name, value);
+        return true;
+    #else
+        ObjShape* shape = instance->shape;
+        ObjShape* next;
+        int slot;
+        if (cache->shapes[0] == shape) {
+            slot = cache->slots[0];
+            next = cache->next[0];
+        } else {
+            if (instance->shared) return false;
+            slot = lookupProperty(vm, function, cache, shape, name, true, &next);
+        }
+
+        if (next != shape) {
+            // Fields are added one at a time, so the new slot is at most one past the end
+            if (slot >= instance->capacity) {
+                int oldCapacity = instance->capacity;
+                instance->capacity = GROW_CAPACITY(oldCapacity);
+                instance->fields = GROW_ARRAY(instance->fields, Value, oldCapacity, instance->capacity);
+            }
+            instance->shape = next;
+        }
+
+        instance->fields[slot] = value;
+        return true;
+    #endif
+}
+
+/**
+    Find the element of *array* that *index* picks. Reports a runtime error and returns false if *array* isn't an
+    array, or *index* isn't a whole number within it. An int index in bounds is the fast path
+ */
+static inline bool elementIndex(VM* vm, Value array, Value index, int* element) {
+    if (!IS_ARRAY(array)) {
+        runtimeError(vm, "Only arrays can be indexed.");
+        return false;
+    }
+
+    int count = AS_ARRAY(array)->count;
+    if (IS_INT(index) && (uint32_t)AS_INT(index) < (uint32_t)count) {
+        *element = AS_INT(index);
+        return true;
+    }
+
+    if (!IS_NUMBER(index)) {
+        runtimeError(vm, "Array index must be a number.");
+        return false;
+    }
+
+    double position = AS_NUMBER(index);
+    if (!(position >= 0 && position < count)) {
+        runtimeError(vm, "Array index out of bounds.");
+        return false;
+    }
+    if (position != (int)position) {
+        runtimeError(vm, "Array index must be a whole number.");
+        return false;
+    }
+
+    *element = (int)position;
+    return true;
+}
+
+#ifdef CLOX_REGISTER_VM
+/**
+    Dispatch loop for register code. Runs for as long as the current frame has register code, and returns false when
+    a call or return lands in a frame that only has stack bytecode, for run() to carry on with. Returns true when the
+    program is over, with *result* set.
+
+    A register frame's registers are its stack slots, so frames of either kind call each other the same way: before a
+    call, the stack top is set just past the arguments, which already sit in consecutive registers
+ */
+static bool runRegisters(VM* vm, InterpretResult* result) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+
+    #define READ_BYTE() (*frame->ip++)
+    #define READ_REGISTER() (frame->slots[READ_BYTE()])
+    #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
+    #define READ_STRING() AS_STRING(READ_CONSTANT())
+
+    #define RUNTIME_ERROR(...) \
+        do { \
+            runtimeError(vm, __VA_ARGS__); \
+            *result = INTERPRET_RUNTIME_ERROR; \
+            return true; \
+        } while (false)
+
+    // R[dst] = *expression*, computed from number operands a and b. readB reads the right operand
+    #define NUMBER_OP(readB, expression) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value a = READ_REGISTER(); \
+            Value b = readB; \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) RUNTIME_ERROR("Operands must be numbers."); \
+            \
+            frame->slots[dst] = expression; \
+        } while (false)
+
+    // R[dst] = a op b. Two ints are combined with *intOp* (see addInts()), and anything else in doubles
+    #define ARITHMETIC_OP(readB, op, intOp) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value a = READ_REGISTER(); \
+            Value b = readB; \
+            int32_t combined; \
+            if (IS_INT(a) && IS_INT(b) && intOp(AS_INT(a), AS_INT(b), &combined)) { \
+                frame->slots[dst] = INT_VAL(combined); \
+                break; \
+            } \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) RUNTIME_ERROR("Operands must be numbers."); \
+            \
+            frame->slots[dst] = NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)
+
+    #define ADD_OP(readB) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value a = READ_REGISTER(); \
+            Value b = readB; \
+            int32_t sum; \
+            if (IS_INT(a) && IS_INT(b) && addInts(AS_INT(a), AS_INT(b), &sum)) { \
+                frame->slots[dst] = INT_VAL(sum); \
+            } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+                frame->slots[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)); \
+            } else if (IS_STRING(a) && IS_STRING(b)) { \
+                frame->slots[dst] = OBJ_VAL(concatenateStrings(vm, AS_STRING(a), AS_STRING(b))); \
+            } else { \
+                RUNTIME_ERROR("Operands must be two numbers or two strings."); \
+            } \
+        } while (false)
+
+    for (;;) {
+        #ifdef DEBUG_TRACE_EXECUTION
+            disassembleRegisterInstruction(frame->function->registers, &frame->function->chunk.constants,
+                                           (int)(frame->ip - frame->function->registers->code));
+        #endif
+
+        #ifdef DEBUG_DISPATCH_STATS
+            vm->dispatchCount++;
+        #endif
+
+        switch (READ_BYTE()) {
+            case REG_LOAD_CONSTANT: {
+                uint8_t dst = READ_BYTE();
+                frame->slots[dst] = READ_CONSTANT();
+                break;
+            }
+            case REG_LOAD_NIL:   frame->slots[READ_BYTE()] = NIL_VAL; break;
+            case REG_LOAD_TRUE:  frame->slots[READ_BYTE()] = BOOL_VAL(true); break;
+            case REG_LOAD_FALSE: frame->slots[READ_BYTE()] = BOOL_VAL(false); break;
+            case REG_MOVE: {
+                uint8_t dst = READ_BYTE();
+                frame->slots[dst] = READ_REGISTER();
+                break;
+            }
+
+            case REG_GET_GLOBAL: {
+                uint8_t dst = READ_BYTE();
+                ObjString* name = READ_STRING();
+                if (!tableGet(&vm->globals, name, &frame->slots[dst])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                break;
+            }
+            case REG_DEFINE_GLOBAL: {
+                Value value = READ_REGISTER();
+                tableSet(&vm->globals, READ_STRING(), value);
+                break;
+            }
+            case REG_SET_GLOBAL: {
+                Value value = READ_REGISTER();
+                ObjString* name = READ_STRING();
+                if (tableSet(&vm->globals, name, value)) {
+                    tableDelete(&vm->globals, name);
+                    RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                break;
+            }
+
+            case REG_EQUAL: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_REGISTER();
+                frame->slots[dst] = BOOL_VAL(valuesEqual(a, READ_REGISTER()));
+                break;
+            }
+            case REG_NOT_EQUAL: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_REGISTER();
+                frame->slots[dst] = BOOL_VAL(!valuesEqual(a, READ_REGISTER()));
+                break;
+            }
+            case REG_GREATER:       NUMBER_OP(READ_REGISTER(), BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b))); break;
+            case REG_GREATER_EQUAL: NUMBER_OP(READ_REGISTER(), BOOL_VAL(!(AS_NUMBER(a) < AS_NUMBER(b)))); break;
+            case REG_LESS:          NUMBER_OP(READ_REGISTER(), BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b))); break;
+            case REG_LESS_EQUAL:    NUMBER_OP(READ_REGISTER(), BOOL_VAL(!(AS_NUMBER(a) > AS_NUMBER(b)))); break;
+            case REG_ADD:           ADD_OP(READ_REGISTER()); break;
+            case REG_SUBTRACT:      ARITHMETIC_OP(READ_REGISTER(), -, subtractInts); break;
+            case REG_MULTIPLY:      ARITHMETIC_OP(READ_REGISTER(), *, multiplyInts); break;
+            case REG_DIVIDE:        NUMBER_OP(READ_REGISTER(), NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b))); break;
+
+            case REG_EQUAL_CONSTANT: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_REGISTER();
+                frame->slots[dst] = BOOL_VAL(valuesEqual(a, READ_CONSTANT()));
+                break;
+            }
+            case REG_GREATER_CONSTANT:  NUMBER_OP(READ_CONSTANT(), BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b))); break;
+            case REG_LESS_CONSTANT:     NUMBER_OP(READ_CONSTANT(), BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b))); break;
+            case REG_ADD_CONSTANT:      ADD_OP(READ_CONSTANT()); break;
+            case REG_SUBTRACT_CONSTANT: ARITHMETIC_OP(READ_CONSTANT(), -, subtractInts); break;
+            case REG_MULTIPLY_CONSTANT: ARITHMETIC_OP(READ_CONSTANT(), *, multiplyInts); break;
+
+            case REG_NOT: {
+                uint8_t dst = READ_BYTE();
+                frame->slots[dst] = BOOL_VAL(isFalsey(READ_REGISTER()));
+                break;
+            }
+            case REG_NEGATE: {
+                uint8_t dst = READ_BYTE();
+                Value value = READ_REGISTER();
+                if (!IS_NUMBER(value)) RUNTIME_ERROR("Operand must be a number.");
+
+                frame->slots[dst] = negateNumber(value);
+                break;
+            }
+
+            case REG_PRINT:
+                printValue(READ_REGISTER());
+                endOutputLine();
+                break;
+
+            case REG_CALL: {
+                uint8_t base = READ_BYTE();
+                int argCount = READ_BYTE();
+                vm->stackTop = frame->slots + base + argCount + 1;
+                if (!callValue(vm, frame->slots[base], argCount)) {
+                    *result = INTERPRET_RUNTIME_ERROR;
+                    return true;
+                }
+                if (--vm->fuel == 0) {
+                    *result = INTERPRET_BUDGET_EXHAUSTED;
+                    return true;
+                }
+
+                frame = &vm->frames[vm->frameCount - 1];
+                if (frame->function->registers == NULL) return false;
+                break;
+            }
+            case REG_RETURN: {
+                Value returned = READ_REGISTER();
+
+                vm->frameCount--;
+                vm->stackTop = frame->slots;
+                if (vm->frameCount == 0) {
+                    if (!finishFiber(vm, returned)) {
+                        *result = INTERPRET_OK;
+                        return true;
+                    }
+                } else {
+                    push(vm, returned);  // Into the caller's register that held the callee
+                }
+
+                frame = &vm->frames[vm->frameCount - 1];
+                if (frame->function->registers == NULL) return false;
+                break;
+            }
+        }
+    }
+
+    #undef READ_BYTE
+    #undef READ_REGISTER
+    #undef READ_CONSTANT
+    #undef READ_STRING
+    #undef RUNTIME_ERROR
+    #undef NUMBER_OP
+    #undef ARITHMETIC_OP
+    #undef ADD_OP
 }
+#endif
 
 /**
     Run a program. ~90% of clox's time will be spent inside this function
@@ -122,112 +882,631 @@ static void concatenate() {
         - Pop the previous value from th stack ()
         - Return that value (return 22)
  */
-static InterpretResult run() {
-    #define READ_BYTE() (*vm.ip++)
-    #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+static InterpretResult run(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];  // Cached so every instruction doesn't have to index vm->frames
 
-    // valueType refers to a value conversion macro
-    #define BINARY_OP(valueType, op) \
+    // Compiled code for the current frame, if any. Whenever compiled code hands an instruction back, the interpreter
+    // runs from *bailIp* until it moves past it. An instruction that deoptimized itself is re-dispatched in place, and
+    // re-entering compiled code there would just hand it straight back again
+    JitCode* jit = frame->function->jit;
+    uint8_t* bailIp = NULL;
+
+    #define READ_BYTE() (*frame->ip++)
+    #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
+    #define READ_STRING() AS_STRING(READ_CONSTANT())
+    #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+
+    // Quickening. Generic instructions rewrite themselves in place into a form specialized for the operand types they
+    // just saw, so the next run skips the type dispatch. The specialized form only guards its own types, and on a
+    // guard failure rewrites itself back to the generic form and re-runs that. Functions in a shared segment can be
+    // running on several threads at once, so their code is never rewritten
+    #define QUICKEN(quickOp) \
+        do { \
+            if (!frame->function->shared) frame->ip[-1] = quickOp; \
+        } while (false)
+
+    #define DEOPTIMIZE(genericOp) \
+        do { \
+            frame->ip--; \
+            *frame->ip = genericOp; \
+        } while (false)
+
+    // Arithmetic on two numbers. Two ints are combined with *intOp* (see addInts()), and the instruction quickens into
+    // its int form *intQuickOp*. Anything else, or a result that isn't an int, is computed in doubles, and other pairs
+    // of numbers quicken it into *quickOp*
+    #define ARITHMETIC_OP(op, intOp, intQuickOp, quickOp) \
         do { \
-            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-                runtimeError("Operands must be numbers."); \
+            Value a = vm->stackTop[-2]; \
+            Value b = vm->stackTop[-1]; \
+            if (IS_INT(a) && IS_INT(b)) { \
+                QUICKEN(intQuickOp); \
+                int32_t result; \
+                if (intOp(AS_INT(a), AS_INT(b), &result)) { \
+                    vm->stackTop--; \
+                    vm->stackTop[-1] = INT_VAL(result); \
+                    break; \
+                } \
+            } else if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+                runtimeError(vm, "Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
+            } else { \
+                QUICKEN(quickOp); \
             } \
             \
-            double b = AS_NUMBER(pop()); \
-            double a = AS_NUMBER(pop()); \
-            push(valueType(a op b)); \
-        } while (false)  // do while loop forces BINARY_OPs to be in their own scope
+            vm->stackTop--; \
+            vm->stackTop[-1] = NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)  // do while loop forces these macros to be in their own scope
+
+    // Comparison of two numbers. Ints compare exactly like the doubles they equal, so two ints are compared as ints
+    #define COMPARISON_OP(op, intQuickOp, quickOp) \
+        do { \
+            Value a = vm->stackTop[-2]; \
+            Value b = vm->stackTop[-1]; \
+            bool result; \
+            if (IS_INT(a) && IS_INT(b)) { \
+                QUICKEN(intQuickOp); \
+                result = AS_INT(a) op AS_INT(b); \
+            } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+                QUICKEN(quickOp); \
+                result = AS_NUMBER(a) op AS_NUMBER(b); \
+            } else { \
+                runtimeError(vm, "Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            vm->stackTop--; \
+            vm->stackTop[-1] = BOOL_VAL(result); \
+        } while (false)
+
+    // Quickened forms. On a guard failure the break leaves the do while loop, and the instruction is re-dispatched as
+    // *genericOp*. The _NUMBER forms hand two ints back too, so the generic form can quicken into the _INT form
+    #define BINARY_OP_NUMBER(valueType, op, genericOp) \
+        do { \
+            Value a = vm->stackTop[-2]; \
+            Value b = vm->stackTop[-1]; \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b) || (IS_INT(a) && IS_INT(b))) { \
+                DEOPTIMIZE(genericOp); \
+                break; \
+            } \
+            \
+            vm->stackTop--; \
+            vm->stackTop[-1] = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)
+
+    #define ARITHMETIC_OP_INT(intOp, genericOp) \
+        do { \
+            int32_t result; \
+            if (!IS_INT(vm->stackTop[-1]) || !IS_INT(vm->stackTop[-2]) || \
+                !intOp(AS_INT(vm->stackTop[-2]), AS_INT(vm->stackTop[-1]), &result)) { \
+                DEOPTIMIZE(genericOp); \
+                break; \
+            } \
+            \
+            vm->stackTop--; \
+            vm->stackTop[-1] = INT_VAL(result); \
+        } while (false)
+
+    #define COMPARISON_OP_INT(op, genericOp) \
+        do { \
+            if (!IS_INT(vm->stackTop[-1]) || !IS_INT(vm->stackTop[-2])) { \
+                DEOPTIMIZE(genericOp); \
+                break; \
+            } \
+            \
+            vm->stackTop--; \
+            vm->stackTop[-1] = BOOL_VAL(AS_INT(vm->stackTop[-1]) op AS_INT(vm->stackTop[0])); \
+        } while (false)
+
+    // Same as ARITHMETIC_OP and COMPARISON_OP, but the right operand comes from the constant table and the left
+    // operand is replaced in place. These aren't quickened, so they try doubles first (leaving the type alone), then
+    // ints, then the generic path
+    #define ARITHMETIC_OP_CONSTANT(op, intOp) \
+        do { \
+            Value* a = &vm->stackTop[-1]; \
+            const Value* b = &READ_CONSTANT(); \
+            int32_t result; \
+            if (IS_DOUBLE(*a) && IS_DOUBLE(*b)) { \
+                AS_DOUBLE(*a) = AS_DOUBLE(*a) op AS_DOUBLE(*b); \
+                break; \
+            } \
+            if (IS_INT(*a) && IS_INT(*b) && intOp(AS_INT(*a), AS_INT(*b), &result)) { \
+                *a = INT_VAL(result); \
+                break; \
+            } \
+            if (!IS_NUMBER(*a) || !IS_NUMBER(*b)) { \
+                runtimeError(vm, "Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            *a = NUMBER_VAL(AS_NUMBER(*a) op AS_NUMBER(*b)); \
+        } while (false)
+
+    #define COMPARISON_OP_CONSTANT(op) \
+        do { \
+            Value a = vm->stackTop[-1]; \
+            Value b = READ_CONSTANT(); \
+            if (IS_INT(a) && IS_INT(b)) { \
+                vm->stackTop[-1] = BOOL_VAL(AS_INT(a) op AS_INT(b)); \
+                break; \
+            } \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+                runtimeError(vm, "Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            vm->stackTop[-1] = BOOL_VAL(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)
+
+    // Negated comparison, for <= and >=. Computed as !(a op b) rather than with the opposite operator so NaN compares
+    // exactly like the OP_GREATER, OP_NOT sequence it replaces
+    #define NEGATED_COMPARISON(op) \
+        do { \
+            Value a = vm->stackTop[-2]; \
+            Value b = vm->stackTop[-1]; \
+            bool result; \
+            if (IS_INT(a) && IS_INT(b)) { \
+                result = !(AS_INT(a) op AS_INT(b)); \
+            } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+                result = !(AS_NUMBER(a) op AS_NUMBER(b)); \
+            } else { \
+                runtimeError(vm, "Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            vm->stackTop--; \
+            vm->stackTop[-1] = BOOL_VAL(result); \
+        } while (false)
+
+    // Compare and branch. *test* is the comparison of the numbers a and b that the fused instruction replaces, written
+    // the same way that instruction computes it, and the branch is taken when it's false. Two ints are compared as
+    // ints. Both operands are popped
+    #define BRANCH_ON(x, y, test) \
+        do { \
+            bool holds; \
+            if (IS_INT(x) && IS_INT(y)) { \
+                int32_t a = AS_INT(x); \
+                int32_t b = AS_INT(y); \
+                holds = (test); \
+            } else if (IS_NUMBER(x) && IS_NUMBER(y)) { \
+                double a = AS_NUMBER(x); \
+                double b = AS_NUMBER(y); \
+                holds = (test); \
+            } else { \
+                runtimeError(vm, "Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            \
+            if (!holds) frame->ip += offset; \
+        } while (false)
+
+    #define BRANCH_UNLESS(test) \
+        do { \
+            uint16_t offset = READ_SHORT(); \
+            Value x = vm->stackTop[-2]; \
+            Value y = vm->stackTop[-1]; \
+            vm->stackTop -= 2; \
+            BRANCH_ON(x, y, test); \
+        } while (false)
+
+    // Same as BRANCH_UNLESS, but b comes from the constant table and only a is popped
+    #define BRANCH_UNLESS_CONSTANT(test) \
+        do { \
+            Value y = READ_CONSTANT(); \
+            uint16_t offset = READ_SHORT(); \
+            Value x = vm->stackTop[-1]; \
+            vm->stackTop--; \
+            BRANCH_ON(x, y, test); \
+        } while (false)
 
     for (;;) {
+        #ifdef CLOX_REGISTER_VM
+            if (frame->function->registers != NULL) {
+                InterpretResult result;
+                if (runRegisters(vm, &result)) return result;
+
+                frame = &vm->frames[vm->frameCount - 1];
+                jit = frame->function->jit;
+            }
+        #endif
+
+        if (jit != NULL && frame->ip != bailIp) {
+            frame->ip = jitRun(vm, frame);
+            bailIp = frame->ip;
+        }
+
         #ifdef  DEBUG_TRACE_EXECUTION
-            printf("          ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-                printf("[ ");
+            printOutput("          ");
+            for (Value* slot = vm->fiber->stack; slot < vm->stackTop; slot++) {
+                printOutput("[ ");
                 printValue(*slot);
-                printf(" ]");
+                printOutput(" ]");
             }
-            printf("\n");
-            disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));  // Get address OFFSET between start of code chunk and current instruction
+            printOutput("\n");
+            disassembleInstruction(&frame->function->chunk,
+                                   (int)(frame->ip - frame->function->chunk.code));  // Get address OFFSET between start of code chunk and current instruction
+        #endif
+
+        #ifdef DEBUG_DISPATCH_STATS
+            vm->dispatchCount++;
+            vm->pairCounts[vm->previousInstruction][*frame->ip]++;
+            vm->previousInstruction = *frame->ip;
         #endif
 
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                push(vm, constant);
+                break;
+            }
+            case OP_NIL: push(vm, NIL_VAL); break;
+            case OP_TRUE: push(vm, BOOL_VAL(true)); break;
+            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
+            case OP_POP: pop(vm); break;
+
+            case OP_GET_LOCAL: {
+                uint8_t slot = READ_BYTE();
+                push(vm, frame->slots[slot]);
+                break;
+            }
+            case OP_SET_LOCAL: {
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = peek(vm, 0);  // Assignment is an expression, so leave the value on the stack
+                break;
+            }
+            case OP_GET_GLOBAL: {
+                ObjString* name = READ_STRING();
+                Value value;
+                if (!tableGet(&vm->globals, name, &value)) {
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(vm, value);
+                break;
+            }
+            case OP_DEFINE_GLOBAL: {
+                ObjString* name = READ_STRING();
+                tableSet(&vm->globals, name, peek(vm, 0));
+                pop(vm);
+                break;
+            }
+            case OP_SET_GLOBAL: {
+                ObjString* name = READ_STRING();
+                if (tableSet(&vm->globals, name, peek(vm, 0))) {
+                    // Assigning to an undefined global is an error, so undo the accidental definition
+                    tableDelete(&vm->globals, name);
+                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 break;
             }
-            case OP_NIL: push(NIL_VAL); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
 
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
 
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
+            case OP_GREATER:  COMPARISON_OP(>, OP_GREATER_INT, OP_GREATER_NUMBER); break;
+            case OP_LESS:     COMPARISON_OP(<, OP_LESS_INT, OP_LESS_NUMBER); break;
             case OP_ADD: {  // Handle both number addition and string concatenation
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    QUICKEN(OP_ADD_STRING);
+                    concatenate(vm);
+                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    ARITHMETIC_OP(+, addInts, OP_ADD_INT, OP_ADD_NUMBER);
                 } else {
-                    runtimeError("Operands must be two numbers or two strings.");
+                    runtimeError(vm, "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SUBTRACT: ARITHMETIC_OP(-, subtractInts, OP_SUBTRACT_INT, OP_SUBTRACT_NUMBER); break;
+            case OP_MULTIPLY: ARITHMETIC_OP(*, multiplyInts, OP_MULTIPLY_INT, OP_MULTIPLY_NUMBER); break;
+            case OP_DIVIDE: {  // Always a double, so there's no int form
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) {
+                    runtimeError(vm, "Operands must be numbers.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
+
+                QUICKEN(OP_DIVIDE_NUMBER);
+                vm->stackTop--;
+                vm->stackTop[-1] = NUMBER_VAL(AS_NUMBER(vm->stackTop[-1]) / AS_NUMBER(vm->stackTop[0]));
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
+
+            case OP_GREATER_NUMBER:  BINARY_OP_NUMBER(BOOL_VAL, >, OP_GREATER); break;
+            case OP_LESS_NUMBER:     BINARY_OP_NUMBER(BOOL_VAL, <, OP_LESS); break;
+            case OP_ADD_NUMBER:      BINARY_OP_NUMBER(NUMBER_VAL, +, OP_ADD); break;
+            case OP_SUBTRACT_NUMBER: BINARY_OP_NUMBER(NUMBER_VAL, -, OP_SUBTRACT); break;
+            case OP_MULTIPLY_NUMBER: BINARY_OP_NUMBER(NUMBER_VAL, *, OP_MULTIPLY); break;
+            case OP_DIVIDE_NUMBER:
+                if (!IS_NUMBER(vm->stackTop[-1]) || !IS_NUMBER(vm->stackTop[-2])) {
+                    DEOPTIMIZE(OP_DIVIDE);
+                    break;
+                }
+
+                vm->stackTop--;
+                vm->stackTop[-1] = NUMBER_VAL(AS_NUMBER(vm->stackTop[-1]) / AS_NUMBER(vm->stackTop[0]));
+                break;
+            case OP_GREATER_INT:  COMPARISON_OP_INT(>, OP_GREATER); break;
+            case OP_LESS_INT:     COMPARISON_OP_INT(<, OP_LESS); break;
+            case OP_ADD_INT:      ARITHMETIC_OP_INT(addInts, OP_ADD); break;
+            case OP_SUBTRACT_INT: ARITHMETIC_OP_INT(subtractInts, OP_SUBTRACT); break;
+            case OP_MULTIPLY_INT: ARITHMETIC_OP_INT(multiplyInts, OP_MULTIPLY); break;
+            case OP_ADD_STRING:
+                if (!IS_STRING(peek(vm, 0)) || !IS_STRING(peek(vm, 1))) {
+                    DEOPTIMIZE(OP_ADD);
+                    break;
+                }
+
+                concatenate(vm);
+                break;
             case OP_NOT:
-                push(BOOL_VAL(isFalsey(pop())));
+                push(vm, BOOL_VAL(isFalsey(pop(vm))));
                 break;
             case OP_NEGATE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtimeError(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                vm->stackTop[-1] = negateNumber(vm->stackTop[-1]);
+                break;
+            case OP_NOT_EQUAL: {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(!valuesEqual(a, b)));
+                break;
+            }
+            case OP_GREATER_EQUAL: NEGATED_COMPARISON(<); break;
+            case OP_LESS_EQUAL:    NEGATED_COMPARISON(>); break;
+            case OP_EQUAL_CONSTANT: {
+                Value b = READ_CONSTANT();
+                vm->stackTop[-1] = BOOL_VAL(valuesEqual(vm->stackTop[-1], b));
                 break;
+            }
+            case OP_GREATER_CONSTANT: COMPARISON_OP_CONSTANT(>); break;
+            case OP_LESS_CONSTANT:    COMPARISON_OP_CONSTANT(<); break;
+            case OP_ADD_CONSTANT: {
+                Value* a = &vm->stackTop[-1];
+                const Value* b = &READ_CONSTANT();
+                int32_t sum;
+                if (IS_DOUBLE(*a) && IS_DOUBLE(*b)) {  // Checked first, and only the payload changes
+                    AS_DOUBLE(*a) = AS_DOUBLE(*a) + AS_DOUBLE(*b);
+                } else if (IS_INT(*a) && IS_INT(*b) && addInts(AS_INT(*a), AS_INT(*b), &sum)) {
+                    *a = INT_VAL(sum);
+                } else if (IS_NUMBER(*a) && IS_NUMBER(*b)) {
+                    *a = NUMBER_VAL(AS_NUMBER(*a) + AS_NUMBER(*b));
+                } else if (IS_STRING(*a) && IS_STRING(*b)) {
+                    push(vm, *b);
+                    concatenate(vm);
+                } else {
+                    runtimeError(vm, "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SUBTRACT_CONSTANT: ARITHMETIC_OP_CONSTANT(-, subtractInts); break;
+            case OP_MULTIPLY_CONSTANT: ARITHMETIC_OP_CONSTANT(*, multiplyInts); break;
+            case OP_PRINT: {
+                printValue(pop(vm));
+                endOutputLine();
+                break;
+            }
+            case OP_JUMP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(peek(vm, 0))) frame->ip += offset;
+                break;
+            }
+            case OP_LOOP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip -= offset;
+
+                ObjFunction* function = frame->function;
+                if (!function->shared && ++function->backEdges + function->calls == vm->hotThreshold) {
+                    tierUp(vm, function);
+                    jit = function->jit;
+                }
+                if (--vm->fuel == 0) return INTERPRET_BUDGET_EXHAUSTED;
+                break;
+            }
+            case OP_JUMP_IF_NOT_EQUAL: {
+                uint16_t offset = READ_SHORT();
+                bool equal = valuesEqual(vm->stackTop[-2], vm->stackTop[-1]);
+                vm->stackTop -= 2;
+                if (!equal) frame->ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_EQUAL: {
+                uint16_t offset = READ_SHORT();
+                bool equal = valuesEqual(vm->stackTop[-2], vm->stackTop[-1]);
+                vm->stackTop -= 2;
+                if (equal) frame->ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_NOT_GREATER:       BRANCH_UNLESS(a > b); break;
+            case OP_JUMP_IF_NOT_GREATER_EQUAL: BRANCH_UNLESS(!(a < b)); break;
+            case OP_JUMP_IF_NOT_LESS:          BRANCH_UNLESS(a < b); break;
+            case OP_JUMP_IF_NOT_LESS_EQUAL:    BRANCH_UNLESS(!(a > b)); break;
+            case OP_JUMP_IF_NOT_EQUAL_CONSTANT: {
+                Value constant = READ_CONSTANT();
+                uint16_t offset = READ_SHORT();
+                vm->stackTop--;
+                if (!valuesEqual(vm->stackTop[0], constant)) frame->ip += offset;
+                break;
+            }
+            case OP_JUMP_IF_NOT_GREATER_CONSTANT: BRANCH_UNLESS_CONSTANT(a > b); break;
+            case OP_JUMP_IF_NOT_LESS_CONSTANT:    BRANCH_UNLESS_CONSTANT(a < b); break;
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                if (!callValue(vm, peek(vm, argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (--vm->fuel == 0) return INTERPRET_BUDGET_EXHAUSTED;
+                frame = &vm->frames[vm->frameCount - 1];
+                jit = frame->function->jit;
+                break;
+            }
             case OP_RETURN: {
-                printValue(pop());
-                printf("\n");
-                return INTERPRET_OK;  // TODO: Switch to return from function rather than end program execution
+                Value result = pop(vm);
+
+                vm->frameCount--;
+                if (vm->frameCount == 0) {
+                    // The script or a fiber has returned. Carry on with whichever fiber is waiting for it, if any
+                    if (!finishFiber(vm, result)) return INTERPRET_OK;
+
+                    frame = &vm->frames[vm->frameCount - 1];
+                    jit = frame->function->jit;
+                    break;
+                }
+
+                // Discard the callee's whole window of slots and leave the return value in place of the callee
+                vm->stackTop = frame->slots;
+                push(vm, result);
+
+                frame = &vm->frames[vm->frameCount - 1];
+                jit = frame->function->jit;
+                break;
+            }
+            case OP_CLASS:
+                push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
+                break;
+            case OP_GET_PROPERTY: {
+                ObjString* name = READ_STRING();
+                PropertyCache* cache = &frame->function->chunk.caches[READ_SHORT()];
+                if (!IS_INSTANCE(peek(vm, 0))) {
+                    runtimeError(vm, "Only instances have properties.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (!getProperty(vm, frame->function, cache, AS_INSTANCE(peek(vm, 0)), name, &vm->stackTop[-1])) {
+                    runtimeError(vm, "Undefined property '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                ObjString* name = READ_STRING();
+                PropertyCache* cache = &frame->function->chunk.caches[READ_SHORT()];
+                if (!IS_INSTANCE(peek(vm, 1))) {
+                    runtimeError(vm, "Only instances have fields.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (!setProperty(vm, frame->function, cache, AS_INSTANCE(peek(vm, 1)), name, peek(vm, 0))) {
+                    runtimeError(vm, "Cannot set fields of a shared instance.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // The assignment's value is its result, in place of the instance
+                vm->stackTop[-2] = vm->stackTop[-1];
+                vm->stackTop--;
+                break;
+            }
+            case OP_GET_INDEX: {
+                int element;
+                if (!elementIndex(vm, peek(vm, 1), peek(vm, 0), &element)) return INTERPRET_RUNTIME_ERROR;
+
+                vm->stackTop[-2] = NUMBER_VAL(AS_ARRAY(peek(vm, 1))->values[element]);
+                vm->stackTop--;
+                break;
+            }
+            case OP_SET_INDEX: {
+                int element;
+                if (!elementIndex(vm, peek(vm, 2), peek(vm, 1), &element)) return INTERPRET_RUNTIME_ERROR;
+
+                ObjArray* array = AS_ARRAY(peek(vm, 2));
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtimeError(vm, "Array elements must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (array->shared) {
+                    runtimeError(vm, "Cannot set elements of a shared array.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                array->values[element] = AS_NUMBER(peek(vm, 0));
+                vm->stackTop[-3] = vm->stackTop[-1];  // The assigned value is the result
+                vm->stackTop -= 2;
+                break;
             }
         }
     }
 
     #undef READ_BYTE
     #undef READ_CONSTANT
-    #undef BINARY_OP
+    #undef READ_STRING
+    #undef READ_SHORT
+    #undef QUICKEN
+    #undef DEOPTIMIZE
+    #undef ARITHMETIC_OP
+    #undef COMPARISON_OP
+    #undef BINARY_OP_NUMBER
+    #undef ARITHMETIC_OP_INT
+    #undef COMPARISON_OP_INT
+    #undef ARITHMETIC_OP_CONSTANT
+    #undef COMPARISON_OP_CONSTANT
+    #undef NEGATED_COMPARISON
+    #undef BRANCH_ON
+    #undef BRANCH_UNLESS
+    #undef BRANCH_UNLESS_CONSTANT
+}
+
+static InterpretResult runScript(VM* vm, ObjFunction* script) {
+    resetStack(vm);  // Abandons a script that ran out of budget and was never resumed
+    push(vm, OBJ_VAL(script));  // The script function sits in stack slot zero, like the callee of any other call
+    if (!callValue(vm, OBJ_VAL(script), 0)) return INTERPRET_RUNTIME_ERROR;  // No room for the script's stack
+
+    return run(vm);
 }
 
 /**
-    Interpret a single chunk in the vm
+    Compile source code into a top level script function and run it in the vm, for at most vm->budget back-edges
+    plus calls
  */
-InterpretResult interpret(const char* source) {
-    Chunk chunk;
-    initChunk(&chunk);
+InterpretResult interpret(VM* vm, const char* source, size_t length) {
+    ObjFunction* function = compile(vm, source, length);
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
-    }
+    refuel(vm);
+    return runScript(vm, function);
+}
+
+/**
+    Compile and run one entry of an interactive session. See compileEntry(), including for *incomplete*, which is set
+    instead of reporting a compile error when the entry needs more source
+ */
+InterpretResult interpretEntry(VM* vm, ReplSession* session, const char* source, size_t length, bool* incomplete) {
+    ObjFunction* function = compileEntry(session, source, length, incomplete);
+    if (function == NULL) return INTERPRET_COMPILE_ERROR;
+
+    refuel(vm);
+    return runScript(vm, function);
+}
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+/**
+    Carry on with a script that returned INTERPRET_BUDGET_EXHAUSTED, with a fresh vm->budget. The VM can be given
+    something else to run in between, so one thread can take turns running many VMs
+ */
+InterpretResult resumeInterpret(VM* vm) {
+    if (vm->frameCount == 0) return INTERPRET_OK;  // Nothing left to run
 
-    InterpretResult result = run();
+    refuel(vm);
+    return run(vm);
+}
 
-    freeChunk(&chunk);
-    return result;
+/**
+    Compile and run source code one top level declaration at a time. See compileStream(). The rest of the source
+    isn't compiled yet when a declaration is stopped part way, so streamed scripts always run without a budget
+ */
+InterpretResult interpretStream(VM* vm, const char* source, size_t length, bool mappedSource) {
+    vm->fuel = UINT64_MAX;
+    return compileStream(vm, source, length, mappedSource, runScript);
 }
\ No newline at end of file
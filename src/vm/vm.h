@@ -1,34 +1,115 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include "../arena/arena.h"
 #include "../chunk/chunk.h"
+#include "../io/io.h"
+#include "../object/object.h"
+#include "../shared/shared.h"
+#include "../stack/stack.h"
 #include "../value/value.h"
 #include "../table/table.h"
 
-#define STACK_MAX 256
+// Compiler state of an interactive session, see compileEntry()
+typedef struct sReplSession ReplSession;
 
+#define FRAMES_MAX 64
+#define HOT_THRESHOLD 1000  // Default number of calls plus loop iterations after which a function counts as hot
+
+/**
+    A single ongoing function call. *slots* points into the VM's value stack at the first slot the function can use
+    (slot zero holds the callee itself, followed by the arguments). Arguments are never copied - the caller pushes them
+    and the callee's locals simply start where they already are
+ */
+struct sCallFrame {
+    ObjFunction* function;
+    uint8_t* ip;  // Caller's instruction pointer is saved here while it calls another function
+    Value* slots;
+};
+
+/**
+    Transitions a VM has added to a shared shape, which can't be written to itself. See addField()
+ */
 typedef struct {
-    Chunk* chunk;
-    uint8_t* ip;  // Instruction Pointer. Pointer to the location of the NEXT instruction in the bytecode array. Faster to deref a pointer than get array index
-    Value stack[STACK_MAX];
+    ObjShape* shape;  // The shared shape, or NULL if the entry is empty
+    Table transitions;  // Field name -> this VM's child shape that adds it
+} ShapeOverlay;
+
+/**
+    The fields up to *fiber* belong to whichever fiber is running. Switching fibers writes them back to the fiber
+    that's stopping and loads them from the one that's starting, and nothing else changes
+ */
+struct sVM {
+    CallFrame* frames;
+    int frameCount;  // Current height of the CallFrame stack
+    int frameCapacity;  // FRAMES_MAX for the main script. Fibers start with fewer and grow up to it
     Value* stackTop;  // Like ip, points at value after last pushed stack value (or to 0 if nothing is on stack)
+    Value* stackLimit;  // End of the room the stack has now. Checked once per call against the callee's maxSlots
+    ObjFiber* fiber;  // Running fiber. &mainFiber while the main script runs
+
+    ObjFiber mainFiber;  // Never a Lox value. Its frames and stack are the two below
+    CallFrame mainFrames[FRAMES_MAX];
+    ValueStack stack;  // The main script's stack. Grows on demand without moving
+    ObjFiber* readyHead;  // Queue of spawned fibers, and fibers that yielded to them, waiting to run
+    ObjFiber* readyTail;
+    uint32_t fiberSwitches;  // Bumped on every switch, so callValue() can tell a native switched fibers
+    IoLoop* io;  // Event loop for readFile() and writeFile(). NULL until a fiber first needs it
+    IoBackend ioBackend;
+
+    Table globals;
     Table strings;  // A hash set of interned strings to make value comparison == identity coparison
+    SharedSegment* shared;  // Read only strings and prelude globals shared with other VMs. NULL if not attached
+    ShapeOverlay* shapeOverlays;  // Open addressed by shape. NULL until a field is first added to a shared shape
+    int shapeOverlayCount;
+    int shapeOverlayCapacity;
+    bool jitEnabled;  // Compile functions to machine code once they're hot
+    uint32_t hotThreshold;  // Calls plus loop back-edges before a function is tiered up
+    int tierUps;  // Functions that have reached the hot threshold
+    uint64_t budget;  // Back-edges plus calls each interpret() or resumeInterpret() may run. 0 for no limit
+    uint64_t fuel;  // What's left of the budget. Checked only on back-edges and calls
+    Arena* compileArena;  // Lent to the compiler and reset instead of freed, to skip reserving one per compile. Or NULL
+    bool lazyFunctions;  // Only pre-parse function bodies when compiling, and compile each one on its first call
 
     Obj* objects;  // Pointer to first object in linked list of heap objects. Temp fix to keep track of memory before implementing GC
-} VM;
+
+#ifdef DEBUG_DISPATCH_STATS
+    uint64_t dispatchCount;
+    uint64_t pairCounts[UINT8_COUNT][UINT8_COUNT];  // pairCounts[a][b] is how many times instruction b ran right after a
+    uint8_t previousInstruction;
+#endif
+};
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_BUDGET_EXHAUSTED  // Stopped part way with every frame intact. resumeInterpret() carries on
 } InterpretResult;
 
-extern VM vm;  // Expose the VM defined in vm.c to other modules
+/**
+    Hotness counters of one function, as reported by getProfile()
+ */
+typedef struct {
+    ObjFunction* function;
+    uint32_t calls;
+    uint32_t backEdges;
+    bool hot;  // Reached the hot threshold and was tiered up
+    bool compiled;  // Running as machine code
+} FunctionProfile;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+void initVM(VM* vm);
+void initSharedVM(VM* vm, SharedSegment* shared);
+void freeVM(VM* vm);
+InterpretResult interpret(VM* vm, const char* source, size_t length);
+InterpretResult interpretStream(VM* vm, const char* source, size_t length, bool mappedSource);
+InterpretResult interpretEntry(VM* vm, ReplSession* session, const char* source, size_t length, bool* incomplete);
+InterpretResult resumeInterpret(VM* vm);
+int getProfile(VM* vm, FunctionProfile* profiles, int capacity);
+void printProfile(VM* vm);
+void runtimeError(VM* vm, const char* format, ...);
+bool compileBody(VM* vm, ObjFunction* function);
+bool callFunction(VM* vm, ObjFunction* function, int argCount);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif